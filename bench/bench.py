@@ -0,0 +1,183 @@
+#!/usr/bin/env python3
+"""End-to-end benchmark of cgrep over a synthetic corpus.
+
+Runs every combination of pattern class, worker count and cache state a few
+times and writes one JSON record per combination (throughput in GB/s,
+files/s, p50/p99 wall time), so results from two commits can be compared
+with --baseline.
+"""
+import argparse
+import json
+import math
+import os
+import platform
+import subprocess
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import corpus  # noqa: E402
+
+# Each class stresses a different engine: the literal memmem path, the
+# case-folded literal path, PCRE2 behind a prefilter, and line-number counting.
+PATTERNS = {
+    "literal": ["timeout"],
+    "ignore-case": ["-i", "TIMEOUT"],
+    "regex": [r"\b(?:ERROR|[Ee]rror)\b.*?\b[Tt]imeout\b\D*\d{3,}"],
+    "line-numbers": ["-n", "timeout"],
+}
+CACHES = ("warm", "cold")
+
+
+def percentile(samples, fraction):
+    # Nearest rank, so with few runs p99 is the slowest one rather than an interpolation.
+    ordered = sorted(samples)
+    return ordered[max(0, math.ceil(fraction * len(ordered)) - 1)]
+
+
+def default_workers():
+    count = os.cpu_count() or 1
+    workers = {1, count}
+    w = 2
+    while w < count:
+        workers.add(w)
+        w *= 2
+    return sorted(workers)
+
+
+def evict(root):
+    """Drop the corpus from the page cache; returns how, for the record."""
+    try:
+        os.sync()
+        with open("/proc/sys/vm/drop_caches", "w") as f:
+            f.write("1\n")
+        return "drop_caches"
+    except OSError:
+        pass
+    # Unprivileged: clean pages of files we can open are dropped on request.
+    for dirpath, _, filenames in os.walk(root):
+        for name in filenames:
+            try:
+                fd = os.open(os.path.join(dirpath, name), os.O_RDONLY)
+            except OSError:
+                continue
+            try:
+                os.posix_fadvise(fd, 0, 0, os.POSIX_FADV_DONTNEED)
+            finally:
+                os.close(fd)
+    return "fadvise"
+
+
+def run_once(command):
+    start = time.perf_counter()
+    res = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+    elapsed = time.perf_counter() - start
+    if res.returncode not in (0, 1):
+        raise RuntimeError("%s exited with %d" % (" ".join(command), res.returncode))
+    return elapsed, res.stdout.count(b"\n")
+
+
+def commit_of(path):
+    try:
+        res = subprocess.run(["git", "-C", path, "rev-parse", "--short", "HEAD"], capture_output=True, text=True)
+        return res.stdout.strip() or None
+    except OSError:
+        return None
+
+
+def compare(records, baseline_path):
+    key = lambda r: (r["pattern"], r["workers"], r["cache"])
+    with open(baseline_path) as f:
+        baseline = {key(r): r for r in map(json.loads, filter(str.strip, f))}
+    print("\n%-14s %7s %5s %10s %10s %8s %10s %10s %8s" % ("pattern", "workers", "cache", "base p50", "p50", "change",
+                                                          "base p99", "p99", "change"), file=sys.stderr)
+    for r in records:
+        old = baseline.get(key(r))
+        if old is None:
+            continue
+        change = lambda field: (r[field] - old[field]) / old[field] * 100
+        print("%-14s %7d %5s %9.3fs %9.3fs %+7.1f%% %9.3fs %9.3fs %+7.1f%%" % (
+            r["pattern"], r["workers"], r["cache"], old["p50_s"], r["p50_s"], change("p50_s"), old["p99_s"],
+            r["p99_s"], change("p99_s")), file=sys.stderr)
+
+
+def main():
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--cgrep", default=os.path.join(root, "build", "cgrep"), help="binary to benchmark")
+    parser.add_argument("--corpus", default=os.path.join(root, "build", "bench-corpus"),
+                        help="corpus directory, generated if missing or built with other parameters")
+    parser.add_argument("--output", help="write JSON lines here instead of stdout")
+    parser.add_argument("--baseline", help="JSON lines from an earlier run to compare p50 and p99 times against")
+    parser.add_argument("--cgrep-args", type=str.split, default=[],
+                        help="extra options for every run, e.g. '--largest-first' (recorded as 'extra_args')")
+    parser.add_argument("--runs", type=int, default=5, help="timed runs per combination (default 5)")
+    parser.add_argument("--workers", type=lambda s: [int(w) for w in s.split(",")], default=default_workers(),
+                        help="comma-separated worker counts (default: powers of two up to the CPU count)")
+    parser.add_argument("--patterns", type=lambda s: s.split(","), default=list(PATTERNS),
+                        help="comma-separated pattern classes: %s" % ",".join(PATTERNS))
+    parser.add_argument("--caches", type=lambda s: s.split(","), default=list(CACHES),
+                        help="comma-separated cache states: warm,cold")
+    corpus.add_arguments(parser)
+    args = parser.parse_args()
+    for name in args.patterns:
+        if name not in PATTERNS:
+            parser.error("unknown pattern class '%s'" % name)
+    for cache in args.caches:
+        if cache not in CACHES:
+            parser.error("unknown cache state '%s'" % cache)
+
+    print("Preparing corpus in %s..." % args.corpus, file=sys.stderr)
+    manifest = corpus.generate(args.corpus, **corpus.corpus_options(args))
+    print("%d files, %.1f MB (%d binary)" % (manifest["files"], manifest["bytes"] / 1e6, manifest["binary_files"]),
+          file=sys.stderr)
+
+    meta = {
+        "commit": commit_of(root),
+        "cgrep": os.path.abspath(args.cgrep),
+        "host": platform.node(),
+        "cpus": os.cpu_count(),
+        "time": time.strftime("%Y-%m-%dT%H:%M:%S%z"),
+        "corpus": manifest["params"],
+    }
+    records = []
+    print("%-14s %7s %5s %9s %9s %8s %10s" % ("pattern", "workers", "cache", "p50", "p99", "GB/s", "files/s"),
+          file=sys.stderr)
+    for name in args.patterns:
+        for workers in args.workers:
+            command = [args.cgrep, "-r", "-w", str(workers)] + args.cgrep_args + PATTERNS[name] + [args.corpus]
+            for cache in args.caches:
+                samples = []
+                lines = 0
+                method = None
+                if cache == "warm":
+                    run_once(command)
+                for _ in range(args.runs):
+                    if cache == "cold":
+                        method = evict(args.corpus)
+                    elapsed, lines = run_once(command)
+                    samples.append(elapsed)
+                p50 = percentile(samples, 0.50)
+                record = dict(meta, pattern=name, args=PATTERNS[name], extra_args=args.cgrep_args, workers=workers,
+                              cache=cache, evict=method, runs=args.runs, lines=lines, bytes=manifest["bytes"],
+                              files=manifest["files"], p50_s=p50, p99_s=percentile(samples, 0.99),
+                              min_s=min(samples), gbps=manifest["bytes"] / p50 / 1e9,
+                              files_per_s=manifest["files"] / p50)
+                records.append(record)
+                print("%-14s %7d %5s %8.3fs %8.3fs %8.3f %10.0f" % (name, workers, cache, p50, record["p99_s"],
+                                                                    record["gbps"], record["files_per_s"]),
+                      file=sys.stderr)
+
+    out = open(args.output, "w") if args.output else sys.stdout
+    try:
+        for record in records:
+            out.write(json.dumps(record) + "\n")
+    finally:
+        if args.output:
+            out.close()
+    if args.baseline:
+        compare(records, args.baseline)
+
+
+if __name__ == "__main__":
+    main()
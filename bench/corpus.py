@@ -0,0 +1,171 @@
+#!/usr/bin/env python3
+"""Deterministic synthetic corpus for benchmarking cgrep.
+
+The same parameters and seed always produce byte-identical trees, so runs on
+different commits (or machines) search the same data. A stamp file records
+the parameters a corpus was built with; generate() reuses a matching corpus
+and rebuilds one that differs.
+"""
+import argparse
+import json
+import math
+import os
+import random
+import shutil
+
+STAMP = ".cgrep-bench-corpus.json"
+
+# Matching lines carry every needle the driver's pattern classes look for;
+# the other lines contain none of them, in any case.
+WORDS = ("alpha beta gamma delta epsilon zeta theta kappa lambda sigma omega "
+         "request response handler buffer socket thread cache index value "
+         "parse render commit update queue worker stream record session").split()
+MATCH_TEMPLATES = (
+    "{ts} ERROR [{mod}] connection timeout after {n} ms while reading {word}",
+    "{ts} Error: {mod}_{word} timeout code={n}",
+    "{ts} error {word} Timeout={n}ms in {mod}",
+)
+
+DEFAULTS = {
+    "files": 2000,
+    "median_size": 16 * 1024,
+    "max_size": 4 * 1024 * 1024,
+    "sigma": 1.5,
+    "depth": 4,
+    "fanout": 6,
+    "binary_ratio": 0.05,
+    "match_density": 0.001,
+    "skew_files": 0,
+    "skew_size": 48 * 1024 * 1024,
+    "seed": 1,
+}
+
+
+def _plain_line(rng):
+    words = rng.choices(WORDS, k=rng.randint(4, 14))
+    return "%08x %s %s" % (rng.getrandbits(32), rng.choice(("INFO", "DEBUG", "TRACE")), " ".join(words))
+
+
+def _match_line(rng):
+    return rng.choice(MATCH_TEMPLATES).format(ts="%08x" % rng.getrandbits(32), mod=rng.choice(WORDS),
+                                              word=rng.choice(WORDS), n=rng.randint(100, 99999))
+
+
+def _file_size(rng, params):
+    # Log-normal: many small files, a long tail of large ones, like a source or log tree.
+    size = int(params["median_size"] * math.exp(rng.gauss(0.0, params["sigma"])))
+    return max(1, min(size, params["max_size"]))
+
+
+def _directories(rng, params):
+    dirs = [""]
+    frontier = [""]
+    for level in range(params["depth"]):
+        next_frontier = []
+        for parent in frontier:
+            for i in range(rng.randint(1, params["fanout"])):
+                path = os.path.join(parent, "d%d_%d" % (level, i))
+                dirs.append(path)
+                next_frontier.append(path)
+        frontier = next_frontier
+    return dirs
+
+
+def _text(rng, size, density, pool, match_pool):
+    # Lines come from pools drawn once per corpus: generating each line afresh is far too slow
+    # in Python for corpora of hundreds of megabytes.
+    average = sum(len(line) + 1 for line in pool[:64]) / 64
+    count = max(1, int(size / average))
+    lines = rng.choices(pool, k=count)
+    matches = min(count, int(count * density + rng.random()))
+    for index in rng.sample(range(count), matches):
+        lines[index] = rng.choice(match_pool)
+    return ("\n".join(lines) + "\n").encode()[:size], matches
+
+
+def generate(root, **overrides):
+    """Build (or reuse) a corpus under 'root' and return its manifest."""
+    params = dict(DEFAULTS, **{k: v for k, v in overrides.items() if v is not None})
+    stamp_path = os.path.join(root, STAMP)
+    try:
+        with open(stamp_path) as f:
+            manifest = json.load(f)
+        if manifest["params"] == params:
+            return manifest
+    except (OSError, ValueError, KeyError):
+        pass
+    shutil.rmtree(root, ignore_errors=True)
+
+    rng = random.Random(params["seed"])
+    pool = [_plain_line(rng) for _ in range(4096)]
+    match_pool = [_match_line(rng) for _ in range(256)]
+    dirs = _directories(rng, params)
+    for d in dirs:
+        os.makedirs(os.path.join(root, d), exist_ok=True)
+
+    manifest = {"params": params, "files": 0, "bytes": 0, "text_bytes": 0, "binary_files": 0, "match_lines": 0}
+    for i in range(params["files"]):
+        size = _file_size(rng, params)
+        if rng.random() < params["binary_ratio"]:
+            # A NUL early on, so cgrep and grep both skip the file as binary.
+            data = b"\x7fELF\x02\x01\x01\x00" + rng.randbytes(size)
+            name = "blob%d.bin" % i
+            manifest["binary_files"] += 1
+        else:
+            data, matches = _text(rng, size, params["match_density"], pool, match_pool)
+            name = "file%d.%s" % (i, rng.choice(("log", "txt", "c", "md")))
+            manifest["text_bytes"] += len(data)
+            manifest["match_lines"] += matches
+        with open(os.path.join(root, rng.choice(dirs), name), "wb") as f:
+            f.write(data)
+        manifest["files"] += 1
+        manifest["bytes"] += len(data)
+
+    # Big files at the bottom of the last branch, reached late by a walk: the tail
+    # that dominates wall time when one of them is started after everything else.
+    deepest = max(dirs, key=lambda d: (d.count(os.sep), d))
+    for i in range(params["skew_files"]):
+        data, matches = _text(rng, params["skew_size"], params["match_density"], pool, match_pool)
+        with open(os.path.join(root, deepest, "big%d.log" % i), "wb") as f:
+            f.write(data)
+        manifest["files"] += 1
+        manifest["bytes"] += len(data)
+        manifest["text_bytes"] += len(data)
+        manifest["match_lines"] += matches
+
+    with open(stamp_path, "w") as f:
+        json.dump(manifest, f, indent=2)
+    return manifest
+
+
+def add_arguments(parser):
+    parser.add_argument("--files", type=int, help="number of files (default %d)" % DEFAULTS["files"])
+    parser.add_argument("--median-size", type=int, help="median file size in bytes (default %d)" % DEFAULTS["median_size"])
+    parser.add_argument("--max-size", type=int, help="largest file size in bytes (default %d)" % DEFAULTS["max_size"])
+    parser.add_argument("--sigma", type=float, help="spread of the log-normal file sizes (default %g)" % DEFAULTS["sigma"])
+    parser.add_argument("--depth", type=int, help="directory depth (default %d)" % DEFAULTS["depth"])
+    parser.add_argument("--fanout", type=int, help="most subdirectories per directory (default %d)" % DEFAULTS["fanout"])
+    parser.add_argument("--binary-ratio", type=float, help="fraction of binary files (default %g)" % DEFAULTS["binary_ratio"])
+    parser.add_argument("--match-density", type=float,
+                        help="fraction of text lines that match (default %g)" % DEFAULTS["match_density"])
+    parser.add_argument("--skew-files", type=int,
+                        help="big files added in the deepest directory (default %d)" % DEFAULTS["skew_files"])
+    parser.add_argument("--skew-size", type=int, help="size of each big file in bytes (default %d)" % DEFAULTS["skew_size"])
+    parser.add_argument("--seed", type=int, help="random seed (default %d)" % DEFAULTS["seed"])
+
+
+def corpus_options(args):
+    return {key: getattr(args, key) for key in DEFAULTS}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("root", help="directory to create the corpus in (replaced if built differently)")
+    add_arguments(parser)
+    args = parser.parse_args()
+    manifest = generate(args.root, **corpus_options(args))
+    print(json.dumps(manifest, indent=2))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,427 @@
+#include "discovery.h"
+#include "matcher.h"
+#include "raii.h"
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+/*
+ * Microbenchmarks of the per-byte kernels, called directly on in-memory
+ * buffers: matcher_process_buffer() for each engine and buffer shape,
+ * is_binary() and should_process_file(). Each case prints one JSON line with
+ * wall time per byte and, where perf_event_open() is permitted, cycles,
+ * instructions, branch misses and cache misses counted in user space.
+ */
+
+enum { COUNTER_CYCLES, COUNTER_INSTRUCTIONS, COUNTER_BRANCH_MISSES, COUNTER_CACHE_MISSES, COUNTER_COUNT };
+
+static const char *const COUNTER_NAMES[COUNTER_COUNT] = {
+    "cycles", "instructions", "branch_misses", "cache_misses"
+};
+
+typedef struct {
+    int fds[COUNTER_COUNT]; // -1 for counters the machine or kernel does not offer
+    int slot[COUNTER_COUNT]; // Position of each counter's value in a group read
+    int open_count;
+} counters_t;
+
+typedef struct {
+    double ns;
+    double values[COUNTER_COUNT]; // Scaled for multiplexing
+} sample_t;
+
+static void counters_close(counters_t *counters) {
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (counters->fds[i] >= 0) close(counters->fds[i]);
+        counters->fds[i] = -1;
+    }
+}
+
+#ifdef __linux__
+static const uint64_t COUNTER_CONFIGS[COUNTER_COUNT] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES
+};
+
+static int open_counter(uint64_t config, int group) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = group < 0;
+    attr.exclude_kernel = 1; // Allowed at the default perf_event_paranoid level of 2
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, PERF_FLAG_FD_CLOEXEC);
+}
+
+// Cycles lead the group; without them the counters are not worth reporting.
+static bool counters_open(counters_t *counters, const char **reason) {
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        counters->fds[i] = open_counter(COUNTER_CONFIGS[i], i == 0 ? -1 : counters->fds[0]);
+        if (counters->fds[i] < 0 && i == 0) {
+            *reason = strerror(errno);
+            return false;
+        }
+        counters->slot[i] = counters->fds[i] >= 0 ? counters->open_count++ : -1;
+    }
+    return true;
+}
+
+static void counters_start(const counters_t *counters) {
+    ioctl(counters->fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(counters->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static void counters_stop(const counters_t *counters, sample_t *sample) {
+    ioctl(counters->fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    uint64_t data[3 + COUNTER_COUNT]; // nr, time enabled, time running, values
+    if (read(counters->fds[0], data, sizeof(data)) < (ssize_t)(3 * sizeof(uint64_t))) return;
+    double scale = data[2] > 0 ? (double)data[1] / (double)data[2] : 0.0;
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (counters->slot[i] >= 0) sample->values[i] = (double)data[3 + counters->slot[i]] * scale;
+    }
+}
+#else
+static bool counters_open([[maybe_unused]] counters_t *counters, const char **reason) {
+    *reason = "not supported on this system";
+    return false;
+}
+
+static void counters_start([[maybe_unused]] const counters_t *counters) {}
+
+static void counters_stop([[maybe_unused]] const counters_t *counters, [[maybe_unused]] sample_t *sample) {}
+#endif
+
+typedef struct bench_case bench_case_t;
+
+struct bench_case {
+    char name[64];
+    const char *kernel;
+    size_t (*run)(bench_case_t *bench); // One iteration; the result is kept so it cannot be optimized away
+    size_t bytes; // Per iteration
+    size_t items; // Per iteration: buffers or paths
+    const char *buffer;
+    size_t length;
+    grep_config_t config;
+    matcher_state_t state;
+    const char *const *paths;
+    const discovery_config_t *discovery;
+};
+
+static size_t run_matcher(bench_case_t *bench) {
+    size_t matches = matcher_process_buffer("bench", bench->buffer, bench->length, &bench->config, &bench->state,
+                                            SIZE_MAX);
+    // Lines are formatted into the batch as when searching, but never written.
+    output_discard(&bench->state.output);
+    return matches;
+}
+
+enum { BINARY_PROBE_SIZE = 1024 };
+
+// Probes consecutive file-sized slices, as a walk over many small files would.
+static size_t run_is_binary(bench_case_t *bench) {
+    size_t binary = 0;
+    for (size_t offset = 0; offset + BINARY_PROBE_SIZE <= bench->length; offset += BINARY_PROBE_SIZE) {
+        binary += is_binary(bench->buffer + offset, BINARY_PROBE_SIZE);
+    }
+    return binary;
+}
+
+static size_t run_should_process(bench_case_t *bench) {
+    size_t accepted = 0;
+    for (size_t i = 0; i < bench->items; i++) {
+        accepted += should_process_file(bench->paths[i], NULL, bench->discovery);
+    }
+    return accepted;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static volatile size_t sink;
+
+static sample_t measure(bench_case_t *bench, size_t iterations, const counters_t *counters) {
+    sample_t sample = { .ns = 0 };
+    for (int i = 0; i < COUNTER_COUNT; i++) sample.values[i] = -1;
+    if (counters) counters_start(counters);
+    double start = now_ns();
+    for (size_t i = 0; i < iterations; i++) sink += bench->run(bench);
+    sample.ns = now_ns() - start;
+    if (counters) counters_stop(counters, &sample);
+    return sample;
+}
+
+static int compare_samples(const void *a, const void *b) {
+    double x = ((const sample_t *)a)->ns;
+    double y = ((const sample_t *)b)->ns;
+    return (x > y) - (x < y);
+}
+
+typedef struct {
+    double min_time; // Seconds per sample
+    int samples;
+    const char *filter;
+} bench_options_t;
+
+static void print_per(const char *name, double value, double per, bool available) {
+    if (available) {
+        printf(", \"%s\": %.4f", name, value / per);
+    } else {
+        printf(", \"%s\": null", name);
+    }
+}
+
+// Reports the median sample, which shrugs off the odd preempted one.
+static void run_case(bench_case_t *bench, const bench_options_t *options, const counters_t *counters) {
+    if (options->filter && strstr(bench->name, options->filter) == NULL) return;
+    measure(bench, 1, NULL); // Warm caches and the JIT
+    size_t iterations = 1;
+    while (true) {
+        double ns = measure(bench, iterations, NULL).ns;
+        if (ns >= options->min_time * 1e9 || iterations >= SIZE_MAX / 2) break;
+        iterations = ns < 1e6 ? iterations * 10 : (size_t)((double)iterations * options->min_time * 1e9 / ns) + 1;
+    }
+
+    auto_free sample_t *samples = calloc((size_t)options->samples, sizeof(sample_t));
+    if (samples == NULL) return;
+    for (int i = 0; i < options->samples; i++) samples[i] = measure(bench, iterations, counters);
+    qsort(samples, (size_t)options->samples, sizeof(sample_t), compare_samples);
+    const sample_t *median = &samples[options->samples / 2];
+
+    double bytes = (double)bench->bytes * (double)iterations;
+    printf("{\"name\": \"%s\", \"kernel\": \"%s\", \"bytes\": %zu, \"items\": %zu, \"iterations\": %zu, "
+           "\"samples\": %d, \"ns_per_byte\": %.5f, \"gb_per_s\": %.3f, \"ns_per_item\": %.2f",
+           bench->name, bench->kernel, bench->bytes, bench->items, iterations, options->samples,
+           median->ns / bytes, bytes / median->ns, median->ns / ((double)bench->items * (double)iterations));
+    double kib = bytes / 1024;
+    print_per("cycles_per_byte", median->values[COUNTER_CYCLES], bytes, median->values[COUNTER_CYCLES] >= 0);
+    print_per("instructions_per_byte", median->values[COUNTER_INSTRUCTIONS], bytes,
+              median->values[COUNTER_INSTRUCTIONS] >= 0);
+    bool ipc = median->values[COUNTER_CYCLES] > 0 && median->values[COUNTER_INSTRUCTIONS] >= 0;
+    print_per("ipc", median->values[COUNTER_INSTRUCTIONS], ipc ? median->values[COUNTER_CYCLES] : 1, ipc);
+    print_per("branch_misses_per_kib", median->values[COUNTER_BRANCH_MISSES], kib,
+              median->values[COUNTER_BRANCH_MISSES] >= 0);
+    print_per("cache_misses_per_kib", median->values[COUNTER_CACHE_MISSES], kib,
+              median->values[COUNTER_CACHE_MISSES] >= 0);
+    printf("}\n");
+    fflush(stdout);
+}
+
+// Deterministic xorshift, so every run searches the same bytes.
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+typedef struct {
+    const char *name;
+    size_t min_words; // Words per line, which sets the line length
+    size_t max_words;
+    unsigned int match_every; // One matching line in this many
+} buffer_shape_t;
+
+static const buffer_shape_t SHAPES[] = {
+    { "log", 6, 14, 1000 }, // ~80-byte lines, rare matches: the common case
+    { "dense", 6, 14, 4 }, // Matches everywhere: line handling and output dominate
+    { "short", 1, 3, 1000 }, // ~16-byte lines: per-line overhead
+    { "long", 200, 400, 100 }, // ~2 KiB lines, such as minified code
+};
+
+static const char *const WORDS[] = {
+    "alpha", "beta", "gamma", "delta", "request", "response", "handler", "buffer", "socket", "thread",
+    "cache", "index", "value", "parse", "render", "commit", "update", "queue", "worker", "stream",
+};
+
+static char *make_buffer(const buffer_shape_t *shape, size_t size) {
+    char *buffer = malloc(size);
+    if (buffer == NULL) return NULL;
+    uint64_t random = 0x9e3779b97f4a7c15ULL;
+    size_t used = 0;
+    while (true) {
+        char line[8192];
+        int length = snprintf(line, sizeof(line), "%08x INFO", (unsigned int)next_random(&random));
+        size_t words = shape->min_words + next_random(&random) % (shape->max_words - shape->min_words + 1);
+        for (size_t i = 0; i < words; i++) {
+            const char *word = WORDS[next_random(&random) % (sizeof(WORDS) / sizeof(WORDS[0]))];
+            length += snprintf(line + length, sizeof(line) - (size_t)length, " %s", word);
+        }
+        if (next_random(&random) % shape->match_every == 0) {
+            length += snprintf(line + length, sizeof(line) - (size_t)length, " ERROR timeout=%u",
+                               (unsigned int)(next_random(&random) % 10000));
+        }
+        line[length++] = '\n';
+        if (used + (size_t)length > size) break;
+        memcpy(buffer + used, line, (size_t)length);
+        used += (size_t)length;
+    }
+    memset(buffer + used, '\n', size - used);
+    return buffer;
+}
+
+typedef struct {
+    const char *name;
+    const char *patterns[3];
+    size_t count;
+    bool case_insensitive;
+    bool line_numbering;
+} pattern_class_t;
+
+// One class per engine path: memmem, case-folded literal, Aho-Corasick, PCRE2
+// behind a literal prefilter, PCRE2 on every line, and line-number counting.
+static const pattern_class_t PATTERNS[] = {
+    { "literal", { "timeout" }, 1, false, false },
+    { "ignore-case", { "TIMEOUT" }, 1, true, false },
+    { "multi-literal", { "timeout", "refused", "unreachable" }, 3, false, false },
+    { "regex-prefilter", { "ERROR\\s+timeout=\\d{3,}" }, 1, false, false },
+    { "regex-no-literal", { "[A-Z]{5}\\s+[a-z]+[=:]\\d{3,}" }, 1, false, false },
+    { "line-numbers", { "timeout" }, 1, false, true },
+};
+
+enum { PATH_COUNT = 4096 };
+
+static const char *const PATH_ROOTS[] = { "src", "lib", "build", "node_modules/pkg" };
+static const char *const PATH_EXTENSIONS[] = { ".c", ".h", ".py", ".min.js", ".md", ".o" };
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [--size BYTES] [--min-time SECONDS] [--samples N] [--filter TEXT] [--no-counters]\n"
+            "Prints one JSON line per case: time per byte and, when perf_event_open() is permitted,\n"
+            "cycles, instructions, branch misses and cache misses.\n",
+            program);
+}
+
+int main(int argc, char **argv) {
+    bench_options_t options = { .min_time = 0.05, .samples = 5, .filter = NULL };
+    size_t size = 8 * 1024 * 1024;
+    bool use_counters = true;
+    static struct option long_options[] = {
+        { "size", required_argument, 0, 's' },
+        { "min-time", required_argument, 0, 't' },
+        { "samples", required_argument, 0, 'n' },
+        { "filter", required_argument, 0, 'f' },
+        { "no-counters", no_argument, 0, 'C' },
+        { "help", no_argument, 0, 'h' },
+        { 0, 0, 0, 0 },
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "s:t:n:f:Ch", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 's': size = strtoull(optarg, NULL, 10); break;
+            case 't': options.min_time = strtod(optarg, NULL); break;
+            case 'n': options.samples = atoi(optarg); break;
+            case 'f': options.filter = optarg; break;
+            case 'C': use_counters = false; break;
+            case 'h': usage(argv[0]); return 0;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (size < BINARY_PROBE_SIZE || options.samples < 1 || options.min_time <= 0) {
+        fprintf(stderr, "Error: --size must be at least %d, --samples and --min-time positive.\n",
+                BINARY_PROBE_SIZE);
+        return 1;
+    }
+
+    counters_t counters = { .fds = { -1, -1, -1, -1 }, .open_count = 0 };
+    const char *reason = "disabled by --no-counters";
+    bool counting = use_counters && counters_open(&counters, &reason);
+    if (!counting) {
+        counters_close(&counters);
+        fprintf(stderr, "Note: hardware counters unavailable (%s); reporting wall time only.\n", reason);
+    } else {
+        for (int i = 0; i < COUNTER_COUNT; i++) {
+            if (counters.fds[i] < 0) fprintf(stderr, "Note: no %s counter on this machine.\n", COUNTER_NAMES[i]);
+        }
+    }
+    const counters_t *active = counting ? &counters : NULL;
+
+    for (size_t s = 0; s < sizeof(SHAPES) / sizeof(SHAPES[0]); s++) {
+        auto_free char *buffer = make_buffer(&SHAPES[s], size);
+        if (buffer == NULL) {
+            fprintf(stderr, "Error: Cannot allocate %zu bytes.\n", size);
+            return 1;
+        }
+        for (size_t p = 0; p < sizeof(PATTERNS) / sizeof(PATTERNS[0]); p++) {
+            const pattern_class_t *pattern = &PATTERNS[p];
+            bench_case_t bench = {
+                .kernel = "matcher_process_buffer", .run = run_matcher, .bytes = size, .items = 1,
+                .buffer = buffer, .length = size,
+                .config = { .code = NULL, .case_insensitive = pattern->case_insensitive,
+                            .line_numbering = pattern->line_numbering, .fixed_strings = false,
+                            .report = MATCHER_REPORT_LINES, .max_count = SIZE_MAX },
+            };
+            snprintf(bench.name, sizeof(bench.name), "matcher/%s/%s", pattern->name, SHAPES[s].name);
+            if (!matcher_compile(&bench.config, pattern->patterns, pattern->count) ||
+                !matcher_state_init(&bench.state, &bench.config)) {
+                fprintf(stderr, "Error: Cannot set up '%s'.\n", bench.name);
+                return 1;
+            }
+            run_case(&bench, &options, active);
+            matcher_state_destroy(&bench.state);
+            matcher_config_destroy(&bench.config);
+        }
+
+        if (strcmp(SHAPES[s].name, "log") == 0) {
+            // Text has no NUL, so every probe scans its whole 1 KiB: the worst case.
+            bench_case_t bench = {
+                .name = "is_binary/text", .kernel = "is_binary", .run = run_is_binary,
+                .bytes = size / BINARY_PROBE_SIZE * BINARY_PROBE_SIZE, .items = size / BINARY_PROBE_SIZE,
+                .buffer = buffer, .length = size,
+            };
+            run_case(&bench, &options, active);
+
+            // A NUL in every probe's first bytes: the early exit taken for real binaries.
+            auto_free char *binary = malloc(size);
+            if (binary == NULL) return 1;
+            memcpy(binary, buffer, size);
+            for (size_t offset = 16; offset < size; offset += BINARY_PROBE_SIZE) binary[offset] = '\0';
+            snprintf(bench.name, sizeof(bench.name), "is_binary/binary");
+            bench.buffer = binary;
+            run_case(&bench, &options, active);
+        }
+    }
+
+    char *paths[PATH_COUNT];
+    size_t path_bytes = 0;
+    uint64_t random = 42;
+    for (size_t i = 0; i < PATH_COUNT; i++) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/d%u/sub%u/file%zu%s",
+                 PATH_ROOTS[next_random(&random) % (sizeof(PATH_ROOTS) / sizeof(PATH_ROOTS[0]))],
+                 (unsigned int)(next_random(&random) % 16), (unsigned int)(next_random(&random) % 8), i,
+                 PATH_EXTENSIONS[next_random(&random) % (sizeof(PATH_EXTENSIONS) / sizeof(PATH_EXTENSIONS[0]))]);
+        paths[i] = strdup(path);
+        if (paths[i] == NULL) return 1;
+        path_bytes += strlen(path);
+    }
+    auto_discovery_config discovery_config_t filters = { .ignore_binary = true, .recursive = true, .order = NULL };
+    bool filters_ok = discovery_add_include(&filters, "*.c") && discovery_add_include(&filters, "*.h") &&
+                      discovery_add_include(&filters, "*.py") && discovery_add_exclude(&filters, "*.min.js") &&
+                      discovery_add_exclude(&filters, "build/**") && discovery_compile_filters(&filters);
+    if (filters_ok) {
+        bench_case_t bench = {
+            .name = "should_process_file/globs", .kernel = "should_process_file", .run = run_should_process,
+            .bytes = path_bytes, .items = PATH_COUNT, .paths = (const char *const *)paths, .discovery = &filters,
+        };
+        run_case(&bench, &options, active);
+    } else {
+        fprintf(stderr, "Error: Cannot compile the path filters.\n");
+    }
+    for (size_t i = 0; i < PATH_COUNT; i++) free(paths[i]);
+    counters_close(&counters);
+    return filters_ok ? 0 : 1;
+}
@@ -0,0 +1,46 @@
+#ifndef AHO_CORASICK_H
+#define AHO_CORASICK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @file aho_corasick.h
+ * @brief Multi-literal search with a dense Aho-Corasick automaton.
+ *
+ * Bytes are first mapped to equivalence classes (all bytes that occur in no
+ * pattern share one class, and with caseless matching both cases of a letter
+ * share one), so each state's row is only as wide as the number of classes.
+ * Failure links are resolved at build time and accepting states are numbered
+ * last, so searching is one table load and one compare per input byte with
+ * no backtracking, whatever the number of patterns.
+ */
+
+typedef struct {
+    uint32_t *transitions; // Row-major; entries are row offsets (state id * num_classes)
+    uint32_t accept_offset; // Row offsets at or above this belong to accepting states
+    uint32_t num_classes;
+    uint32_t num_states;
+    bool matches_empty; // An empty pattern was given: every position matches
+    uint8_t byte_class[256];
+} ac_automaton_t;
+
+/**
+ * @brief Build the automaton for 'count' patterns.
+ *
+ * An empty pattern is allowed and matches at every position.
+ * @return false on allocation failure or if the automaton would be too large.
+ */
+bool ac_build(ac_automaton_t *automaton, const char *const *patterns, size_t count, bool caseless);
+
+void ac_destroy(ac_automaton_t *automaton);
+
+/**
+ * @brief Find the first position where any pattern ends.
+ * @return A pointer to the last byte of the earliest-ending match ('haystack'
+ *         itself for an empty pattern), or NULL if nothing matches.
+ */
+const char *ac_find(const ac_automaton_t *automaton, const char *haystack, size_t length);
+
+#endif // AHO_CORASICK_H
@@ -0,0 +1,78 @@
+#ifndef CHUNK_H
+#define CHUNK_H
+
+#include "matcher.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @file chunk.h
+ * @brief Parallel search of one large file.
+ *
+ * A file above the chunk size is split into line-aligned chunks that are
+ * queued as separate work items. Whoever claims a chunk collects its matching
+ * lines (and newline count, for -n); the worker that split the file prints
+ * the chunks in file order, numbering lines from the counts of the chunks
+ * before them, and searches unclaimed chunks itself while it waits.
+ */
+
+struct file_job;
+
+typedef struct file_chunk {
+    struct file_job *job;
+    const char *start;
+    size_t length;
+    atomic_bool claimed;
+    bool done; // Guarded by job->mutex; 'lines' and 'newlines' are final once set
+    matcher_lines_t lines;
+    unsigned int newlines;
+} file_chunk_t;
+
+typedef struct file_job {
+    void *map; // The whole file, unmapped with the last reference
+    size_t map_length;
+    atomic_uint refs;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    size_t chunk_count;
+    file_chunk_t chunks[];
+} file_job_t;
+
+/**
+ * @brief Split a mapped file into chunks of about 'chunk_size' bytes, each ending after a newline.
+ *
+ * The job takes over the mapping and holds one reference for the caller.
+ * @return The job, or NULL on allocation failure (the mapping stays with the caller).
+ */
+file_job_t *file_job_create(void *map, size_t map_length, size_t chunk_size);
+
+file_job_t *file_job_retain(file_job_t *job);
+
+void file_job_release(file_job_t *job);
+
+/**
+ * @brief Claim a chunk for searching.
+ * @return false if another thread already claimed it.
+ */
+bool file_chunk_claim(file_chunk_t *chunk);
+
+/**
+ * @brief Search a claimed chunk and publish its results.
+ */
+void file_chunk_search(file_chunk_t *chunk, const grep_config_t *config, matcher_state_t *state);
+
+/**
+ * @brief Block until a chunk claimed by another thread is searched.
+ */
+void file_chunk_wait(file_chunk_t *chunk);
+
+static inline bool file_chunk_done(file_chunk_t *chunk) {
+    pthread_mutex_lock(&chunk->job->mutex);
+    bool done = chunk->done;
+    pthread_mutex_unlock(&chunk->job->mutex);
+    return done;
+}
+
+#endif // CHUNK_H
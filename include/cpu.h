@@ -0,0 +1,29 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @file cpu.h
+ * @brief The CPUs this process may actually use, for sizing and pinning workers.
+ */
+
+/**
+ * @brief Count the CPUs available to the process.
+ *
+ * Starts from the scheduler affinity mask (taskset, cpusets) and lowers it to
+ * the CPU bandwidth quota of the process's cgroup and its ancestors (cgroup v2
+ * cpu.max, or v1 cpu.cfs_quota_us), rounded up, as container runtimes set it.
+ * @return At least 1.
+ */
+size_t cpu_count_available(void);
+
+/**
+ * @brief Restrict threads created with 'attr' to one CPU of the affinity mask, chosen round robin by 'index'.
+ * @return false if the mask could not be read or applied (the thread then runs unpinned).
+ */
+bool cpu_pin_attr(pthread_attr_t *attr, size_t index);
+
+#endif // CPU_H
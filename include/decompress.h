@@ -0,0 +1,89 @@
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * @file decompress.h
+ * @brief Streaming decompression of gzip and zstd files for -z.
+ *
+ * A worker keeps one decompressor and pulls a loaded file's contents through
+ * it a window at a time, so memory per worker stays bounded by the window
+ * (plus the format's own history window) however large the file expands.
+ * Formats are recognized by their magic bytes; support for each is compiled
+ * in when its library was found (CGREP_HAVE_ZLIB, CGREP_HAVE_ZSTD).
+ */
+
+typedef enum {
+    COMPRESSION_NONE,
+    COMPRESSION_GZIP,
+    COMPRESSION_ZSTD,
+} compression_t;
+
+enum {
+    DECOMPRESS_WINDOW_SIZE = 1024 * 1024,
+    DECOMPRESS_WINDOW_MAX = 16 * 1024 * 1024, // The longest line a window grows to hold
+};
+
+struct z_stream_s;
+struct ZSTD_DCtx_s;
+
+/**
+ * Per-worker decompression state, reused for every file.
+ */
+typedef struct {
+    compression_t type; // Of the file being read
+    struct z_stream_s *zlib;
+    struct ZSTD_DCtx_s *zstd;
+    const unsigned char *input;
+    size_t input_length;
+    size_t input_pos; // Handed to the library so far
+    bool finished;
+    bool failed; // The data is corrupt or truncated
+    char *window; // Decompressed data handed to the caller, grown only for lines longer than it
+    size_t window_capacity;
+} decompressor_t;
+
+/**
+ * @return true if this build can decompress any format.
+ */
+bool decompress_available(void);
+
+/**
+ * @brief Recognize a compressed file by its first bytes.
+ * @return COMPRESSION_NONE unless the format is recognized and supported by this build.
+ */
+compression_t decompress_detect(const char *data, size_t length);
+
+void decompressor_init(decompressor_t *decompressor);
+
+void decompressor_destroy(decompressor_t *decompressor);
+
+/**
+ * @brief Start decompressing 'data', which must stay loaded until the last decompressor_read().
+ * @return false on allocation failure.
+ */
+bool decompressor_start(decompressor_t *decompressor, compression_t type, const char *data, size_t length);
+
+/**
+ * @brief Decompress up to 'capacity' bytes into 'out'.
+ *
+ * Fills 'out' completely unless the input ends first. Gzip files made of
+ * several members (as written by pigz or by concatenation) are read through.
+ * @return The number of bytes produced, 0 at the end of the data, -1 if it is corrupt or truncated.
+ */
+ssize_t decompressor_read(decompressor_t *decompressor, char *out, size_t capacity);
+
+/**
+ * @brief Double the window, for a line that does not fit in it.
+ *
+ * decompressor_start() shrinks it back for the next file.
+ * @return false on allocation failure or once the window is DECOMPRESS_WINDOW_MAX bytes.
+ */
+bool decompressor_grow_window(decompressor_t *decompressor);
+
+#define auto_decompressor [[gnu::cleanup(decompressor_destroy)]]
+
+#endif // DECOMPRESS_H
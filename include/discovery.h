@@ -1,32 +1,88 @@
 #ifndef DISCOVERY_H
 #define DISCOVERY_H
 
+#include "glob.h"
 #include <stdbool.h>
 #include <stddef.h>
 
+struct order;
+
 typedef struct discovery_config {
-    char **include_patterns;
-    size_t include_count;
-    char **exclude_patterns;
-    size_t exclude_count;
+    glob_set_t include; // Files must match one of these, if any were given
+    glob_set_t exclude_files;
+    glob_set_t exclude_dirs; // Directories matching these are pruned with their whole subtree
     bool ignore_binary;
     bool recursive;
+    bool use_ignore_files; // Honor .gitignore, .ignore and .git/info/exclude, and skip .git
+    bool size_schedule; // --largest-first: directories first, and files stat-ed as listed so the largest go next
+    struct order *order; // Set for --ordered: entries are queued in name order with output slots
 } discovery_config_t;
 
 #include "worker.h"
 
+/**
+ * @brief Add an --include pattern. A trailing '/' selects everything below a directory.
+ * @return false on allocation failure.
+ */
+bool discovery_add_include(discovery_config_t *config, const char *pattern);
+
+/**
+ * @brief Add an --exclude pattern.
+ *
+ * Patterns apply to files and prune directories alike. A trailing '/' makes a
+ * pattern apply to directories only, and a pattern naming everything below a
+ * directory (a final '/' followed by '*' or '**') also prunes the directory
+ * itself, so the subtree is never read.
+ * @return false on allocation failure.
+ */
+bool discovery_add_exclude(discovery_config_t *config, const char *pattern);
+
+/**
+ * @brief Compile the include and exclude patterns once they are all added.
+ * @return false if a pattern is invalid.
+ */
+bool discovery_compile_filters(discovery_config_t *config);
+
+void discovery_config_destroy(discovery_config_t *config);
+
+#define auto_discovery_config [[gnu::cleanup(discovery_config_destroy)]]
+
 /**
  * @brief Discover files and directories and add them to the work queue.
  * 
- * If the path is a directory, its immediate children are added to the queue.
+ * If the path is a directory, its immediate children are added to the queue
+ * (sorted by name and given output slots under 'node' with config->order).
  * If the path is a regular file, it is added if it matches the configuration filters.
  * In a recursive search, worker threads call this function to expand subdirectories.
  * 
  * @param path The path to start discovery from.
+ * @param node The queued node for 'path', or NULL when 'path' is a root given on the command line.
+ *             Children are pushed as names below this node rather than as full paths.
  * @param config The discovery configuration (filters, recursive flag).
  * @param queue The work queue to push discovered items to.
  */
-void discover_files(const char *path, const discovery_config_t *config, work_queue_t *queue);
+void discover_files(const char *path, path_node_t *node, const discovery_config_t *config, work_queue_t *queue);
+
+/**
+ * @brief List a directory known to be one and queue its entries below 'node'.
+ *
+ * The directory is opened relative to its parent's held descriptor and read
+ * with getdents64(); each child carries the entry's d_type, so workers only
+ * stat entries the file system could not classify.
+ */
+void discover_directory(const char *path, path_node_t *node, const discovery_config_t *config, work_queue_t *queue);
+
+/**
+ * @brief Queue a command line path as is, with an output slot after the previous one.
+ */
+void discover_push_root(const char *path, const discovery_config_t *config, work_queue_t *queue);
+
+/**
+ * @brief The part of 'path' below the command line path it was found under,
+ *        which is what patterns with a '/' are matched against.
+ * @param node The queued node for 'path', or NULL for a path given on the command line.
+ */
+const char *discovery_relative_path(const char *path, const path_node_t *node);
 
 /**
  * @brief Check if a file is binary.
@@ -34,8 +90,15 @@ void discover_files(const char *path, const discovery_config_t *config, work_que
 bool is_binary(const char *buffer, size_t length);
 
 /**
- * @brief Check if a filename matches include/exclude filters.
+ * @brief Check if a file matches the include/exclude filters.
+ * @param path The file's full path.
+ * @param node Its queued node, or NULL for a path given on the command line.
+ */
+bool should_process_file(const char *path, const path_node_t *node, const discovery_config_t *config);
+
+/**
+ * @brief Check if a directory found during the walk is not excluded.
  */
-bool should_process_file(const char *filename, const discovery_config_t *config);
+bool should_enter_directory(const char *path, const path_node_t *node, const discovery_config_t *config);
 
 #endif // DISCOVERY_H
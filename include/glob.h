@@ -0,0 +1,77 @@
+#ifndef GLOB_H
+#define GLOB_H
+
+#include "raii.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @file glob.h
+ * @brief A list of shell globs compiled into one matcher.
+ *
+ * Patterns are sorted by shape when they are added: '*.ext' patterns go into
+ * an extension hash set, patterns without wildcards into a name hash set,
+ * and all others are translated to regular expressions and joined into one
+ * PCRE2 alternation (one for base names, one for paths). A lookup is then two
+ * hash probes and at most two JIT matches, however many patterns were given.
+ *
+ * Patterns containing a '/' match the path relative to the search root, the
+ * rest match the base name. Wildcards follow fnmatch() except that '*', '?'
+ * and brackets never match '/', and '**' matches across directories.
+ */
+
+typedef struct {
+    char **items; // Open addressing; NULL marks an empty slot
+    size_t count;
+    size_t capacity; // Zero or a power of two
+} glob_strset_t;
+
+typedef struct {
+    glob_strset_t extensions; // From '*.ext', matched against the text after a base name's last '.'
+    glob_strset_t names; // Wildcard free base names
+    char *name_regex; // Alternation sources, kept so patterns can still be added
+    char *path_regex;
+    pcre2_code *name_code;
+    pcre2_code *path_code;
+    size_t count;
+} glob_set_t;
+
+/**
+ * @brief Add a pattern. The set must be compiled again before matching.
+ * @return false on allocation failure.
+ */
+bool glob_set_add(glob_set_t *set, const char *pattern);
+
+/**
+ * @brief Add a pattern matched against the relative path even if it has no '/'.
+ *
+ * "build" then only matches the root's build, not every build below it.
+ * @return false on allocation failure.
+ */
+bool glob_set_add_path(glob_set_t *set, const char *pattern);
+
+/**
+ * @brief Build the automata for the patterns added so far.
+ * @return false if a pattern could not be compiled (reported on stderr).
+ */
+bool glob_set_compile(glob_set_t *set);
+
+/**
+ * @return true if patterns that need the relative path were added.
+ */
+static inline bool glob_set_has_paths(const glob_set_t *set) {
+    return set->path_regex != NULL;
+}
+
+/**
+ * @brief Match one entry against every pattern in the set.
+ * @param relative The entry's path relative to the search root.
+ * @param basename Its last component.
+ */
+bool glob_set_match(const glob_set_t *set, const char *relative, const char *basename);
+
+void glob_set_destroy(glob_set_t *set);
+
+#define auto_glob_set [[gnu::cleanup(glob_set_destroy)]]
+
+#endif // GLOB_H
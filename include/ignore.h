@@ -0,0 +1,75 @@
+#ifndef IGNORE_H
+#define IGNORE_H
+
+#include "glob.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @file ignore.h
+ * @brief Hierarchical .gitignore / .ignore / .git/info/exclude rules.
+ *
+ * Each directory with ignore files gets one level of compiled rules, linked
+ * to the level of its parent directory. A level is immutable once built and
+ * reference counted, so every queued entry below a directory shares it and
+ * no ignore file is read or parsed twice. Directories without ignore files
+ * simply share their parent's level.
+ *
+ * Within a level the last matching pattern wins, and deeper levels take
+ * precedence over shallower ones, as in git.
+ */
+
+enum {
+    IGNORE_READ_GITIGNORE = 1 << 0,
+    IGNORE_READ_IGNORE = 1 << 1,
+    IGNORE_READ_GIT_EXCLUDE = 1 << 2, // The directory is a repository root
+};
+
+/**
+ * A run of consecutive patterns with the same polarity. Runs are kept in
+ * file order, so the last run with a match decides.
+ */
+typedef struct {
+    bool negate; // '!' patterns: a match re-includes the entry
+    glob_set_t any;
+    glob_set_t dirs; // Patterns with a trailing '/', which only match directories
+} ignore_run_t;
+
+typedef struct ignore_rules {
+    atomic_uint refs;
+    struct ignore_rules *parent;
+    char *lead; // Prefixed to a root-relative path to make it relative to this level (ancestors of a root)
+    size_t skip; // Bytes of a root-relative path that lie above this level
+    size_t run_count;
+    ignore_run_t runs[];
+} ignore_rules_t;
+
+/**
+ * @brief Read the ignore files selected by 'files' from the directory 'dir_fd'.
+ *
+ * @param parent The level for the directory above, or NULL.
+ * @param skip Length of the directory's path relative to the search root, plus its '/'.
+ * @return A new level on top of 'parent', or 'parent' itself (with a new
+ *         reference) if the directory has no rules.
+ */
+ignore_rules_t *ignore_rules_load(ignore_rules_t *parent, int dir_fd, unsigned files, size_t skip);
+
+/**
+ * @brief Load the rules of the directories above a search root, up to its repository root.
+ * @return NULL if 'root' is not inside a repository or nothing above it has rules.
+ */
+ignore_rules_t *ignore_rules_load_ancestors(const char *root);
+
+ignore_rules_t *ignore_rules_retain(ignore_rules_t *rules);
+
+void ignore_rules_release(ignore_rules_t *rules);
+
+/**
+ * @brief Check an entry against every level.
+ * @param relative The entry's path relative to the search root.
+ * @return true if the entry is ignored.
+ */
+bool ignore_rules_match(const ignore_rules_t *rules, const char *relative, const char *basename, bool is_dir);
+
+#endif // IGNORE_H
@@ -0,0 +1,252 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include "raii.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/**
+ * @file index.h
+ * @brief Persistent trigram index of a directory tree.
+ *
+ * --index-build walks the tree like a search would and records, for every
+ * trigram (three bytes of a line, ASCII case folded) that occurs in a file,
+ * the list of files containing it. A query turns each pattern's required
+ * literal into the trigrams every match must contain and intersects their
+ * posting lists, so only files that can match are searched. Files are
+ * numbered in walk order (sorted by path), and posting lists store the gaps
+ * between file numbers as varints.
+ *
+ * An index is a base file plus delta segments written by --index-update,
+ * which only re-reads files whose inode, size or mtime changed. A segment
+ * supersedes older records by path: it holds the files indexed again and the
+ * paths that are gone. Once segments pile up they are compacted into a new
+ * base by merging posting lists, without reading any file again. Segments
+ * name the base they belong to, so a reader never combines a new base with
+ * stale segments.
+ *
+ * Layout of the base and of every segment (native byte order, offsets from
+ * the start of the file):
+ *   index_header_t
+ *   index_file_t[file_count]        sorted by path
+ *   index_trigram_t[trigram_count]  sorted by trigram
+ *   uint64_t[removed_count]         path offsets, sorted by path (segments only)
+ *   paths                           NUL terminated, relative to the indexed directory
+ *   postings                        varint gaps
+ */
+
+#define INDEX_FILE_NAME ".cgrep-index" // Segments add ".1", ".2", ...
+
+enum {
+    INDEX_VERSION = 2,
+    INDEX_SEGMENT_LIMIT = 4, // More segments than this are compacted into a new base
+};
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t file_count;
+    uint32_t trigram_count;
+    uint32_t removed_count;
+    uint64_t base_id; // Identifies the base; a segment carries its base's
+    uint64_t files_offset;
+    uint64_t trigrams_offset;
+    uint64_t removed_offset;
+    uint64_t paths_offset;
+    uint64_t postings_offset;
+    uint64_t length; // Of the whole file, to detect truncation
+} index_header_t;
+
+typedef struct {
+    uint64_t path_offset; // Into the paths section
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t inode;
+} index_file_t;
+
+typedef struct {
+    uint32_t trigram;
+    uint32_t file_count;
+    uint64_t offset; // Into the postings section
+} index_trigram_t;
+
+/**
+ * A mapped base or segment.
+ */
+typedef struct {
+    struct mmap_region region;
+    const index_header_t *header;
+    const index_file_t *files;
+    const index_trigram_t *trigrams;
+    const uint64_t *removed;
+    const char *paths;
+    const uint8_t *postings;
+} index_t;
+
+/**
+ * Collects the trigrams of files indexed by any number of threads.
+ */
+typedef struct index_builder index_builder_t;
+
+index_builder_t *index_builder_create(void);
+
+/**
+ * @brief Record a file. Thread safe; each thread fills its own shard.
+ * @param path The file's path relative to the indexed directory.
+ * @return false on allocation failure, after which index_builder_write() fails too.
+ */
+bool index_builder_add(index_builder_t *builder, const char *path, const char *data, size_t length,
+                       const struct stat *st);
+
+/**
+ * @brief Take over the records of 'index' whose bit is set in 'live', with their posting lists.
+ *
+ * Not thread safe; used to compact a base and its segments.
+ * @return false on allocation failure.
+ */
+bool index_builder_add_index(index_builder_t *builder, const index_t *index, const uint64_t *live);
+
+/**
+ * @brief Record that 'path' is gone, for a segment. Not thread safe.
+ * @return false on allocation failure.
+ */
+bool index_builder_remove(index_builder_t *builder, const char *path);
+
+/**
+ * @return true if nothing was added or removed.
+ */
+bool index_builder_is_empty(const index_builder_t *builder);
+
+/**
+ * @brief Merge the shards and write them to 'filename' (atomically, through a rename).
+ * @param base_id The base a segment belongs to, or 0 to write a new base.
+ * @return false on I/O or allocation failure, including one in an earlier index_builder_add().
+ */
+bool index_builder_write(index_builder_t *builder, const char *filename, uint64_t base_id, size_t *file_count,
+                         size_t *trigram_count);
+
+void index_builder_destroy(index_builder_t *builder);
+
+/**
+ * @return false if the file is missing, truncated or not an index of this version.
+ */
+bool index_open(index_t *index, const char *filename);
+
+void index_close(index_t *index);
+
+static inline const char *index_file_path(const index_t *index, uint32_t id) {
+    return index->paths + index->files[id].path_offset;
+}
+
+/**
+ * A query: files containing all trigrams of at least one clause.
+ */
+typedef struct {
+    uint32_t *trigrams;
+    size_t count; // 0: every file
+} index_clause_t;
+
+typedef struct {
+    index_clause_t *clauses;
+    size_t count;
+} index_query_t;
+
+/**
+ * @brief Add a clause for a literal that every match of one pattern contains.
+ *
+ * A literal shorter than three bytes has no trigrams, so its clause matches every file.
+ * @return false on allocation failure.
+ */
+bool index_query_add_literal(index_query_t *query, const char *literal, size_t length);
+
+void index_query_destroy(index_query_t *query);
+
+/**
+ * @brief Find the files of one base or segment that may match the query.
+ * @param ids Receives a malloc'ed, ascending array of file numbers.
+ * @return false on allocation failure.
+ */
+bool index_query_run(const index_t *index, const index_query_t *query, uint32_t **ids, size_t *count);
+
+/**
+ * The base or one segment of an index set, with per-record bitmaps.
+ */
+typedef struct {
+    index_t index;
+    _Atomic(uint64_t) *unchanged; // Records an update walk found unchanged
+    uint64_t *candidates; // Records that may match the query, once one ran
+} index_generation_t;
+
+/**
+ * A base with its segments, oldest first, as seen by one search or update.
+ */
+typedef struct index_set {
+    index_generation_t *generations;
+    size_t count;
+} index_set_t;
+
+/**
+ * A record in an index set.
+ */
+typedef struct {
+    size_t generation;
+    uint32_t id;
+} index_ref_t;
+
+/**
+ * @brief Open the base in 'directory' and the segments written for it.
+ * @return false if there is no usable base.
+ */
+bool index_set_open(index_set_t *set, const char *directory);
+
+void index_set_close(index_set_t *set);
+
+/**
+ * @brief Find the current record of 'path' and check it against the file's metadata.
+ * @return true if the record exists and the file's inode, size and mtime still match it.
+ */
+bool index_set_find_unchanged(const index_set_t *set, const char *path, const struct stat *st, index_ref_t *ref);
+
+/**
+ * @brief Note that an update walk found the file of 'ref' unchanged. Thread safe.
+ */
+void index_set_keep(index_set_t *set, index_ref_t ref);
+
+/**
+ * @brief Run a query against every generation, for index_set_may_match().
+ * @return false on allocation failure.
+ */
+bool index_set_query(index_set_t *set, const index_query_t *query);
+
+static inline bool index_set_may_match(const index_set_t *set, index_ref_t ref) {
+    return (set->generations[ref.generation].candidates[ref.id / 64] >> (ref.id % 64)) & 1;
+}
+
+/**
+ * @brief After an update walk, record every current path not found unchanged as removed.
+ *
+ * Changed files were added to 'builder' again, which supersedes the removal.
+ * @return false on allocation failure.
+ */
+bool index_set_remove_stale(const index_set_t *set, index_builder_t *builder);
+
+/**
+ * @brief Write 'builder' as the next segment of the set's base in 'directory'.
+ * @return false on I/O or allocation failure.
+ */
+bool index_set_write_segment(const index_set_t *set, index_builder_t *builder, const char *directory,
+                             size_t *file_count, size_t *trigram_count);
+
+/**
+ * @brief Merge the base and its segments into a new base in 'directory' and delete the segments.
+ * @return false on I/O or allocation failure; the old files are then left as they were.
+ */
+bool index_set_compact(const index_set_t *set, const char *directory, size_t *file_count, size_t *trigram_count);
+
+#define auto_index_query [[gnu::cleanup(index_query_destroy)]]
+#define auto_index_set [[gnu::cleanup(index_set_close)]]
+
+#endif // INDEX_H
@@ -0,0 +1,86 @@
+#ifndef IO_H
+#define IO_H
+
+#include "raii.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @file io.h
+ * @brief Size-aware file loading.
+ *
+ * Small files are read with pread() into a buffer each worker reuses, which
+ * avoids the mmap()/page fault/munmap() round trip that dominates for them.
+ * Larger files are mapped with MADV_SEQUENTIAL, and pre-faulted with
+ * MAP_POPULATE up to a limit so the scan does not stop on every page.
+ */
+
+typedef struct {
+    size_t mmap_threshold; // Files of at least this size are mapped, smaller ones read
+    size_t populate_limit; // Mapped files up to this size are pre-faulted
+} io_config_t;
+
+enum {
+    IO_DEFAULT_MMAP_THRESHOLD = 128 * 1024,
+    IO_DEFAULT_POPULATE_LIMIT = 16 * 1024 * 1024,
+};
+
+/**
+ * Per-worker read buffer, grown on demand up to the mmap threshold.
+ */
+typedef struct {
+    char *data;
+    size_t capacity;
+} io_buffer_t;
+
+/**
+ * A loaded file: either a slice of the worker's io_buffer_t or a mapping.
+ */
+typedef struct {
+    const char *data;
+    size_t length;
+    struct mmap_region region; // .addr is MAP_FAILED unless the file is mapped
+} io_view_t;
+
+/**
+ * Process-wide counters of the strategy picked per file.
+ */
+typedef struct {
+    atomic_size_t files_read;
+    atomic_size_t bytes_read;
+    atomic_size_t files_mapped;
+    atomic_size_t bytes_mapped;
+    atomic_size_t files_populated;
+} io_stats_t;
+
+extern io_stats_t io_stats;
+
+/**
+ * @brief Load 'size' bytes of 'fd' into 'view'.
+ *
+ * A read file stays valid until the next io_load() with the same buffer; a
+ * mapped one until io_view_release().
+ * @return false on error; 'view' then holds nothing.
+ */
+bool io_load(int fd, size_t size, const io_config_t *config, io_buffer_t *buffer, io_view_t *view);
+
+/**
+ * @brief Ask the kernel to start reading a range of a mapped file.
+ */
+void io_advise_willneed(const char *data, size_t length);
+
+static inline void io_view_release(io_view_t *view) {
+    cleanup_munmap(&view->region);
+}
+
+static inline void io_buffer_destroy(io_buffer_t *buffer) {
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->capacity = 0;
+}
+
+#define auto_io_view [[gnu::cleanup(io_view_release)]]
+#define auto_io_buffer [[gnu::cleanup(io_buffer_destroy)]]
+
+#endif // IO_H
@@ -0,0 +1,44 @@
+#ifndef LITERAL_H
+#define LITERAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @file literal.h
+ * @brief Vectorized substring search.
+ *
+ * Candidates are found by comparing the needle's first and last bytes against
+ * a whole vector of haystack positions at once (AVX2 or SSE2, as simd_level()
+ * reports), and only positions where both anchors agree are verified.
+ * Caseless search folds ASCII letters only, matching PCRE2's default tables.
+ */
+
+typedef struct literal literal_t;
+
+typedef const char *(*literal_search_fn)(const literal_t *literal, const char *haystack, size_t length);
+
+struct literal {
+    char *needle; // Stored lowercased when caseless
+    size_t length;
+    bool caseless;
+    literal_search_fn search; // Best implementation for this CPU, chosen by literal_init()
+};
+
+/**
+ * @brief Copy 'needle' and prepare it for searching.
+ * @return false on allocation failure or an empty needle.
+ */
+bool literal_init(literal_t *literal, const char *needle, size_t length, bool caseless);
+
+void literal_destroy(literal_t *literal);
+
+/**
+ * @brief Find the first occurrence of the literal in 'haystack'.
+ * @return A pointer to the occurrence, or NULL.
+ */
+static inline const char *literal_find(const literal_t *literal, const char *haystack, size_t length) {
+    return literal->search(literal, haystack, length);
+}
+
+#endif // LITERAL_H
@@ -6,21 +6,148 @@
 
 #define PCRE2_CODE_UNIT_WIDTH 8
 #include <pcre2.h>
+#include "aho_corasick.h"
+#include "literal.h"
+#include "output.h"
+
+typedef enum {
+    MATCHER_ENGINE_PCRE2,
+    MATCHER_ENGINE_FIXED, // A single literal: plain substring search, no PCRE2 involved
+    MATCHER_ENGINE_MULTI_LITERAL, // Several literals: one Aho-Corasick pass
+} matcher_engine_t;
+
+typedef enum {
+    MATCHER_REPORT_LINES, // Print every matching line
+    MATCHER_REPORT_FILES_WITH_MATCHES, // -l: print the names of files with a match
+    MATCHER_REPORT_FILES_WITHOUT_MATCH, // -L: print the names of files without one
+    MATCHER_REPORT_COUNT, // -c: print the number of matching lines per file
+    MATCHER_REPORT_QUIET, // -q: print nothing; the first match ends the search
+} matcher_report_t;
 
 typedef struct {
-    pcre2_code *code;
+    matcher_engine_t engine; // Chosen by matcher_compile()
+    pcre2_code *code; // PCRE2 engine only
+    // FIXED engine: the needle. PCRE2 engine: a literal every match contains,
+    // used as a prefilter. Length 0 when there is none.
+    literal_t literal;
+    ac_automaton_t automaton; // MULTI_LITERAL engine only
+    size_t prefilter_min_spacing; // Average bytes per candidate line below which the prefilter is dropped
     bool case_insensitive;
     bool line_numbering;
+    bool fixed_strings;
+    matcher_report_t report;
+    size_t max_count; // -m: matching lines to find per file before stopping; SIZE_MAX for all
 } grep_config_t;
 
 /**
- * @brief Initialize the matcher with a pattern.
+ * Per-worker matching state, created once per thread and reused for every file.
+ */
+typedef struct {
+    pcre2_match_data *match_data;
+    pcre2_match_context *match_context;
+    pcre2_jit_stack *jit_stack;
+    bool use_jit;
+    output_buffer_t output; // Matches of the file being searched, flushed by output_end_file()
+} matcher_state_t;
+
+/**
+ * A matching line collected by matcher_collect_lines().
+ */
+typedef struct {
+    const char *start;
+    size_t length; // Including the newline, if the line has one
+    unsigned int line_number; // 1-based, counted from the start of the searched buffer
+} matcher_line_t;
+
+typedef struct {
+    matcher_line_t *items; // Only stored with MATCHER_REPORT_LINES; the other modes just count
+    size_t count;
+    size_t capacity;
+} matcher_lines_t;
+
+/**
+ * @brief Initialize the matcher with one or more patterns; a line matches if any of them does.
+ *
+ * With config->fixed_strings, or when no pattern uses a regex metacharacter,
+ * the patterns are searched for as-is: one by the FIXED engine, several by
+ * the MULTI_LITERAL engine. Otherwise they are joined into one alternation and
+ * JIT compiled when PCRE2 supports it (falling back to the interpreter), and
+ * the longest literal every match must contain is extracted into
+ * config->literal so that only lines holding it are handed to PCRE2.
+ *
+ * @return false if a pattern does not compile (the error is reported on stderr).
+ */
+bool matcher_compile(grep_config_t *config, const char *const *patterns, size_t count);
+
+/**
+ * @brief Find the longest literal that every match of one pattern contains.
+ *
+ * A fixed or metacharacter free pattern is its own literal; for a regex this
+ * is the literal matcher_compile() would use as its prefilter.
+ * @param best Receives the literal (not NUL terminated); must hold strlen(pattern) bytes.
+ * @return Its length, 0 if no literal could be found.
+ */
+size_t matcher_required_literal(const char *pattern, bool fixed_strings, char *best);
+
+/**
+ * @brief Free what matcher_compile() stored in the config.
  */
-pcre2_code* matcher_compile(const char *pattern, bool case_insensitive);
+void matcher_config_destroy(grep_config_t *config);
 
 /**
- * @brief Match a buffer and print results.
+ * @brief Allocate the match data, match context and JIT stack for one thread.
+ * @return false on allocation failure (the FIXED engine needs no state).
  */
-void matcher_process_buffer(const char *filename, const char *buffer, size_t length, const grep_config_t *config);
+bool matcher_state_init(matcher_state_t *state, const grep_config_t *config);
+
+void matcher_state_destroy(matcher_state_t *state);
+
+/**
+ * @brief The number of matching lines after which a file is settled: 1 for -l, -L and -q, else -m's.
+ */
+size_t matcher_match_limit(const grep_config_t *config);
+
+/**
+ * @brief Match a buffer with the configured engine and queue matching lines in state->output.
+ *
+ * Matching lines may be referenced rather than copied, so 'buffer' must stay
+ * mapped until output_end_file(&state->output) has been called. Only
+ * MATCHER_REPORT_LINES prints anything; see matcher_report_file().
+ *
+ * @param limit Stop after this many matching lines.
+ * @return The number of matching lines found.
+ */
+size_t matcher_process_buffer(const char *filename, const char *buffer, size_t length,
+                              const grep_config_t *config, matcher_state_t *state, size_t limit);
+
+/**
+ * @brief Match a buffer like matcher_process_buffer(), but collect the matching lines instead of printing them.
+ *
+ * Used for the chunks of a file searched in parallel, whose line numbers are
+ * only known once all earlier chunks are counted.
+ *
+ * @param limit Stop after this many matching lines.
+ * @return The number of newlines in the buffer with config->line_numbering, otherwise 0.
+ */
+unsigned int matcher_collect_lines(const char *buffer, size_t length, const grep_config_t *config,
+                                   matcher_state_t *state, matcher_lines_t *lines, size_t limit);
+
+/**
+ * @brief Print collected lines, adding 'line_offset' to their line numbers (MATCHER_REPORT_LINES only).
+ */
+void matcher_print_lines(const char *filename, const grep_config_t *config, const matcher_lines_t *lines,
+                         unsigned int line_offset, output_buffer_t *out);
+
+void matcher_lines_destroy(matcher_lines_t *lines);
+
+/**
+ * @brief Print what -l, -L or -c report for a whole file once its matching lines are counted.
+ * @param filename NULL for standard input searched on its own.
+ */
+void matcher_report_file(const char *filename, const grep_config_t *config, size_t matches,
+                         output_buffer_t *out);
+
+#define auto_grep_config [[gnu::cleanup(matcher_config_destroy)]]
+#define auto_matcher_state [[gnu::cleanup(matcher_state_destroy)]]
 
 #endif // MATCHER_H
@@ -0,0 +1,75 @@
+#ifndef ORDER_H
+#define ORDER_H
+
+#include "output.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/**
+ * @file order.h
+ * @brief Reorder buffer for deterministic (--ordered) output.
+ *
+ * Every queued path gets a slot in a tree that mirrors the search: command
+ * line paths are children of the root in argument order, and a directory's
+ * entries are its children in name order. Output is emitted in a depth-first
+ * walk of that tree, so it does not depend on which worker finished first.
+ *
+ * Workers keep running ahead of the emission cursor. Output that cannot be
+ * emitted yet is held in memory up to a cap; beyond it, it is spilled to an
+ * anonymous temporary file and read back when the cursor reaches it.
+ */
+
+typedef struct order_slot {
+    struct order_slot *parent;
+    struct order_slot *first_child; // Fixed once the slot is resolved
+    struct order_slot *last_child;
+    struct order_slot *next_sibling;
+    char *data; // Held output, or NULL
+    size_t length;
+    off_t spill_offset; // Where the output lives in the spill file when 'spilled'
+    bool spilled;
+    bool resolved;
+} order_slot_t;
+
+typedef struct order {
+    pthread_mutex_t mutex;
+    order_slot_t root;
+    order_slot_t *cursor; // Next slot to emit, NULL once everything is out
+    bool emitting; // A thread is writing emitted output outside the mutex
+    size_t buffered; // Bytes held in memory
+    size_t memory_cap;
+    FILE *spill; // Created on first use
+    off_t spill_end;
+} order_t;
+
+/**
+ * @brief Initialize an empty order holding at most 'memory_cap' bytes of output in memory.
+ */
+void order_init(order_t *order, size_t memory_cap);
+
+/**
+ * @brief Append a child slot below 'parent' (NULL for a command line path).
+ *
+ * Only the thread that will resolve 'parent' may add children to it, and
+ * only before resolving it.
+ */
+order_slot_t *order_append_child(order_t *order, order_slot_t *parent);
+
+/**
+ * @brief Resolve a slot with the output buffered in 'out' (may be NULL or empty).
+ *
+ * The output is written immediately if 'slot' is next in line, and held or
+ * spilled otherwise; 'out' is left empty either way. Pass NULL as 'slot' to
+ * resolve the root once every command line path has been added.
+ */
+void order_finish(order_t *order, order_slot_t *slot, output_buffer_t *out);
+
+/**
+ * @brief Free all slots and the spill file.
+ */
+void order_destroy(order_t *order);
+
+#endif // ORDER_H
@@ -1,6 +1,105 @@
 #ifndef OUTPUT_H
 #define OUTPUT_H
 
-void output_printf(const char *fmt, ...);
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * @file output.h
+ * @brief Per-worker output batching.
+ *
+ * Each worker collects a file's output in its own buffer: short pieces are
+ * copied into a scratch area, long lines are kept as references into the
+ * caller's (mmap'd) data. output_end_file() writes the batch to stdout with
+ * writev() while holding the global output lock, so lines from different
+ * files never interleave. A file whose output outgrows the buffer is flushed
+ * early and keeps the lock until its end.
+ *
+ * In capture mode (--ordered) nothing is flushed early and all data is
+ * copied, so a file's output can outlive its mapping and be handed to the
+ * reorder buffer in order.h.
+ *
+ * A file produced a piece at a time (decompressed with -z) sets 'copy' and
+ * calls output_yield() between pieces, so the lock is never held while the
+ * next piece is produced.
+ */
+
+typedef struct {
+    const char *base; // NULL when the bytes live in the scratch area at 'offset'
+    size_t offset;
+    size_t length;
+} output_segment_t;
+
+typedef struct {
+    output_segment_t *segments;
+    size_t segment_count;
+    size_t segment_capacity;
+    char *scratch;
+    size_t scratch_used;
+    size_t scratch_capacity;
+    size_t pending; // Bytes buffered for the current file
+    bool holds_lock; // Part of the current file was already written
+    bool capture; // Set by the owner: buffer whole files and never reference caller data
+    bool copy; // Set by the owner: never reference caller data, but still flush early
+} output_buffer_t;
+
+void output_buffer_init(output_buffer_t *out);
+
+/**
+ * @brief Flush anything still buffered and free the buffer.
+ */
+void output_buffer_destroy(output_buffer_t *out);
+
+/**
+ * @brief Append a copy of 'data'.
+ */
+void output_write(output_buffer_t *out, const char *data, size_t length);
+
+/**
+ * @brief Append 'data' without copying it when it is long enough to matter.
+ *
+ * 'data' must stay valid until the next output_end_file().
+ */
+void output_write_ref(output_buffer_t *out, const char *data, size_t length);
+
+void output_write_uint(output_buffer_t *out, unsigned int value);
+
+/**
+ * @brief Write everything buffered for the current file to stdout in one batch.
+ */
+void output_end_file(output_buffer_t *out);
+
+/**
+ * @brief Give the output lock back if an early flush took it, writing what is buffered first.
+ *
+ * Called between lines, so the rest of the file's output may follow other
+ * files' output but never splits a line. Does nothing while the lock is free,
+ * and so nothing in capture mode, which never flushes early.
+ */
+void output_yield(output_buffer_t *out);
+
+/**
+ * @brief Copy everything buffered for the current file into 'dest' (out->pending bytes).
+ */
+void output_copy_to(const output_buffer_t *out, char *dest);
+
+/**
+ * @brief Write everything buffered for the current file to 'fd' at 'offset'.
+ * @return false if the write failed.
+ */
+bool output_spill_to(const output_buffer_t *out, int fd, off_t offset);
+
+/**
+ * @brief Drop everything buffered for the current file.
+ */
+void output_discard(output_buffer_t *out);
+
+/**
+ * @brief Write 'data' straight to stdout under the output lock.
+ */
+void output_write_raw(const char *data, size_t length);
+
+#define auto_output_buffer [[gnu::cleanup(output_buffer_destroy)]]
 
 #endif // OUTPUT_H
@@ -0,0 +1,118 @@
+#ifndef PATH_H
+#define PATH_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/**
+ * @file path.h
+ * @brief Interned path nodes allocated from bump arenas.
+ *
+ * A queued path is a node holding its own name and a counted reference to
+ * its parent directory's node, so a directory prefix is stored once no matter
+ * how many children are pending. Full paths are only materialized with
+ * path_node_format() right before they are opened or printed.
+ *
+ * A directory node can also hold the open descriptor it was listed through,
+ * so its children are opened with openat() on their bare name instead of
+ * making the kernel walk the full path again.
+ */
+
+enum {
+    PATH_CHUNK_SIZE = 64 * 1024,
+    PATH_HELD_DIR_LIMIT = 256, // Directory descriptors held at once, process wide
+};
+
+/**
+ * Arena chunk. Chunks are PATH_CHUNK_SIZE aligned so a node finds its chunk by
+ * masking its own address. 'live' counts nodes still referenced plus one bias
+ * held by the owning arena while it still allocates from the chunk.
+ */
+typedef struct path_chunk {
+    atomic_size_t live;
+    size_t used;
+    alignas(max_align_t) char data[];
+} path_chunk_t;
+
+struct order_slot;
+struct file_chunk;
+struct ignore_rules;
+
+typedef struct path_node {
+    struct path_node *parent; // NULL for a path given on the command line
+    struct order_slot *order_slot; // Output position with --ordered, otherwise NULL
+    struct file_chunk *chunk; // Set when the node stands for a slice of its parent file
+    struct ignore_rules *ignore; // Rules for a listed directory's entries (--gitignore), released with the node
+    atomic_uint refs;
+    int dir_fd; // Held descriptor children are opened against, or -1; closed with the last reference
+    uint16_t name_len;
+    uint8_t type; // d_type from the parent's listing, DT_UNKNOWN if not known
+    uint8_t work_class; // Scheduling class (work_class_t); 0, the first, unless discovery classed it
+    char name[];
+} path_node_t;
+
+/**
+ * Single-owner bump allocator. Nodes may be released from any thread; a chunk
+ * returns to the system once the owner has moved on and its last node is gone.
+ */
+typedef struct {
+    path_chunk_t *current;
+} path_arena_t;
+
+/**
+ * @brief Allocate a node named 'name' below 'parent' (which is retained).
+ * @return The node with one reference, or NULL if 'name' is too long.
+ */
+path_node_t *path_node_create(path_arena_t *arena, path_node_t *parent, const char *name);
+
+path_node_t *path_node_retain(path_node_t *node);
+
+/**
+ * @brief Drop a reference, releasing the node and any parents it kept alive.
+ */
+void path_node_release(path_node_t *node);
+
+/**
+ * @brief Keep 'fd' open as the directory children of 'node' are opened against.
+ *
+ * Must be called before any child is queued. Fails once PATH_HELD_DIR_LIMIT
+ * descriptors are held; children then fall back to full paths.
+ * @return true if the node took over 'fd'.
+ */
+bool path_node_hold_dir(path_node_t *node, int fd);
+
+/**
+ * @brief open() 'node', whose full path is 'path', relative to its parent's held directory if possible.
+ */
+int path_node_open(const path_node_t *node, const char *path, int flags);
+
+/**
+ * @brief lstat() 'node', whose full path is 'path', relative to its parent's held directory if possible.
+ */
+int path_node_lstat(const path_node_t *node, const char *path, struct stat *st);
+
+/**
+ * @brief Write the full path of 'node' into 'buffer'.
+ * @return The path length, or 0 if it does not fit.
+ */
+size_t path_node_format(const path_node_t *node, char *buffer, size_t size);
+
+/**
+ * @brief Give up the arena's current chunk. Nodes already handed out stay valid.
+ */
+void path_arena_destroy(path_arena_t *arena);
+
+static inline void cleanup_path_node(path_node_t **node) {
+    if (*node) {
+        path_node_release(*node);
+        *node = NULL;
+    }
+}
+
+#define auto_path_node [[gnu::cleanup(cleanup_path_node)]]
+
+#endif // PATH_H
@@ -0,0 +1,48 @@
+#ifndef SCALER_H
+#define SCALER_H
+
+#include "worker.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @file scaler.h
+ * @brief --adaptive: grow the active worker count while workers wait on I/O, shrink it when CPU-bound.
+ *
+ * All threads up to the ceiling are started up front; the scaler only moves
+ * the queue's active count (work_queue_set_active_workers()). Every tick it
+ * compares the CPU time the process used with the CPUs it may use. When no
+ * worker is out of work yet the CPUs are mostly unused, the workers are
+ * waiting on reads (cold cache, network filesystems) and more of them keep
+ * more requests in flight, so the count grows. Once the CPUs are saturated,
+ * extra threads only add switching, so it shrinks back towards the floor.
+ */
+
+typedef struct {
+    work_queue_t *queue;
+    size_t cpus; // CPUs the process may use (cpu_count_available())
+    size_t min_workers;
+    size_t max_workers;
+    size_t peak; // Highest active count so far
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; // Signals 'stop'
+    bool stop;
+} worker_scaler_t;
+
+/**
+ * @brief Activate 'min_workers' of the queue's workers and start adjusting the count between the two bounds.
+ *
+ * The queue must have been initialized for 'max_workers'.
+ * @return false if the scaler thread could not be started (the count then stays at 'min_workers').
+ */
+bool worker_scaler_start(worker_scaler_t *scaler, work_queue_t *queue, size_t cpus, size_t min_workers,
+                         size_t max_workers);
+
+/**
+ * @brief Stop adjusting and join the scaler thread. The active count is left as it is.
+ */
+void worker_scaler_stop(worker_scaler_t *scaler);
+
+#endif // SCALER_H
@@ -0,0 +1,52 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @file simd.h
+ * @brief Vectorized byte scanning kernels.
+ *
+ * Each kernel has a scalar, an SSE2 and an AVX2 implementation; the best one
+ * for the running CPU is picked once at startup. They are used for the hot
+ * byte loops of the search path: finding line boundaries around a match,
+ * counting newlines for -n and detecting NUL bytes in binary files.
+ *
+ * This is the only place the CPU is probed: other vectorized code (the
+ * substring search in literal.c) picks its implementation by simd_level().
+ */
+
+typedef enum {
+    SIMD_LEVEL_SCALAR, // Not x86, or no vector kernels built
+    SIMD_LEVEL_SSE2,
+    SIMD_LEVEL_AVX2,
+} simd_level_t;
+
+/**
+ * @brief The instruction set the kernels were picked for at startup.
+ */
+simd_level_t simd_level(void);
+
+/**
+ * @brief Find the first 'byte' in 'buffer[0, length)'.
+ * @return A pointer to it, or NULL.
+ */
+const char *simd_find_byte(const char *buffer, size_t length, char byte);
+
+/**
+ * @brief Find the last 'byte' in 'buffer[0, length)'.
+ * @return A pointer to it, or NULL.
+ */
+const char *simd_rfind_byte(const char *buffer, size_t length, char byte);
+
+/**
+ * @brief Count the occurrences of 'byte' in 'buffer[0, length)'.
+ */
+size_t simd_count_byte(const char *buffer, size_t length, char byte);
+
+static inline bool simd_contains_byte(const char *buffer, size_t length, char byte) {
+    return simd_find_byte(buffer, length, byte) != NULL;
+}
+
+#endif // SIMD_H
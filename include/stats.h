@@ -0,0 +1,120 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @file stats.h
+ * @brief --stats: per-thread counters and phase timings, merged and printed at exit.
+ *
+ * Each thread taking part registers once and then counts into its own
+ * cache-line aligned record through a thread-local pointer, so counting takes
+ * no lock and shares no cache line. A thread's time is charged to one phase
+ * at a time: stats_enter() charges the time since the last switch to the
+ * phase being left and returns it, and stats_leave() switches back. Nested
+ * phases (output flushed while matching) are thus never counted twice, and a
+ * thread's phases add up to its lifetime. Without --stats the thread-local
+ * pointer is NULL and every hook is a load and a branch.
+ */
+
+typedef enum {
+    STATS_FILES, // Regular files opened for searching
+    STATS_DIRS, // Directories listed
+    STATS_BYTES, // Bytes handed to the matcher
+    STATS_MATCHES, // Matching lines, up to each file's match limit
+    STATS_BINARY_SKIPS,
+    STATS_FILTERED, // Files and directories left out by --include, --exclude or ignore files
+    STATS_INDEX_SKIPS, // Files ruled out by --index without being read
+    STATS_QUEUE_CONTENDED, // Work queue lock acquisitions that had to wait
+    STATS_COUNTER_COUNT,
+} stats_counter_t;
+
+typedef enum {
+    STATS_PHASE_OTHER, // Anything below none of the others: stat calls, bookkeeping
+    STATS_PHASE_DISCOVERY, // Listing directories and filtering their entries
+    STATS_PHASE_IO, // Opening, reading, mapping and decompressing files
+    STATS_PHASE_MATCH,
+    STATS_PHASE_OUTPUT, // Writing results to stdout
+    STATS_PHASE_OUTPUT_LOCK, // Waiting for the output lock
+    STATS_PHASE_QUEUE_LOCK, // Waiting for a work queue mutex
+    STATS_PHASE_QUEUE_WAIT, // Asleep on the work queue's condition variable
+    STATS_PHASE_IDLE, // Otherwise out of work: looking for some, or waiting on another thread
+    STATS_PHASE_COUNT,
+} stats_phase_t;
+
+typedef struct {
+    alignas(64) const char *role; // "main" or "worker"
+    uint64_t counters[STATS_COUNTER_COUNT];
+    uint64_t ns[STATS_PHASE_COUNT];
+    stats_phase_t phase; // Being charged since 'since'
+    uint64_t since;
+    uint64_t start;
+    uint64_t end;
+} stats_thread_t;
+
+typedef struct stats {
+    stats_thread_t *threads;
+    size_t capacity;
+    atomic_size_t count;
+    uint64_t start;
+    struct {
+        size_t start, peak, end; // Active workers; all 0 without --adaptive
+    } adaptive;
+} stats_t;
+
+/** The calling thread's record, NULL when --stats is off or the thread did not register. */
+extern _Thread_local stats_thread_t *stats_current;
+
+/**
+ * @brief Prepare records for up to 'capacity' threads and start the wall clock.
+ * @return false on allocation failure.
+ */
+bool stats_init(stats_t *stats, size_t capacity);
+
+void stats_destroy(stats_t *stats);
+
+/**
+ * @brief Give the calling thread a record; it counts from now on.
+ *
+ * Threads beyond the capacity are silently not counted.
+ */
+void stats_thread_begin(stats_t *stats, const char *role);
+
+/**
+ * @brief Close the calling thread's record before the thread exits.
+ */
+void stats_thread_end(void);
+
+/**
+ * @brief Charge the time since the last switch to the current phase and start 'phase'.
+ * @return The phase that was current.
+ */
+stats_phase_t stats_switch(stats_thread_t *thread, stats_phase_t phase);
+
+static inline void stats_count(stats_counter_t counter, uint64_t amount) {
+    stats_thread_t *thread = stats_current;
+    if (thread) thread->counters[counter] += amount;
+}
+
+static inline stats_phase_t stats_enter(stats_phase_t phase) {
+    stats_thread_t *thread = stats_current;
+    return thread ? stats_switch(thread, phase) : STATS_PHASE_OTHER;
+}
+
+static inline void stats_leave(stats_phase_t previous) {
+    stats_thread_t *thread = stats_current;
+    if (thread) stats_switch(thread, previous);
+}
+
+/**
+ * @brief Print the merged totals and a line per thread to stderr, as text or as one JSON object.
+ */
+void stats_print(const stats_t *stats, bool json);
+
+#define auto_stats [[gnu::cleanup(stats_destroy)]]
+
+#endif // STATS_H
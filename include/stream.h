@@ -0,0 +1,36 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "matcher.h"
+#include <stdbool.h>
+
+/**
+ * @file stream.h
+ * @brief Search of stdin, pipes and other inputs that cannot be mapped.
+ *
+ * A reader thread fills two blocks in turn while the caller searches the
+ * other one, so reading the next block overlaps the scan of the current one.
+ * A block is handed over up to its last newline; the partial line after it
+ * starts the next block, and line numbers continue across blocks. Reading
+ * goes on while more input is ready and the block has room, so a busy pipe
+ * yields large blocks and a slow one (a log being followed) is searched as
+ * soon as a line arrives. Memory stays at two blocks, unless a single line is
+ * longer than a block: the blocks then grow to hold it.
+ */
+
+enum { STREAM_BLOCK_SIZE = 1024 * 1024 };
+
+/**
+ * @brief Search 'fd' until end of input, printing matches as each block is searched.
+ *
+ * Reading stops early once the match limit (-m, -l, -L, -q) is reached, even
+ * if the reader is waiting for more input.
+ *
+ * @param label Printed before each matching line, or NULL for none.
+ * @param ignore_binary Skip the input if its first block looks binary.
+ * @param matches Receives the number of matching lines, up to the match limit.
+ * @return false if reading failed (reported on stderr) or the reader could not be started.
+ */
+bool stream_search(int fd, const char *label, const grep_config_t *config, bool ignore_binary, size_t *matches);
+
+#endif // STREAM_H
@@ -0,0 +1,65 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * @file uring.h
+ * @brief Batched stat/open/read of files through io_uring (built with ENABLE_IO_URING).
+ *
+ * A worker hands the reader many paths at once and gets them back as they
+ * complete, so dozens of stat, open and read requests per thread are in
+ * flight instead of one blocking chain at a time. Regular files below
+ * 'max_read' are read whole into per-request buffers; anything else comes
+ * back with only its type and size for the caller to handle synchronously.
+ */
+
+typedef struct uring_reader uring_reader_t;
+
+typedef struct {
+    void *user; // As given to uring_reader_submit()
+    const char *path;
+    int error; // errno of the failed step, or 0
+    mode_t mode; // File type bits, valid unless 'error'
+    size_t size;
+    const char *data; // Whole file contents, or NULL if it was not read
+    size_t length;
+} uring_result_t;
+
+/**
+ * @brief Set up a ring with 'depth' requests in flight.
+ * @return NULL if io_uring or one of the operations it needs is unavailable.
+ */
+uring_reader_t *uring_reader_create(unsigned depth, size_t max_read);
+
+void uring_reader_destroy(uring_reader_t *reader);
+
+/**
+ * @return true if another path can be submitted.
+ */
+bool uring_reader_has_room(const uring_reader_t *reader);
+
+/**
+ * @return Submitted paths whose results have not been released yet.
+ */
+unsigned uring_reader_pending(const uring_reader_t *reader);
+
+/**
+ * @brief Queue 'path' to be stat'ed and, if it is a wanted regular file, read.
+ * @return false if the path does not fit (the caller handles it synchronously).
+ */
+bool uring_reader_submit(uring_reader_t *reader, const char *path, bool want_data, void *user);
+
+/**
+ * @brief Wait for the next finished path.
+ *
+ * The result stays valid until it is passed to uring_reader_release().
+ * @return false if nothing is pending.
+ */
+bool uring_reader_next(uring_reader_t *reader, uring_result_t *result);
+
+void uring_reader_release(uring_reader_t *reader, const uring_result_t *result);
+
+#endif // URING_H
@@ -2,66 +2,244 @@
 #define WORKER_H
 
 #include "matcher.h"
+#include "path.h"
+#include "io.h"
 #include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
 
+/**
+ * Growable ring buffer backing a work-stealing deque.
+ * Rings replaced by a grow are kept on the 'retired' chain until the queue is
+ * destroyed, because a concurrent thief may still be reading from them.
+ */
+typedef struct work_ring {
+    int64_t capacity; // Always a power of two
+    struct work_ring *retired;
+    _Atomic(path_node_t *) slots[];
+} work_ring_t;
+
+/**
+ * Scheduling classes, in the order workers take them. With --largest-first,
+ * directories come first so the frontier expands early, then files from the
+ * largest down: the longest jobs start first and the small ones fill in
+ * around them, instead of a big file turning up last and running long after
+ * every other worker went idle. Items of the rare classes are taken from
+ * anywhere in the queue before a worker's own common ones. Within a class,
+ * owners still work depth first and thieves take the oldest item.
+ */
+typedef enum {
+    WORK_CLASS_FIRST, // Chunks of split files (their splitter waits on them), command line paths, and directories
+    WORK_CLASS_HUGE, // Files of WORK_HUGE_SIZE or more
+    WORK_CLASS_LARGE, // WORK_LARGE_SIZE or more
+    WORK_CLASS_MEDIUM, // WORK_MEDIUM_SIZE or more, of unknown size, or anything listed without --largest-first
+    WORK_CLASS_SMALL,
+    WORK_CLASS_COUNT,
+} work_class_t;
+
+#define WORK_HUGE_SIZE (16 * 1024 * 1024)
+#define WORK_LARGE_SIZE (1024 * 1024)
+#define WORK_MEDIUM_SIZE (64 * 1024)
+
+static inline work_class_t work_class_for_size(uint64_t size) {
+    if (size >= WORK_HUGE_SIZE) return WORK_CLASS_HUGE;
+    if (size >= WORK_LARGE_SIZE) return WORK_CLASS_LARGE;
+    if (size >= WORK_MEDIUM_SIZE) return WORK_CLASS_MEDIUM;
+    return WORK_CLASS_SMALL;
+}
+
+/**
+ * Chase-Lev deque owned by a single worker.
+ * The owner pushes and pops at 'bottom' (LIFO), thieves steal at 'top' (FIFO).
+ */
 typedef struct {
-    char **items;
+    alignas(64) _Atomic(int64_t) top;
+    alignas(64) _Atomic(int64_t) bottom;
+    _Atomic(work_ring_t *) ring;
+} work_deque_t;
+
+/**
+ * A registered worker's part of the queue: one deque per scheduling class.
+ * 'pushed' and 'completed' are only written by the owner and are summed by
+ * the termination check, replacing a single shared pending counter.
+ */
+typedef struct {
+    work_deque_t deques[WORK_CLASS_COUNT];
+    atomic_size_t pushed;
+    atomic_size_t completed;
+    path_arena_t arena; // Owner only
+} work_local_t;
+
+typedef struct {
+    path_node_t **items;
     size_t head;
     size_t tail;
     size_t capacity;
+} work_fifo_t;
+
+/**
+ * Mutex protected FIFOs, one per scheduling class, for items pushed by
+ * threads that are not registered workers (the main thread during initial
+ * discovery, tests).
+ */
+typedef struct {
+    work_fifo_t fifos[WORK_CLASS_COUNT];
     pthread_mutex_t mutex;
+    atomic_size_t count;
+    atomic_size_t pushed;
+    atomic_size_t completed;
+    path_arena_t arena; // Guarded by 'mutex'
+} work_injector_t;
+
+typedef struct {
+    work_local_t *locals;
+    size_t num_workers;
+    atomic_size_t registered;
+    // Queued items of each class before WORK_CLASS_MEDIUM, wherever they are. These
+    // are rare, so workers can afford to look for them everywhere before their own
+    // common items, and the counts are a hint that spares the look when there are none.
+    alignas(64) atomic_size_t rare[WORK_CLASS_MEDIUM];
+    work_injector_t injector;
+    pthread_mutex_t mutex; // Only taken by idle workers going to sleep and by their wakers
     pthread_cond_t cond;
-    bool done;
-    int pending_items;
+    atomic_int sleepers;
+    atomic_size_t active; // Registered workers with an index at or above this park between items
+    pthread_cond_t park_cond; // Where they park, on 'mutex'; kept apart from 'cond' so pushes never wake them
+    atomic_bool done;
+    atomic_bool cancelled; // Set by work_queue_cancel()
 } work_queue_t;
 
 struct discovery_config;
+struct index_builder;
+struct index_set;
+struct stats;
 
 typedef struct {
     work_queue_t *queue;
     const grep_config_t *grep_config;
     const struct discovery_config *discovery_config;
+    size_t chunk_size; // Files larger than this are searched in parallel chunks; 0 disables
+    io_config_t io_config;
+    bool use_io_uring; // Batch stat/open/read through io_uring where built and supported
+    bool decompress; // -z: search gzip and zstd files through their decompressed contents
+    struct index_builder *index_builder; // Set for --index-build/--index-update: files are indexed instead of searched
+    struct index_set *index_set; // Set for --index/--index-update: files unchanged since indexing are settled by the index
+    struct stats *stats; // Set for --stats: each worker counts into its own record
+    atomic_bool *failed; // Set by a worker that could not set up its matcher; it cancels the queue
 } worker_args_t;
 
 /**
- * @brief Initialize a work queue.
+ * @brief Initialize a work queue with one local deque per worker.
+ *
+ * @param queue The work queue.
+ * @param num_workers Number of threads that will call work_queue_register_worker().
+ */
+void work_queue_init(work_queue_t *queue, size_t num_workers);
+
+/**
+ * @brief Bind the calling thread to one of the queue's sets of worker deques.
+ *
+ * Pushes from a registered thread go to its own deque without locking, and its
+ * pops prefer that deque before stealing from others. Threads that never
+ * register (or register after all deques are taken) use the shared injector.
  */
-void work_queue_init(work_queue_t *queue);
+void work_queue_register_worker(work_queue_t *queue);
+
+/**
+ * @brief Let only the first 'count' registered workers take items.
+ *
+ * The others park in work_queue_pop() until the count covers them again or
+ * the queue is done; items already in their deques are stolen by the rest.
+ * All registered workers are active after work_queue_init().
+ */
+void work_queue_set_active_workers(work_queue_t *queue, size_t count);
+
+static inline size_t work_queue_active_workers(const work_queue_t *queue) {
+    return atomic_load_explicit(&queue->active, memory_order_relaxed);
+}
 
 /**
- * @brief Push a new path into the queue and increment the pending items count.
- * 
+ * @brief Allocate a path node from the calling thread's arena.
+ *
  * @param queue The work queue.
- * @param filename The path to add.
+ * @param parent The directory node 'name' lives in, or NULL for a root path.
+ * @param name The entry name (or the full path of a root).
+ * @return A node holding one reference, or NULL if the name is too long.
  */
-void work_queue_push(work_queue_t *queue, const char *filename);
+path_node_t *work_queue_new_node(work_queue_t *queue, path_node_t *parent, const char *name);
+
+/**
+ * @brief Push a node into the queue and count it as pending.
+ *
+ * The queue takes over the caller's reference.
+ */
+void work_queue_push_node(work_queue_t *queue, path_node_t *node);
+
+/**
+ * @brief Push a new path into the queue and count it as pending.
+ *
+ * @param queue The work queue.
+ * @param parent The directory node 'name' lives in, or NULL for a root path.
+ * @param name The entry name (or the full path of a root).
+ */
+void work_queue_push(work_queue_t *queue, path_node_t *parent, const char *name);
+
+/**
+ * @brief Count a pending item that is not stored in the queue.
+ *
+ * Use this to keep workers alive while items are still being produced from
+ * outside the workers (e.g. initial discovery). Release it with work_queue_item_done().
+ */
+void work_queue_hold(work_queue_t *queue);
 
 /**
  * @brief Pop a path from the queue.
- * 
- * Blocks if the queue is empty but not 'done'.
- * 
+ *
+ * Takes from the caller's own deques first, then the injector, then steals from
+ * other workers, each in class order. Blocks if no work is available but the
+ * queue is not 'done'.
+ *
  * @note Every successful pop MUST be followed by a call to work_queue_item_done()
  *       after the item is processed (or if processing is skipped).
- * @return A heap-allocated string (caller must free), or NULL if the queue is finished.
+ * @return A node reference (caller must release), or NULL if the queue is finished.
+ */
+path_node_t* work_queue_pop(work_queue_t *queue);
+
+/**
+ * @brief Pop a path from the queue without blocking.
+ *
+ * Same order as work_queue_pop(), and the same work_queue_item_done() duty.
+ * @return A node reference (caller must release), or NULL if nothing is available right now.
  */
-char* work_queue_pop(work_queue_t *queue);
+path_node_t *work_queue_try_pop(work_queue_t *queue);
 
 /**
- * @brief Decrement the pending items count and signal 'done' if it reaches zero.
- * 
+ * @brief Mark one pending item as completed and signal 'done' once none remain.
+ *
  * This function handles the lifecycle of the queue. Once all pushed items
- * (and any initial sentinels) are marked as done, workers will exit.
+ * (and any holds) are marked as done, workers will exit.
  */
 void work_queue_item_done(work_queue_t *queue);
 
 /**
  * @brief Explicitly set the 'done' flag to true.
- * 
+ *
  * Use this to force termination of the workers even if pending items remain.
  */
 void work_queue_set_done(work_queue_t *queue);
 
+/**
+ * @brief Stop the search early: workers exit after the item in hand and discovery stops listing.
+ *
+ * Used by -q once anything matched. Items still queued are dropped.
+ */
+void work_queue_cancel(work_queue_t *queue);
+
+static inline bool work_queue_is_cancelled(const work_queue_t *queue) {
+    return atomic_load_explicit(&queue->cancelled, memory_order_relaxed);
+}
+
 /**
  * @brief Destroy the queue and free its internal resources.
  */
@@ -71,7 +249,7 @@ void work_queue_destroy(work_queue_t *queue);
  * RAII helper for work_queue_t.
  */
 static inline void work_queue_cleanup(work_queue_t *queue) {
-    if (queue->items) { // Simple check to see if it was initialized
+    if (queue->locals) { // Simple check to see if it was initialized
         work_queue_destroy(queue);
     }
 }
@@ -0,0 +1,148 @@
+#include "aho_corasick.h"
+#include "raii.h"
+#include <string.h>
+
+enum { AC_NO_STATE = UINT32_MAX };
+
+static unsigned char ac_fold(unsigned char byte, bool caseless) {
+    return (caseless && byte >= 'A' && byte <= 'Z') ? (unsigned char)(byte | 0x20) : byte;
+}
+
+static uint32_t ac_assign_classes(ac_automaton_t *automaton, const char *const *patterns, size_t count, bool caseless) {
+    bool used[256] = { false };
+    for (size_t i = 0; i < count; i++) {
+        for (const unsigned char *pos = (const unsigned char *)patterns[i]; *pos; pos++) {
+            used[ac_fold(*pos, caseless)] = true;
+        }
+    }
+
+    // Every byte that occurs in some pattern gets its own class; all the others
+    // behave identically and share the last one.
+    uint32_t num_classes = 0;
+    for (int byte = 0; byte < 256; byte++) {
+        if (used[byte]) automaton->byte_class[byte] = (uint8_t)num_classes++;
+    }
+    if (num_classes < 256) {
+        for (int byte = 0; byte < 256; byte++) {
+            if (!used[byte]) automaton->byte_class[byte] = (uint8_t)num_classes;
+        }
+        num_classes++;
+    }
+    if (caseless) {
+        for (int byte = 'A'; byte <= 'Z'; byte++) {
+            automaton->byte_class[byte] = automaton->byte_class[byte | 0x20];
+        }
+    }
+    return num_classes;
+}
+
+bool ac_build(ac_automaton_t *automaton, const char *const *patterns, size_t count, bool caseless) {
+    memset(automaton, 0, sizeof(*automaton));
+
+    size_t total_len = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t pattern_len = strlen(patterns[i]);
+        if (pattern_len == 0) automaton->matches_empty = true;
+        total_len += pattern_len;
+    }
+
+    uint32_t num_classes = ac_assign_classes(automaton, patterns, count, caseless);
+    automaton->num_classes = num_classes;
+    if (automaton->matches_empty) return true; // ac_find() never needs the table
+
+    // Row offsets must fit in 32 bits.
+    size_t max_states = total_len + 1;
+    if ((uint64_t)max_states * num_classes > UINT32_MAX) return false;
+
+    auto_free uint32_t *trie = malloc(max_states * num_classes * sizeof(uint32_t));
+    auto_free uint8_t *accepting = calloc(max_states, 1);
+    auto_free uint32_t *fail = malloc(max_states * sizeof(uint32_t));
+    auto_free uint32_t *order = malloc(max_states * sizeof(uint32_t));
+    if (!trie || !accepting || !fail || !order) return false;
+    memset(trie, 0xff, max_states * num_classes * sizeof(uint32_t));
+
+    // Trie of all patterns.
+    uint32_t num_states = 1;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t state = 0;
+        for (const unsigned char *pos = (const unsigned char *)patterns[i]; *pos; pos++) {
+            uint32_t *slot = &trie[((size_t)state * num_classes) + automaton->byte_class[*pos]];
+            if (*slot == AC_NO_STATE) *slot = num_states++;
+            state = *slot;
+        }
+        accepting[state] = 1;
+    }
+
+    // Breadth-first pass turning the trie into a DFA: missing edges borrow the
+    // failure state's edge, and a state accepts if its failure state does.
+    size_t head = 0;
+    size_t tail = 0;
+    for (uint32_t cls = 0; cls < num_classes; cls++) {
+        uint32_t child = trie[cls];
+        if (child == AC_NO_STATE) {
+            trie[cls] = 0;
+        } else {
+            fail[child] = 0;
+            order[tail++] = child;
+        }
+    }
+    while (head < tail) {
+        uint32_t state = order[head++];
+        accepting[state] |= accepting[fail[state]];
+        for (uint32_t cls = 0; cls < num_classes; cls++) {
+            uint32_t *slot = &trie[((size_t)state * num_classes) + cls];
+            uint32_t fallback = trie[((size_t)fail[state] * num_classes) + cls];
+            if (*slot == AC_NO_STATE) {
+                *slot = fallback;
+            } else {
+                fail[*slot] = fallback;
+                order[tail++] = *slot;
+            }
+        }
+    }
+
+    // Renumber so the root stays 0 and accepting states come last; 'fail' is
+    // reused as the old-to-new id map.
+    uint32_t next_id = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        for (uint32_t state = 0; state < num_states; state++) {
+            if ((accepting[state] != 0) == (pass == 1)) {
+                fail[state] = next_id++;
+            }
+        }
+        if (pass == 0) automaton->accept_offset = next_id * num_classes;
+    }
+
+    automaton->transitions = malloc((size_t)num_states * num_classes * sizeof(uint32_t));
+    if (!automaton->transitions) return false;
+    for (uint32_t state = 0; state < num_states; state++) {
+        uint32_t *row = &automaton->transitions[(size_t)fail[state] * num_classes];
+        for (uint32_t cls = 0; cls < num_classes; cls++) {
+            row[cls] = fail[trie[((size_t)state * num_classes) + cls]] * num_classes;
+        }
+    }
+    automaton->num_states = num_states;
+    return true;
+}
+
+void ac_destroy(ac_automaton_t *automaton) {
+    free(automaton->transitions);
+    automaton->transitions = NULL;
+}
+
+const char *ac_find(const ac_automaton_t *automaton, const char *haystack, size_t length) {
+    if (automaton->matches_empty) return haystack;
+
+    const uint32_t *transitions = automaton->transitions;
+    const uint8_t *byte_class = automaton->byte_class;
+    const uint32_t accept_offset = automaton->accept_offset;
+    const unsigned char *pos = (const unsigned char *)haystack;
+    const unsigned char *end = pos + length;
+
+    uint32_t offset = 0;
+    for (; pos < end; pos++) {
+        offset = transitions[offset + byte_class[*pos]];
+        if (offset >= accept_offset) return (const char *)pos;
+    }
+    return NULL;
+}
@@ -0,0 +1,79 @@
+#include "chunk.h"
+#include "simd.h"
+#include "io.h"
+#include <stdlib.h>
+#include <sys/mman.h>
+
+file_job_t *file_job_create(void *map, size_t map_length, size_t chunk_size) {
+    size_t max_chunks = map_length / chunk_size + 1;
+    file_job_t *job = malloc(sizeof(file_job_t) + max_chunks * sizeof(file_chunk_t));
+    if (job == NULL) return NULL;
+
+    job->map = map;
+    job->map_length = map_length;
+    atomic_init(&job->refs, 1);
+    pthread_mutex_init(&job->mutex, NULL);
+    pthread_cond_init(&job->cond, NULL);
+    job->chunk_count = 0;
+
+    const char *pos = map;
+    const char *end = pos + map_length;
+    while (pos < end) {
+        const char *chunk_end = end;
+        if ((size_t)(end - pos) > chunk_size) {
+            // Extend to the end of the line the nominal boundary falls in.
+            const char *newline = simd_find_byte(pos + chunk_size - 1, (size_t)(end - pos) - chunk_size + 1, '\n');
+            chunk_end = newline ? newline + 1 : end;
+        }
+        file_chunk_t *chunk = &job->chunks[job->chunk_count++];
+        *chunk = (file_chunk_t){
+            .job = job, .start = pos, .length = (size_t)(chunk_end - pos), .done = false,
+            .lines = { .items = NULL, .count = 0, .capacity = 0 }, .newlines = 0
+        };
+        atomic_init(&chunk->claimed, false);
+        pos = chunk_end;
+    }
+    return job;
+}
+
+file_job_t *file_job_retain(file_job_t *job) {
+    atomic_fetch_add_explicit(&job->refs, 1, memory_order_relaxed);
+    return job;
+}
+
+void file_job_release(file_job_t *job) {
+    if (atomic_fetch_sub_explicit(&job->refs, 1, memory_order_acq_rel) != 1) return;
+    for (size_t i = 0; i < job->chunk_count; i++) {
+        matcher_lines_destroy(&job->chunks[i].lines);
+    }
+    munmap(job->map, job->map_length);
+    pthread_mutex_destroy(&job->mutex);
+    pthread_cond_destroy(&job->cond);
+    free(job);
+}
+
+bool file_chunk_claim(file_chunk_t *chunk) {
+    return !atomic_exchange(&chunk->claimed, true);
+}
+
+void file_chunk_search(file_chunk_t *chunk, const grep_config_t *config, matcher_state_t *state) {
+    io_advise_willneed(chunk->start, chunk->length);
+    matcher_lines_t lines = { .items = NULL, .count = 0, .capacity = 0 };
+    unsigned int newlines =
+        matcher_collect_lines(chunk->start, chunk->length, config, state, &lines, matcher_match_limit(config));
+
+    pthread_mutex_lock(&chunk->job->mutex);
+    chunk->lines = lines;
+    chunk->newlines = newlines;
+    chunk->done = true;
+    pthread_cond_broadcast(&chunk->job->cond);
+    pthread_mutex_unlock(&chunk->job->mutex);
+}
+
+void file_chunk_wait(file_chunk_t *chunk) {
+    pthread_mutex_lock(&chunk->job->mutex);
+    while (!chunk->done) {
+        pthread_cond_wait(&chunk->job->cond, &chunk->job->mutex);
+    }
+    pthread_mutex_unlock(&chunk->job->mutex);
+}
@@ -0,0 +1,128 @@
+#define _GNU_SOURCE // sched_getaffinity, pthread_attr_setaffinity_np
+#include "cpu.h"
+#include "raii.h"
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// cgroup v2 cpu.max holds "QUOTA PERIOD", with "max" for no limit.
+static double read_cpu_max(const char *dir) {
+    char path[PATH_MAX + 16];
+    if (snprintf(path, sizeof(path), "%s/cpu.max", dir) >= (int)sizeof(path)) return 0;
+    auto_file FILE *file = fopen(path, "r");
+    char quota[32];
+    unsigned long long period = 0;
+    if (file == NULL || fscanf(file, "%31s %llu", quota, &period) != 2 || period == 0) return 0;
+    if (strcmp(quota, "max") == 0) return 0;
+    return strtod(quota, NULL) / (double)period;
+}
+
+static long long read_number(const char *dir, const char *name) {
+    char path[PATH_MAX + 32];
+    if (snprintf(path, sizeof(path), "%s/%s", dir, name) >= (int)sizeof(path)) return 0;
+    auto_file FILE *file = fopen(path, "r");
+    long long value = 0;
+    if (file == NULL || fscanf(file, "%lld", &value) != 1) return 0;
+    return value;
+}
+
+// cgroup v1 has the quota in microseconds per period, -1 for no limit.
+static double read_cfs_quota(const char *dir) {
+    long long quota = read_number(dir, "cpu.cfs_quota_us");
+    long long period = read_number(dir, "cpu.cfs_period_us");
+    return quota > 0 && period > 0 ? (double)quota / (double)period : 0;
+}
+
+// Finds the process's group in /proc/self/cgroup: the v2 line ("0::/path")
+// when 'controller' is NULL, else the v1 line whose controllers include it.
+static bool own_group(const char *controller, char *group, size_t size) {
+    auto_file FILE *file = fopen("/proc/self/cgroup", "r");
+    if (file == NULL) return false;
+    char line[PATH_MAX];
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\n")] = '\0';
+        char *controllers = strchr(line, ':');
+        char *path = controllers ? strchr(controllers + 1, ':') : NULL;
+        if (path == NULL) continue;
+        *controllers++ = '\0';
+        *path++ = '\0';
+
+        bool found = controller == NULL && strcmp(line, "0") == 0 && controllers[0] == '\0';
+        for (char *save = NULL, *name = controller ? strtok_r(controllers, ",", &save) : NULL; name && !found;
+             name = strtok_r(NULL, ",", &save)) {
+            found = strcmp(name, controller) == 0;
+        }
+        if (found) {
+            snprintf(group, size, "%s", path);
+            return group[0] == '/';
+        }
+    }
+    return false;
+}
+
+// A quota anywhere up the hierarchy applies, so the tightest one wins. Returns 0 without one.
+static double tightest_quota(const char *mount, const char *group, double (*read_quota)(const char *dir)) {
+    char dir[PATH_MAX + 64];
+    int length = snprintf(dir, sizeof(dir), "%s%s", mount, strcmp(group, "/") == 0 ? "" : group);
+    if (length < 0 || (size_t)length >= sizeof(dir)) return 0;
+
+    double tightest = 0;
+    size_t root = strlen(mount);
+    while (true) {
+        double quota = read_quota(dir);
+        if (quota > 0 && (tightest == 0 || quota < tightest)) tightest = quota;
+        char *slash = strrchr(dir, '/');
+        if (slash == NULL || (size_t)(slash - dir) < root) break;
+        *slash = '\0';
+    }
+    return tightest;
+}
+
+static double cgroup_quota(void) {
+    char group[PATH_MAX];
+    if (own_group(NULL, group, sizeof(group))) {
+        double quota = tightest_quota("/sys/fs/cgroup", group, read_cpu_max);
+        if (quota > 0) return quota;
+    }
+    if (own_group("cpu", group, sizeof(group))) {
+        double quota = tightest_quota("/sys/fs/cgroup/cpu", group, read_cfs_quota);
+        if (quota == 0) quota = tightest_quota("/sys/fs/cgroup/cpu,cpuacct", group, read_cfs_quota);
+        return quota;
+    }
+    return 0;
+}
+
+size_t cpu_count_available(void) {
+    cpu_set_t set;
+    long count = 0;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) count = CPU_COUNT(&set);
+    if (count <= 0) count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count <= 0) count = 1;
+
+    double quota = cgroup_quota();
+    if (quota > 0 && quota < (double)count) {
+        count = (long)quota;
+        if ((double)count < quota) count++; // A quota of 1.5 CPUs keeps two busy part of the time
+    }
+    return count > 0 ? (size_t)count : 1;
+}
+
+bool cpu_pin_attr(pthread_attr_t *attr, size_t index) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return false;
+    int count = CPU_COUNT(&allowed);
+    if (count <= 0) return false;
+
+    size_t wanted = index % (size_t)count;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed) || wanted-- > 0) continue;
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(cpu, &one);
+        return pthread_attr_setaffinity_np(attr, sizeof(one), &one) == 0;
+    }
+    return false;
+}
@@ -0,0 +1,193 @@
+#include "decompress.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef CGREP_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef CGREP_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+static const unsigned char GZIP_MAGIC[] = { 0x1f, 0x8b };
+static const unsigned char ZSTD_MAGIC[] = { 0x28, 0xb5, 0x2f, 0xfd };
+
+static bool has_magic(const char *data, size_t length, const unsigned char *magic, size_t magic_length) {
+    return length >= magic_length && memcmp(data, magic, magic_length) == 0;
+}
+
+static bool is_supported(compression_t type) {
+    switch (type) {
+#ifdef CGREP_HAVE_ZLIB
+        case COMPRESSION_GZIP: return true;
+#endif
+#ifdef CGREP_HAVE_ZSTD
+        case COMPRESSION_ZSTD: return true;
+#endif
+        default: return false;
+    }
+}
+
+bool decompress_available(void) {
+    return is_supported(COMPRESSION_GZIP) || is_supported(COMPRESSION_ZSTD);
+}
+
+compression_t decompress_detect(const char *data, size_t length) {
+    compression_t type = COMPRESSION_NONE;
+    if (has_magic(data, length, GZIP_MAGIC, sizeof(GZIP_MAGIC))) {
+        type = COMPRESSION_GZIP;
+    } else if (has_magic(data, length, ZSTD_MAGIC, sizeof(ZSTD_MAGIC))) {
+        type = COMPRESSION_ZSTD;
+    }
+    return is_supported(type) ? type : COMPRESSION_NONE;
+}
+
+void decompressor_init(decompressor_t *decompressor) {
+    *decompressor = (decompressor_t){ .type = COMPRESSION_NONE, .zlib = NULL, .zstd = NULL, .window = NULL };
+}
+
+void decompressor_destroy(decompressor_t *decompressor) {
+#ifdef CGREP_HAVE_ZLIB
+    if (decompressor->zlib) {
+        inflateEnd(decompressor->zlib);
+        free(decompressor->zlib);
+    }
+#endif
+#ifdef CGREP_HAVE_ZSTD
+    ZSTD_freeDCtx(decompressor->zstd);
+#endif
+    free(decompressor->window);
+    decompressor_init(decompressor);
+}
+
+#ifdef CGREP_HAVE_ZLIB
+static bool start_gzip(decompressor_t *decompressor) {
+    if (decompressor->zlib) return inflateReset(decompressor->zlib) == Z_OK;
+    z_stream *zlib = calloc(1, sizeof(z_stream));
+    if (zlib == NULL) return false;
+    if (inflateInit2(zlib, 16 + MAX_WBITS) != Z_OK) { // 16: gzip wrapper only
+        free(zlib);
+        return false;
+    }
+    decompressor->zlib = zlib;
+    return true;
+}
+
+// zlib counts its input in 32 bits, so larger files are handed over in slices.
+static void refill_gzip(decompressor_t *decompressor) {
+    z_stream *zlib = decompressor->zlib;
+    if (zlib->avail_in > 0 || decompressor->input_pos == decompressor->input_length) return;
+    size_t slice = decompressor->input_length - decompressor->input_pos;
+    if (slice > UINT_MAX) slice = UINT_MAX;
+    zlib->next_in = (Bytef *)(decompressor->input + decompressor->input_pos);
+    zlib->avail_in = (uInt)slice;
+    decompressor->input_pos += slice;
+}
+
+static size_t read_gzip(decompressor_t *decompressor, char *out, size_t capacity) {
+    z_stream *zlib = decompressor->zlib;
+    zlib->next_out = (Bytef *)out;
+    zlib->avail_out = capacity > UINT_MAX ? UINT_MAX : (uInt)capacity;
+    uInt requested = zlib->avail_out;
+    while (zlib->avail_out > 0 && !decompressor->finished) {
+        refill_gzip(decompressor);
+        uInt before = zlib->avail_out;
+        uInt input_before = zlib->avail_in;
+        int ret = inflate(zlib, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            // Another member may follow; anything else after the last one is ignored, as gzip does.
+            refill_gzip(decompressor);
+            bool member = zlib->avail_in >= sizeof(GZIP_MAGIC) &&
+                          memcmp(zlib->next_in, GZIP_MAGIC, sizeof(GZIP_MAGIC)) == 0;
+            if (!member || inflateReset(zlib) != Z_OK) decompressor->finished = true;
+        } else if (ret != Z_OK || (zlib->avail_out == before && zlib->avail_in == input_before)) {
+            decompressor->failed = true;
+        }
+        if (decompressor->failed) break;
+    }
+    return requested - zlib->avail_out;
+}
+#endif
+
+#ifdef CGREP_HAVE_ZSTD
+static bool start_zstd(decompressor_t *decompressor) {
+    if (decompressor->zstd == NULL && (decompressor->zstd = ZSTD_createDCtx()) == NULL) return false;
+    return !ZSTD_isError(ZSTD_DCtx_reset(decompressor->zstd, ZSTD_reset_session_only));
+}
+
+// Consecutive frames are read through by ZSTD_decompressStream() itself.
+static size_t read_zstd(decompressor_t *decompressor, char *out, size_t capacity) {
+    ZSTD_outBuffer output = { .dst = out, .size = capacity, .pos = 0 };
+    ZSTD_inBuffer input = { .src = decompressor->input, .size = decompressor->input_length,
+                            .pos = decompressor->input_pos };
+    while (output.pos < output.size && !decompressor->finished) {
+        size_t before = output.pos;
+        size_t input_before = input.pos;
+        size_t ret = ZSTD_decompressStream(decompressor->zstd, &output, &input);
+        if (ret == 0 && input.pos == input.size) {
+            decompressor->finished = true;
+        } else if (ZSTD_isError(ret) || (output.pos == before && input.pos == input_before)) {
+            decompressor->failed = true;
+            break;
+        }
+    }
+    decompressor->input_pos = input.pos;
+    return output.pos;
+}
+#endif
+
+bool decompressor_start(decompressor_t *decompressor, compression_t type, const char *data, size_t length) {
+    decompressor->type = type;
+    decompressor->input = (const unsigned char *)data;
+    decompressor->input_length = length;
+    decompressor->input_pos = 0;
+    decompressor->finished = false;
+    decompressor->failed = false;
+    // A window grown for a previous file's long line is not kept for the rest.
+    if (decompressor->window_capacity > DECOMPRESS_WINDOW_SIZE) {
+        free(decompressor->window);
+        decompressor->window = NULL;
+    }
+    if (decompressor->window == NULL) {
+        if ((decompressor->window = malloc(DECOMPRESS_WINDOW_SIZE)) == NULL) return false;
+        decompressor->window_capacity = DECOMPRESS_WINDOW_SIZE;
+    }
+    switch (type) {
+#ifdef CGREP_HAVE_ZLIB
+        case COMPRESSION_GZIP:
+            if (!start_gzip(decompressor)) return false;
+            decompressor->zlib->next_in = NULL;
+            decompressor->zlib->avail_in = 0;
+            return true;
+#endif
+#ifdef CGREP_HAVE_ZSTD
+        case COMPRESSION_ZSTD: return start_zstd(decompressor);
+#endif
+        default: return false;
+    }
+}
+
+bool decompressor_grow_window(decompressor_t *decompressor) {
+    if (decompressor->window_capacity >= DECOMPRESS_WINDOW_MAX) return false;
+    char *window = realloc(decompressor->window, decompressor->window_capacity * 2);
+    if (window == NULL) return false;
+    decompressor->window = window;
+    decompressor->window_capacity *= 2;
+    return true;
+}
+
+ssize_t decompressor_read(decompressor_t *decompressor, char *out, size_t capacity) {
+    size_t produced = 0;
+    switch (decompressor->type) {
+#ifdef CGREP_HAVE_ZLIB
+        case COMPRESSION_GZIP: produced = read_gzip(decompressor, out, capacity); break;
+#endif
+#ifdef CGREP_HAVE_ZSTD
+        case COMPRESSION_ZSTD: produced = read_zstd(decompressor, out, capacity); break;
+#endif
+        default: return -1;
+    }
+    // What came out before an error is still returned; the error shows on the next call.
+    if (produced == 0 && decompressor->failed) return -1;
+    return (ssize_t)produced;
+}
@@ -1,68 +1,388 @@
 #include "discovery.h"
 #include "worker.h"
 #include "raii.h"
+#include "simd.h"
+#include "order.h"
+#include "ignore.h"
+#include "stats.h"
 #include <dirent.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <stdalign.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/stat.h>
-#include <fnmatch.h>
-#include <limits.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
-bool should_process_file(const char *filename, const discovery_config_t *config) {
-    const char *basename = strrchr(filename, '/');
-    basename = (basename == NULL) ? filename : basename + 1;
+bool discovery_add_include(discovery_config_t *config, const char *pattern) {
+    size_t length = strlen(pattern);
+    if (length > 1 && pattern[length - 1] == '/') {
+        auto_free char *below = malloc(length + 3);
+        if (below == NULL) return false;
+        memcpy(below, pattern, length);
+        memcpy(below + length, "**", 3);
+        return glob_set_add(&config->include, below);
+    }
+    return glob_set_add(&config->include, pattern);
+}
 
-    // Exclude filters
-    for (size_t i = 0; i < config->exclude_count; i++) {
-        if (fnmatch(config->exclude_patterns[i], basename, 0) == 0) {
-            return false;
-        }
+bool discovery_add_exclude(discovery_config_t *config, const char *pattern) {
+    size_t length = strlen(pattern);
+    if (length > 1 && pattern[length - 1] == '/') {
+        auto_free char *directory = strndup(pattern, length - 1);
+        return directory && glob_set_add(&config->exclude_dirs, directory);
     }
 
-    // Include filters
-    if (config->include_count > 0) {
-        bool matched = false;
-        for (size_t i = 0; i < config->include_count; i++) {
-            if (fnmatch(config->include_patterns[i], basename, 0) == 0) {
-                matched = true;
-                break;
-            }
-        }
-        if (!matched) return false;
+    // 'build/*' excludes everything in build, so build itself need not be read.
+    // Like the pattern, the directory is anchored at the root: 'x/build' stays.
+    const char *star = strrchr(pattern, '/');
+    if (star && star > pattern && (strcmp(star, "/*") == 0 || strcmp(star, "/**") == 0)) {
+        auto_free char *directory = strndup(pattern, (size_t)(star - pattern));
+        if (directory == NULL || !glob_set_add_path(&config->exclude_dirs, directory)) return false;
+        return glob_set_add(&config->exclude_files, pattern);
     }
+    return glob_set_add(&config->exclude_files, pattern) && glob_set_add(&config->exclude_dirs, pattern);
+}
+
+bool discovery_compile_filters(discovery_config_t *config) {
+    return glob_set_compile(&config->include) && glob_set_compile(&config->exclude_files) &&
+           glob_set_compile(&config->exclude_dirs);
+}
+
+void discovery_config_destroy(discovery_config_t *config) {
+    glob_set_destroy(&config->include);
+    glob_set_destroy(&config->exclude_files);
+    glob_set_destroy(&config->exclude_dirs);
+}
+
+const char *discovery_relative_path(const char *path, const path_node_t *node) {
+    if (node == NULL || node->parent == NULL) {
+        while (path[0] == '.' && path[1] == '/') path += 2;
+        return path;
+    }
+    const path_node_t *root = node;
+    while (root->parent) root = root->parent;
+    const char *relative = path + root->name_len;
+    while (*relative == '/') relative++;
+    return relative;
+}
+
+static const char *base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+static bool file_passes(const char *relative, const char *basename, const discovery_config_t *config) {
+    if (glob_set_match(&config->exclude_files, relative, basename)) return false;
+    return config->include.count == 0 || glob_set_match(&config->include, relative, basename);
+}
+
+// Ignore files only apply to what the walk finds, not to paths given on the command line.
+static bool is_ignored(const char *relative, const char *basename, const path_node_t *node, bool is_dir,
+                       const discovery_config_t *config) {
+    if (!config->use_ignore_files || node == NULL || node->parent == NULL) return false;
+    return strcmp(basename, ".git") == 0 || ignore_rules_match(node->parent->ignore, relative, basename, is_dir);
+}
 
-    return true;
+bool should_process_file(const char *path, const path_node_t *node, const discovery_config_t *config) {
+    const char *relative = discovery_relative_path(path, node);
+    const char *basename = base_name(path);
+    return file_passes(relative, basename, config) && !is_ignored(relative, basename, node, false, config);
+}
+
+bool should_enter_directory(const char *path, const path_node_t *node, const discovery_config_t *config) {
+    const char *relative = discovery_relative_path(path, node);
+    const char *basename = base_name(path);
+    return !glob_set_match(&config->exclude_dirs, relative, basename) &&
+           !is_ignored(relative, basename, node, true, config);
 }
 
 bool is_binary(const char *buffer, size_t length) {
     size_t check_len = (length < 1024) ? length : 1024;
-    for (size_t i = 0; i < check_len; i++) {
-        if (buffer[i] == '\0') return true;
+    return simd_contains_byte(buffer, check_len, '\0');
+}
+
+enum { DIRENT_BUFFER_SIZE = 64 * 1024 };
+
+typedef void (*entry_fn)(const char *name, unsigned char type, void *context);
+
+static bool is_dot_entry(const char *name) {
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+#ifdef __linux__
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Lists an open directory with getdents64() into a large buffer, so a big
+// directory takes a handful of syscalls and every entry comes with its type.
+static void read_entries(int dir_fd, entry_fn fn, void *context) {
+    static _Thread_local alignas(struct linux_dirent64) char buffer[DIRENT_BUFFER_SIZE];
+    while (true) {
+        long got = syscall(SYS_getdents64, dir_fd, buffer, sizeof(buffer));
+        if (got <= 0) return;
+        for (long pos = 0; pos < got;) {
+            const struct linux_dirent64 *entry = (const struct linux_dirent64 *)(buffer + pos);
+            if (!is_dot_entry(entry->d_name)) fn(entry->d_name, entry->d_type, context);
+            pos += entry->d_reclen;
+        }
+    }
+}
+#else
+static void read_entries(int dir_fd, entry_fn fn, void *context) {
+    int fd = dup(dir_fd); // closedir() closes the descriptor it was given
+    if (fd < 0) return;
+    DIR *dir = fdopendir(fd);
+    if (dir == NULL) {
+        close(fd);
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (!is_dot_entry(entry->d_name)) fn(entry->d_name, entry->d_type, context);
+    }
+    closedir(dir);
+}
+#endif
+
+typedef struct {
+    path_node_t *node;
+    int dir_fd;
+    const discovery_config_t *config;
+    work_queue_t *queue;
+    const ignore_rules_t *ignore; // With --gitignore, the directory's own rules on top of its parents'
+    path_node_t **children; // Only used for --ordered
+    size_t count;
+    size_t capacity;
+    size_t prefix_length; // Of the directory's relative path (plus '/') in 'relative'
+    char relative[PATH_MAX];
+} listing_t;
+
+static void listing_init(listing_t *listing, int dir_fd, const char *path, path_node_t *node,
+                         const discovery_config_t *config, work_queue_t *queue) {
+    listing->node = node;
+    listing->dir_fd = dir_fd;
+    listing->config = config;
+    listing->queue = queue;
+    listing->ignore = NULL;
+    listing->children = NULL;
+    listing->count = 0;
+    listing->capacity = 0;
+    const char *relative = node->parent ? discovery_relative_path(path, node) : "";
+    size_t length = strlen(relative);
+    if (length + 1 < sizeof(listing->relative)) {
+        memcpy(listing->relative, relative, length);
+        if (length > 0) listing->relative[length++] = '/';
+    } else {
+        length = 0;
+    }
+    listing->prefix_length = length;
+}
+
+// Entries whose type is known are filtered here, so excluded files are never
+// queued and excluded directories are never opened.
+static bool entry_passes(listing_t *listing, const char *name, unsigned char type) {
+    bool use_ignore_files = listing->config->use_ignore_files;
+    if (use_ignore_files && strcmp(name, ".git") == 0) return false;
+    if (type != DT_DIR && type != DT_REG) return true; // Decided once the worker knows the type
+    const char *relative = name;
+    size_t name_length = strlen(name);
+    if (listing->prefix_length + name_length < sizeof(listing->relative)) {
+        memcpy(listing->relative + listing->prefix_length, name, name_length + 1);
+        relative = listing->relative;
     }
-    return false;
+    if (use_ignore_files && ignore_rules_match(listing->ignore, relative, name, type == DT_DIR)) return false;
+    if (type == DT_DIR) return !glob_set_match(&listing->config->exclude_dirs, relative, name);
+    return file_passes(relative, name, listing->config);
 }
 
-void discover_files(const char *path, const discovery_config_t *config, work_queue_t *queue) {
+// Without --largest-first everything listed shares one class, so the walk
+// stays depth first and directory descriptors are released as it goes. With
+// it, directories go first and regular files are classed by size, which the
+// listing does not carry: it is read here, relative to the open directory, at
+// the cost of a stat per file.
+static work_class_t work_class_of(const listing_t *listing, const char *name, unsigned char type) {
+    if (!listing->config->size_schedule) return WORK_CLASS_MEDIUM;
+    if (type == DT_DIR) return WORK_CLASS_FIRST;
+    struct stat entry_stat;
+    if (type == DT_REG && fstatat(listing->dir_fd, name, &entry_stat, AT_SYMLINK_NOFOLLOW) == 0) {
+        return work_class_for_size((uint64_t)entry_stat.st_size);
+    }
+    return WORK_CLASS_MEDIUM;
+}
+
+static path_node_t *new_child(listing_t *listing, const char *name, unsigned char type) {
+    if (!entry_passes(listing, name, type)) {
+        stats_count(STATS_FILTERED, 1);
+        return NULL;
+    }
+    path_node_t *child = work_queue_new_node(listing->queue, listing->node, name);
+    if (child) {
+        child->type = type;
+        child->work_class = work_class_of(listing, name, type);
+    }
+    return child;
+}
+
+static void push_entry(const char *name, unsigned char type, void *context) {
+    listing_t *listing = context;
+    if (work_queue_is_cancelled(listing->queue)) return;
+    path_node_t *child = new_child(listing, name, type);
+    if (child) work_queue_push_node(listing->queue, child);
+}
+
+static void collect_entry(const char *name, unsigned char type, void *context) {
+    listing_t *listing = context;
+    if (listing->count == listing->capacity) {
+        size_t capacity = listing->capacity ? listing->capacity * 2 : 32;
+        path_node_t **grown = realloc(listing->children, sizeof(path_node_t*) * capacity);
+        if (grown == NULL) return;
+        listing->children = grown;
+        listing->capacity = capacity;
+    }
+    path_node_t *child = new_child(listing, name, type);
+    if (child) listing->children[listing->count++] = child;
+}
+
+static int compare_nodes(const void *a, const void *b) {
+    return strcmp((*(path_node_t *const *)a)->name, (*(path_node_t *const *)b)->name);
+}
+
+// Queues the collected entries in name order, each with an output slot after
+// its predecessor's, so ordered output follows a sorted depth-first walk.
+static void push_sorted_entries(listing_t *listing) {
+    auto_free path_node_t **children = listing->children;
+    if (listing->count == 0) return;
+    qsort(children, listing->count, sizeof(path_node_t*), compare_nodes);
+
+    for (size_t i = 0; i < listing->count; i++) {
+        children[i]->order_slot = order_append_child(listing->config->order, listing->node->order_slot);
+    }
+    // Slots are all linked before any child can be picked up by another worker.
+    for (size_t i = 0; i < listing->count; i++) {
+        work_queue_push_node(listing->queue, children[i]);
+    }
+}
+
+typedef struct {
+    char *data; // Entries as a type byte followed by the NUL terminated name
+    size_t length;
+    size_t capacity;
+    unsigned files; // IGNORE_READ_* for the ignore files seen
+} entry_pool_t;
+
+static void gather_entry(const char *name, unsigned char type, void *context) {
+    entry_pool_t *pool = context;
+    size_t size = strlen(name) + 2;
+    if (pool->length + size > pool->capacity) {
+        size_t capacity = pool->capacity ? pool->capacity * 2 : 4096;
+        while (capacity < pool->length + size) capacity *= 2;
+        char *grown = realloc(pool->data, capacity);
+        if (grown == NULL) return;
+        pool->data = grown;
+        pool->capacity = capacity;
+    }
+    pool->data[pool->length] = (char)type;
+    memcpy(pool->data + pool->length + 1, name, size - 1);
+    pool->length += size;
+
+    if (strcmp(name, ".gitignore") == 0) pool->files |= IGNORE_READ_GITIGNORE;
+    else if (strcmp(name, ".ignore") == 0) pool->files |= IGNORE_READ_IGNORE;
+    else if (strcmp(name, ".git") == 0) pool->files |= IGNORE_READ_GIT_EXCLUDE;
+}
+
+// Reads the whole directory before filtering anything, so its own ignore
+// files are known from the listing (no probing) and loaded first.
+static void read_with_ignore_rules(int dir_fd, const char *path, listing_t *listing, entry_fn fn) {
+    entry_pool_t pool = { .data = NULL, .length = 0, .capacity = 0, .files = 0 };
+    read_entries(dir_fd, gather_entry, &pool);
+    auto_free char *data = pool.data;
+
+    path_node_t *node = listing->node;
+    ignore_rules_t *ancestors = node->parent ? NULL : ignore_rules_load_ancestors(path);
+    ignore_rules_t *inherited = node->parent ? node->parent->ignore : ancestors;
+    node->ignore = ignore_rules_load(inherited, dir_fd, pool.files, listing->prefix_length);
+    ignore_rules_release(ancestors);
+    listing->ignore = node->ignore;
+
+    for (size_t pos = 0; pos < pool.length;) {
+        const char *name = data + pos + 1;
+        fn(name, (unsigned char)data[pos], listing);
+        pos += strlen(name) + 2;
+    }
+}
+
+// Queues the entries of the open directory 'dir_fd' below 'node' and keeps
+// the descriptor for opening them, or closes it if too many are held.
+static void list_directory(int dir_fd, const char *path, path_node_t *node, const discovery_config_t *config,
+                           work_queue_t *queue) {
+    stats_phase_t previous = stats_enter(STATS_PHASE_DISCOVERY);
+    stats_count(STATS_DIRS, 1);
+    // Held before the first child is queued, since a worker may open it right away.
+    bool held = path_node_hold_dir(node, dir_fd);
+    listing_t listing;
+    listing_init(&listing, dir_fd, path, node, config, queue);
+    entry_fn fn = config->order ? collect_entry : push_entry;
+    if (config->use_ignore_files) {
+        read_with_ignore_rules(dir_fd, path, &listing, fn);
+    } else {
+        read_entries(dir_fd, fn, &listing);
+    }
+    if (config->order) push_sorted_entries(&listing);
+    if (!held) close(dir_fd);
+    stats_leave(previous);
+}
+
+void discover_directory(const char *path, path_node_t *node, const discovery_config_t *config, work_queue_t *queue) {
+    int dir_fd = path_node_open(node, path, O_RDONLY | O_DIRECTORY);
+    if (dir_fd < 0) return;
+    list_directory(dir_fd, path, node, config, queue);
+}
+
+void discover_files(const char *path, path_node_t *node, const discovery_config_t *config, work_queue_t *queue) {
     struct stat path_stat;
     if (lstat(path, &path_stat) != 0) return;
 
     if (S_ISDIR(path_stat.st_mode)) {
-        DIR *dir = opendir(path);
-        if (!dir) return;
-
-        struct dirent *entry;
-        while ((entry = readdir(dir)) != NULL) {
-            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-                continue;
-            }
+        if (node) {
+            discover_directory(path, node, config, queue);
+            return;
+        }
 
-            char full_path[PATH_MAX];
-            snprintf(full_path, sizeof(full_path), "%s/%s", path, entry->d_name);
-            work_queue_push(queue, full_path);
+        int dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd < 0) return;
+        auto_path_node path_node_t *root = work_queue_new_node(queue, NULL, path);
+        if (root == NULL) {
+            close(dir_fd);
+            return;
         }
-        closedir(dir);
+        root->type = DT_DIR;
+        if (config->order) root->order_slot = order_append_child(config->order, NULL);
+        list_directory(dir_fd, path, root, config, queue);
+        // Nothing pops a root, so it is resolved here rather than by a worker.
+        if (config->order) order_finish(config->order, root->order_slot, NULL);
     } else if (S_ISREG(path_stat.st_mode)) {
-        if (should_process_file(path, config)) {
-            work_queue_push(queue, path);
+        if (should_process_file(path, node, config)) {
+            if (node) {
+                work_queue_push_node(queue, path_node_retain(node));
+            } else {
+                discover_push_root(path, config, queue);
+            }
         }
     }
 }
+
+void discover_push_root(const char *path, const discovery_config_t *config, work_queue_t *queue) {
+    path_node_t *node = work_queue_new_node(queue, NULL, path);
+    if (node == NULL) return;
+    if (config->order) node->order_slot = order_append_child(config->order, NULL);
+    work_queue_push_node(queue, node);
+}
@@ -0,0 +1,251 @@
+#include "glob.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static uint64_t hash_string(const char *text, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325ULL; // FNV-1a
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)text[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static bool strset_contains(const glob_strset_t *set, const char *text, size_t length) {
+    if (set->count == 0) return false;
+    size_t mask = set->capacity - 1;
+    for (size_t i = hash_string(text, length) & mask; set->items[i]; i = (i + 1) & mask) {
+        if (strncmp(set->items[i], text, length) == 0 && set->items[i][length] == '\0') return true;
+    }
+    return false;
+}
+
+static void strset_place(glob_strset_t *set, char *item) {
+    size_t mask = set->capacity - 1;
+    size_t i = hash_string(item, strlen(item)) & mask;
+    while (set->items[i]) i = (i + 1) & mask;
+    set->items[i] = item;
+    set->count++;
+}
+
+static bool strset_add(glob_strset_t *set, const char *text) {
+    if (strset_contains(set, text, strlen(text))) return true;
+    if ((set->count + 1) * 2 > set->capacity) { // Keep the load factor at most 1/2
+        glob_strset_t grown = { .items = NULL, .count = 0, .capacity = set->capacity ? set->capacity * 2 : 16 };
+        grown.items = calloc(grown.capacity, sizeof(char*));
+        if (grown.items == NULL) return false;
+        for (size_t i = 0; i < set->capacity; i++) {
+            if (set->items[i]) strset_place(&grown, set->items[i]);
+        }
+        free(set->items);
+        *set = grown;
+    }
+    char *item = strdup(text);
+    if (item == NULL) return false;
+    strset_place(set, item);
+    return true;
+}
+
+static void strset_destroy(glob_strset_t *set) {
+    for (size_t i = 0; i < set->capacity; i++) free(set->items[i]);
+    free(set->items);
+    *set = (glob_strset_t){ .items = NULL, .count = 0, .capacity = 0 };
+}
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} regex_builder_t;
+
+static bool builder_append(regex_builder_t *builder, const char *text, size_t length) {
+    if (builder->length + length + 1 > builder->capacity) {
+        size_t capacity = builder->capacity ? builder->capacity * 2 : 128;
+        while (capacity < builder->length + length + 1) capacity *= 2;
+        char *grown = realloc(builder->data, capacity);
+        if (grown == NULL) return false;
+        builder->data = grown;
+        builder->capacity = capacity;
+    }
+    memcpy(builder->data + builder->length, text, length);
+    builder->length += length;
+    builder->data[builder->length] = '\0';
+    return true;
+}
+
+static bool builder_append_str(regex_builder_t *builder, const char *text) {
+    return builder_append(builder, text, strlen(text));
+}
+
+// Length of the bracket expression starting at 'pattern' ('['), or 0 if it
+// is not closed and the '[' is therefore literal, as in fnmatch().
+static size_t bracket_length(const char *pattern) {
+    size_t i = 1;
+    if (pattern[i] == '!' || pattern[i] == '^') i++;
+    if (pattern[i] == ']') i++; // A leading ']' is a member
+    while (pattern[i] && pattern[i] != ']') {
+        if (pattern[i] == '[' && pattern[i + 1] == ':') {
+            const char *close = strstr(pattern + i + 2, ":]");
+            if (close == NULL) return 0;
+            i = (size_t)(close - pattern) + 2;
+        } else if (pattern[i] == '\\' && pattern[i + 1]) {
+            i += 2;
+        } else {
+            i++;
+        }
+    }
+    return pattern[i] == ']' ? i + 1 : 0;
+}
+
+// Appends the PCRE2 translation of one glob as a non-capturing group.
+static bool glob_to_regex(const char *pattern, regex_builder_t *builder) {
+    if (!builder_append_str(builder, "(?:")) return false;
+    for (const char *p = pattern; *p; p++) {
+        bool ok;
+        if (p[0] == '*' && p[1] == '*') {
+            bool at_segment_start = p == pattern || p[-1] == '/';
+            if (at_segment_start && p[2] == '/') {
+                ok = builder_append_str(builder, "(?:.*/)?"); // '**/' also matches no directory at all
+                p += 2;
+            } else {
+                ok = builder_append_str(builder, ".*");
+                p++;
+            }
+        } else if (*p == '*') {
+            ok = builder_append_str(builder, "[^/]*");
+        } else if (*p == '?') {
+            ok = builder_append_str(builder, "[^/]");
+        } else if (*p == '[' && bracket_length(p) > 0) {
+            size_t length = bracket_length(p);
+            const char *body = p + 1;
+            size_t body_length = length - 2;
+            ok = builder_append_str(builder, "[");
+            if (*body == '!' || *body == '^') {
+                ok = ok && builder_append_str(builder, "^/");
+                body++;
+                body_length--;
+            }
+            if (*body == ']') { // A leading ']' is a member, but would not stay leading in PCRE2
+                ok = ok && builder_append_str(builder, "\\]");
+                body++;
+                body_length--;
+            }
+            ok = ok && builder_append(builder, body, body_length) && builder_append_str(builder, "]");
+            p += length - 1;
+        } else {
+            if (*p == '\\' && p[1]) p++;
+            char literal[3] = { '\\', *p, '\0' };
+            bool special = strchr("\\^$.|?*+()[]{}", *p) != NULL;
+            ok = builder_append_str(builder, special ? literal : literal + 1);
+        }
+        if (!ok) return false;
+    }
+    return builder_append_str(builder, ")");
+}
+
+static bool append_alternative(char **regex, const char *pattern) {
+    regex_builder_t builder = { .data = *regex, .length = *regex ? strlen(*regex) : 0, .capacity = 0 };
+    builder.capacity = builder.data ? builder.length + 1 : 0;
+    bool ok = (builder.length == 0 || builder_append_str(&builder, "|")) && glob_to_regex(pattern, &builder);
+    *regex = builder.data;
+    return ok;
+}
+
+static bool has_wildcards(const char *text) {
+    return strpbrk(text, "*?[\\") != NULL;
+}
+
+bool glob_set_add_path(glob_set_t *set, const char *pattern) {
+    set->count++;
+    // Relative to the search root, however the user spelled that.
+    while (pattern[0] == '.' && pattern[1] == '/') pattern += 2;
+    while (pattern[0] == '/') pattern++;
+    return append_alternative(&set->path_regex, pattern);
+}
+
+bool glob_set_add(glob_set_t *set, const char *pattern) {
+    if (strchr(pattern, '/') != NULL) return glob_set_add_path(set, pattern);
+    set->count++;
+    if (!has_wildcards(pattern)) {
+        return strset_add(&set->names, pattern);
+    }
+    if (pattern[0] == '*' && pattern[1] == '.' && pattern[2] && !has_wildcards(pattern + 2) &&
+        strchr(pattern + 2, '.') == NULL) {
+        return strset_add(&set->extensions, pattern + 2);
+    }
+    return append_alternative(&set->name_regex, pattern);
+}
+
+static bool compile_alternation(const char *source, pcre2_code **code) {
+    if (source == NULL) return true;
+
+    int errorcode;
+    PCRE2_SIZE erroroffset;
+    pcre2_code *compiled = pcre2_compile((PCRE2_SPTR)source, PCRE2_ZERO_TERMINATED,
+                                         PCRE2_ANCHORED | PCRE2_ENDANCHORED | PCRE2_DOTALL,
+                                         &errorcode, &erroroffset, NULL);
+    if (compiled == NULL) {
+        PCRE2_UCHAR buffer[256];
+        pcre2_get_error_message(errorcode, buffer, sizeof(buffer));
+        fprintf(stderr, "Error: Invalid glob (%s).\n", (const char *)buffer);
+        return false;
+    }
+    pcre2_jit_compile(compiled, PCRE2_JIT_COMPLETE);
+    if (*code) pcre2_code_free(*code);
+    *code = compiled;
+    return true;
+}
+
+bool glob_set_compile(glob_set_t *set) {
+    return compile_alternation(set->name_regex, &set->name_code) &&
+           compile_alternation(set->path_regex, &set->path_code);
+}
+
+// Lookups only ask whether a glob matched, so one single-pair match data per
+// thread serves every set. The key frees it when the thread exits.
+static pthread_key_t match_data_key;
+static pthread_once_t match_data_once = PTHREAD_ONCE_INIT;
+static _Thread_local pcre2_match_data *tls_match_data = NULL;
+
+static void free_match_data(void *match_data) {
+    pcre2_match_data_free(match_data);
+}
+
+static void create_match_data_key(void) {
+    pthread_key_create(&match_data_key, free_match_data);
+}
+
+static pcre2_match_data *thread_match_data(void) {
+    if (tls_match_data == NULL) {
+        pthread_once(&match_data_once, create_match_data_key);
+        tls_match_data = pcre2_match_data_create(1, NULL);
+        if (tls_match_data) pthread_setspecific(match_data_key, tls_match_data);
+    }
+    return tls_match_data;
+}
+
+static bool code_matches(const pcre2_code *code, const char *text) {
+    pcre2_match_data *match_data = thread_match_data();
+    if (match_data == NULL) return false;
+    return pcre2_match(code, (PCRE2_SPTR)text, strlen(text), 0, 0, match_data, NULL) >= 0;
+}
+
+bool glob_set_match(const glob_set_t *set, const char *relative, const char *basename) {
+    if (set->count == 0) return false;
+    if (strset_contains(&set->names, basename, strlen(basename))) return true;
+    const char *dot = strrchr(basename, '.');
+    if (dot && strset_contains(&set->extensions, dot + 1, strlen(dot + 1))) return true;
+    if (set->name_code && code_matches(set->name_code, basename)) return true;
+    return set->path_code && code_matches(set->path_code, relative);
+}
+
+void glob_set_destroy(glob_set_t *set) {
+    strset_destroy(&set->extensions);
+    strset_destroy(&set->names);
+    free(set->name_regex);
+    free(set->path_regex);
+    if (set->name_code) pcre2_code_free(set->name_code);
+    if (set->path_code) pcre2_code_free(set->path_code);
+    *set = (glob_set_t){ .name_regex = NULL };
+}
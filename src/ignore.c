@@ -0,0 +1,206 @@
+#include "ignore.h"
+#include "raii.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+typedef struct {
+    ignore_run_t *runs;
+    size_t count;
+    size_t capacity;
+} run_list_t;
+
+static void run_list_destroy(run_list_t *list) {
+    for (size_t i = 0; i < list->count; i++) {
+        glob_set_destroy(&list->runs[i].any);
+        glob_set_destroy(&list->runs[i].dirs);
+    }
+    free(list->runs);
+}
+
+static ignore_run_t *run_for(run_list_t *list, bool negate) {
+    if (list->count > 0 && list->runs[list->count - 1].negate == negate) {
+        return &list->runs[list->count - 1];
+    }
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 4;
+        ignore_run_t *grown = realloc(list->runs, capacity * sizeof(ignore_run_t));
+        if (grown == NULL) return NULL;
+        list->runs = grown;
+        list->capacity = capacity;
+    }
+    ignore_run_t *run = &list->runs[list->count++];
+    *run = (ignore_run_t){ .negate = negate };
+    return run;
+}
+
+// One line of an ignore file, in gitignore syntax.
+static void add_line(run_list_t *list, const char *line, size_t length) {
+    if (length > 0 && line[length - 1] == '\r') length--;
+    while (length > 0 && line[length - 1] == ' ' && !(length > 1 && line[length - 2] == '\\')) length--;
+    if (length == 0 || line[0] == '#') return;
+
+    bool negate = line[0] == '!';
+    if (negate) {
+        line++;
+        length--;
+    } else if (line[0] == '\\' && length > 1 && (line[1] == '#' || line[1] == '!')) {
+        line++;
+        length--;
+    }
+
+    bool dirs_only = false;
+    while (length > 0 && line[length - 1] == '/') {
+        dirs_only = true;
+        length--;
+    }
+    if (length == 0 || length >= PATH_MAX) return;
+
+    char pattern[PATH_MAX];
+    memcpy(pattern, line, length);
+    pattern[length] = '\0';
+    ignore_run_t *run = run_for(list, negate);
+    if (run) glob_set_add(dirs_only ? &run->dirs : &run->any, pattern);
+}
+
+static void read_rules(int dir_fd, const char *name, run_list_t *list) {
+    auto_close int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) return;
+
+    auto_free char *text = malloc((size_t)st.st_size);
+    if (text == NULL) return;
+    size_t length = 0;
+    while (length < (size_t)st.st_size) {
+        ssize_t got = read(fd, text + length, (size_t)st.st_size - length);
+        if (got <= 0) break;
+        length += (size_t)got;
+    }
+
+    for (const char *line = text, *end = text + length; line < end;) {
+        const char *newline = memchr(line, '\n', (size_t)(end - line));
+        const char *line_end = newline ? newline : end;
+        add_line(list, line, (size_t)(line_end - line));
+        line = line_end + 1;
+    }
+}
+
+static ignore_rules_t *load_level(ignore_rules_t *parent, int dir_fd, unsigned files, size_t skip, const char *lead) {
+    // Lowest precedence first: later runs win.
+    run_list_t list = { .runs = NULL, .count = 0, .capacity = 0 };
+    if (files & IGNORE_READ_GIT_EXCLUDE) read_rules(dir_fd, ".git/info/exclude", &list);
+    if (files & IGNORE_READ_GITIGNORE) read_rules(dir_fd, ".gitignore", &list);
+    if (files & IGNORE_READ_IGNORE) read_rules(dir_fd, ".ignore", &list);
+
+    bool compiled = list.count > 0;
+    for (size_t i = 0; i < list.count && compiled; i++) {
+        compiled = glob_set_compile(&list.runs[i].any) && glob_set_compile(&list.runs[i].dirs);
+    }
+    ignore_rules_t *rules = compiled ? malloc(sizeof(ignore_rules_t) + list.count * sizeof(ignore_run_t)) : NULL;
+    if (rules == NULL) {
+        run_list_destroy(&list);
+        return parent ? ignore_rules_retain(parent) : NULL;
+    }
+
+    atomic_init(&rules->refs, 1);
+    rules->parent = parent ? ignore_rules_retain(parent) : NULL;
+    rules->lead = lead ? strdup(lead) : NULL;
+    rules->skip = skip;
+    rules->run_count = list.count;
+    memcpy(rules->runs, list.runs, list.count * sizeof(ignore_run_t));
+    free(list.runs); // The glob sets now belong to 'rules'
+    return rules;
+}
+
+ignore_rules_t *ignore_rules_load(ignore_rules_t *parent, int dir_fd, unsigned files, size_t skip) {
+    return load_level(parent, dir_fd, files, skip, NULL);
+}
+
+static bool has_git_dir(const char *directory) {
+    char path[PATH_MAX];
+    struct stat st;
+    return snprintf(path, sizeof(path), "%s/.git", directory) < (int)sizeof(path) && stat(path, &st) == 0;
+}
+
+ignore_rules_t *ignore_rules_load_ancestors(const char *root) {
+    char path[PATH_MAX];
+    if (realpath(root, path) == NULL || has_git_dir(path)) return NULL;
+
+    // Ends of the ancestor directories in 'path', nearest first, up to the repository root.
+    size_t ends[PATH_MAX / 2];
+    size_t count = 0;
+    size_t end = strlen(path);
+    bool in_repository = false;
+    while (end > 1 && !in_repository) {
+        size_t slash = end - 1;
+        while (slash > 0 && path[slash] != '/') slash--;
+        end = slash == 0 ? 1 : slash; // Keep "/" itself
+        char saved = path[end];
+        path[end] = '\0';
+        in_repository = has_git_dir(path);
+        path[end] = saved;
+        ends[count++] = end;
+    }
+    if (!in_repository) return NULL;
+
+    ignore_rules_t *rules = NULL;
+    for (size_t i = count; i-- > 0;) {
+        char directory[PATH_MAX];
+        memcpy(directory, path, ends[i]);
+        directory[ends[i]] = '\0';
+        auto_close int dir_fd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd < 0) continue;
+
+        // Entries are matched relative to the search root, so each level leads with the way down to it.
+        char lead[PATH_MAX];
+        const char *below = path + ends[i] + (ends[i] > 1 ? 1 : 0);
+        if (snprintf(lead, sizeof(lead), "%s/", below) >= (int)sizeof(lead)) continue;
+        unsigned files = IGNORE_READ_GITIGNORE | IGNORE_READ_IGNORE | (i == count - 1 ? IGNORE_READ_GIT_EXCLUDE : 0);
+        ignore_rules_t *level = load_level(rules, dir_fd, files, 0, lead);
+        ignore_rules_release(rules);
+        rules = level;
+    }
+    return rules;
+}
+
+ignore_rules_t *ignore_rules_retain(ignore_rules_t *rules) {
+    atomic_fetch_add_explicit(&rules->refs, 1, memory_order_relaxed);
+    return rules;
+}
+
+void ignore_rules_release(ignore_rules_t *rules) {
+    while (rules && atomic_fetch_sub_explicit(&rules->refs, 1, memory_order_acq_rel) == 1) {
+        ignore_rules_t *parent = rules->parent;
+        for (size_t i = 0; i < rules->run_count; i++) {
+            glob_set_destroy(&rules->runs[i].any);
+            glob_set_destroy(&rules->runs[i].dirs);
+        }
+        free(rules->lead);
+        free(rules);
+        rules = parent;
+    }
+}
+
+bool ignore_rules_match(const ignore_rules_t *rules, const char *relative, const char *basename, bool is_dir) {
+    size_t length = strlen(relative);
+    for (const ignore_rules_t *level = rules; level; level = level->parent) {
+        if (level->skip > length) continue;
+        const char *path = relative + level->skip;
+        char buffer[PATH_MAX];
+        if (level->lead) {
+            if (snprintf(buffer, sizeof(buffer), "%s%s", level->lead, path) >= (int)sizeof(buffer)) continue;
+            path = buffer;
+        }
+        for (size_t i = level->run_count; i-- > 0;) {
+            const ignore_run_t *run = &level->runs[i];
+            if (glob_set_match(&run->any, path, basename) || (is_dir && glob_set_match(&run->dirs, path, basename))) {
+                return !run->negate;
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,921 @@
+#include "index.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static const char INDEX_MAGIC[8] = { 'C', 'G', 'R', 'P', 'I', 'D', 'X', '1' };
+
+enum {
+    TRIGRAM_SPACE = 1 << 24,
+    INITIAL_POSTING_CAPACITY = 1024, // Slots per shard table; a power of two
+};
+
+static uint32_t fold(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? (uint32_t)(c | 0x20) : c;
+}
+
+// Walks the trigrams within the lines of a buffer, duplicates included.
+typedef struct {
+    const unsigned char *pos;
+    const unsigned char *end;
+    uint32_t trigram;
+    size_t in_line; // Bytes since the last newline
+} trigram_iter_t;
+
+static trigram_iter_t trigram_iter(const char *data, size_t length) {
+    return (trigram_iter_t){ .pos = (const unsigned char *)data, .end = (const unsigned char *)data + length };
+}
+
+static bool next_trigram(trigram_iter_t *iter) {
+    while (iter->pos < iter->end) {
+        unsigned char c = *iter->pos++;
+        if (c == '\n') {
+            iter->in_line = 0;
+            continue;
+        }
+        iter->trigram = ((iter->trigram << 8) | fold(c)) & (TRIGRAM_SPACE - 1);
+        if (++iter->in_line >= 3) return true;
+    }
+    return false;
+}
+
+static bool bit_is_set(const uint64_t *bitmap, uint32_t bit) {
+    return (bitmap[bit / 64] >> (bit % 64)) & 1;
+}
+
+static size_t put_varint(uint8_t *out, uint32_t value) {
+    size_t length = 0;
+    while (value >= 0x80) {
+        out[length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (uint8_t)value;
+    return length;
+}
+
+static const uint8_t *get_varint(const uint8_t *in, uint32_t *value) {
+    uint32_t result = 0;
+    for (unsigned shift = 0; shift < 32; shift += 7) {
+        uint8_t byte = *in++;
+        result |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) break;
+    }
+    *value = result;
+    return in;
+}
+
+typedef struct {
+    uint32_t key; // Trigram + 1; 0 marks an empty slot
+    uint32_t last; // Last file id appended
+    uint32_t count;
+    uint32_t length;
+    uint32_t capacity;
+    uint8_t *data; // Varint gaps between the ids, which ascend within a shard
+} posting_t;
+
+typedef struct {
+    uint32_t id;
+    char *path;
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t inode;
+} builder_file_t;
+
+/**
+ * One thread's share of the index. File ids come from a shared counter, so
+ * the ids a thread draws ascend and its posting lists can be delta encoded.
+ */
+typedef struct shard {
+    struct shard *next;
+    posting_t *postings; // Open addressing keyed by trigram
+    size_t posting_count;
+    size_t posting_capacity;
+    uint64_t *seen; // Bitmap over all trigrams, cleared after every file
+    uint32_t *distinct; // The current file's trigrams
+    size_t distinct_capacity;
+    builder_file_t *files;
+    size_t file_count;
+    size_t file_capacity;
+} shard_t;
+
+struct index_builder {
+    pthread_mutex_t mutex; // Guards 'shards'
+    shard_t *shards;
+    atomic_uint next_id;
+    atomic_bool failed; // An add ran out of memory, so the shards miss some of a file's trigrams
+    uint64_t generation;
+    char **removed; // Paths a segment drops
+    size_t removed_count;
+    size_t removed_capacity;
+};
+
+static atomic_uint_fast64_t builder_generations = 1;
+
+// Builders are told apart by generation rather than address, which a new one may reuse.
+static _Thread_local struct {
+    uint64_t generation;
+    shard_t *shard;
+} tls_shard = { 0, NULL };
+
+index_builder_t *index_builder_create(void) {
+    index_builder_t *builder = calloc(1, sizeof(index_builder_t));
+    if (builder == NULL) return NULL;
+    pthread_mutex_init(&builder->mutex, NULL);
+    atomic_init(&builder->next_id, 0);
+    atomic_init(&builder->failed, false);
+    builder->generation = atomic_fetch_add(&builder_generations, 1);
+    return builder;
+}
+
+static void shard_destroy(shard_t *shard) {
+    for (size_t i = 0; i < shard->posting_capacity; i++) free(shard->postings[i].data);
+    free(shard->postings);
+    for (size_t i = 0; i < shard->file_count; i++) free(shard->files[i].path);
+    free(shard->files);
+    free(shard->seen);
+    free(shard->distinct);
+    free(shard);
+}
+
+void index_builder_destroy(index_builder_t *builder) {
+    if (builder == NULL) return;
+    for (shard_t *shard = builder->shards, *next; shard; shard = next) {
+        next = shard->next;
+        shard_destroy(shard);
+    }
+    for (size_t i = 0; i < builder->removed_count; i++) free(builder->removed[i]);
+    free(builder->removed);
+    pthread_mutex_destroy(&builder->mutex);
+    free(builder);
+}
+
+static shard_t *shard_create(index_builder_t *builder) {
+    shard_t *shard = calloc(1, sizeof(shard_t));
+    if (shard == NULL) return NULL;
+    shard->seen = calloc(TRIGRAM_SPACE / 64, sizeof(uint64_t));
+    shard->postings = calloc(INITIAL_POSTING_CAPACITY, sizeof(posting_t));
+    if (shard->seen == NULL || shard->postings == NULL) {
+        shard_destroy(shard);
+        return NULL;
+    }
+    shard->posting_capacity = INITIAL_POSTING_CAPACITY;
+
+    pthread_mutex_lock(&builder->mutex);
+    shard->next = builder->shards;
+    builder->shards = shard;
+    pthread_mutex_unlock(&builder->mutex);
+    return shard;
+}
+
+static shard_t *local_shard(index_builder_t *builder) {
+    if (tls_shard.generation == builder->generation) return tls_shard.shard;
+    shard_t *shard = shard_create(builder);
+    if (shard == NULL) return NULL;
+    tls_shard.generation = builder->generation;
+    tls_shard.shard = shard;
+    return shard;
+}
+
+static size_t hash_trigram(uint32_t trigram, size_t mask) {
+    return (size_t)((trigram * 0x9E3779B1u) >> 8) & mask;
+}
+
+static posting_t *find_posting(posting_t *postings, size_t capacity, uint32_t trigram) {
+    size_t mask = capacity - 1;
+    size_t i = hash_trigram(trigram, mask);
+    while (postings[i].key != 0 && postings[i].key != trigram + 1) i = (i + 1) & mask;
+    return &postings[i];
+}
+
+static bool grow_postings(shard_t *shard) {
+    size_t capacity = shard->posting_capacity * 2;
+    posting_t *grown = calloc(capacity, sizeof(posting_t));
+    if (grown == NULL) return false;
+    for (size_t i = 0; i < shard->posting_capacity; i++) {
+        if (shard->postings[i].key == 0) continue;
+        *find_posting(grown, capacity, shard->postings[i].key - 1) = shard->postings[i];
+    }
+    free(shard->postings);
+    shard->postings = grown;
+    shard->posting_capacity = capacity;
+    return true;
+}
+
+static bool posting_append(shard_t *shard, uint32_t trigram, uint32_t id) {
+    posting_t *posting = find_posting(shard->postings, shard->posting_capacity, trigram);
+    if (posting->key == 0) {
+        if ((shard->posting_count + 1) * 2 > shard->posting_capacity) { // Keep the load factor at most 1/2
+            if (!grow_postings(shard)) return false;
+            posting = find_posting(shard->postings, shard->posting_capacity, trigram);
+        }
+        posting->key = trigram + 1;
+        shard->posting_count++;
+    }
+    if (posting->length + 5 > posting->capacity) {
+        uint32_t capacity = posting->capacity ? posting->capacity * 2 : 8;
+        uint8_t *grown = realloc(posting->data, capacity);
+        if (grown == NULL) return false;
+        posting->data = grown;
+        posting->capacity = capacity;
+    }
+    posting->length += (uint32_t)put_varint(posting->data + posting->length,
+                                            posting->count ? id - posting->last : id);
+    posting->last = id;
+    posting->count++;
+    return true;
+}
+
+static bool add_file_record(shard_t *shard, uint32_t id, const char *path, const index_file_t *metadata) {
+    if (shard->file_count == shard->file_capacity) {
+        size_t capacity = shard->file_capacity ? shard->file_capacity * 2 : 256;
+        builder_file_t *grown = realloc(shard->files, capacity * sizeof(builder_file_t));
+        if (grown == NULL) return false;
+        shard->files = grown;
+        shard->file_capacity = capacity;
+    }
+    char *copy = strdup(path);
+    if (copy == NULL) return false;
+    shard->files[shard->file_count++] = (builder_file_t){
+        .id = id,
+        .path = copy,
+        .size = metadata->size,
+        .mtime_ns = metadata->mtime_ns,
+        .inode = metadata->inode,
+    };
+    return true;
+}
+
+static index_file_t metadata_of(const struct stat *st) {
+    return (index_file_t){
+        .size = (uint64_t)st->st_size,
+        .mtime_ns = (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec,
+        .inode = (uint64_t)st->st_ino,
+    };
+}
+
+// A file recorded with only some of its trigrams would be ruled out of later
+// queries for good, so any failure fails the whole build (see index_builder_write()).
+static bool builder_fail(index_builder_t *builder) {
+    atomic_store(&builder->failed, true);
+    return false;
+}
+
+bool index_builder_add(index_builder_t *builder, const char *path, const char *data, size_t length,
+                       const struct stat *st) {
+    shard_t *shard = local_shard(builder);
+    if (shard == NULL) return builder_fail(builder);
+    uint32_t id = atomic_fetch_add(&builder->next_id, 1);
+    index_file_t metadata = metadata_of(st);
+    if (!add_file_record(shard, id, path, &metadata)) return builder_fail(builder);
+
+    bool ok = true;
+    size_t count = 0;
+    for (trigram_iter_t iter = trigram_iter(data, length); next_trigram(&iter);) {
+        uint32_t trigram = iter.trigram;
+        uint64_t bit = 1ULL << (trigram & 63);
+        if (shard->seen[trigram >> 6] & bit) continue;
+        if (count == shard->distinct_capacity) {
+            size_t capacity = shard->distinct_capacity ? shard->distinct_capacity * 2 : 4096;
+            uint32_t *grown = realloc(shard->distinct, capacity * sizeof(uint32_t));
+            if (grown == NULL) {
+                ok = false;
+                break;
+            }
+            shard->distinct = grown;
+            shard->distinct_capacity = capacity;
+        }
+        shard->seen[trigram >> 6] |= bit;
+        shard->distinct[count++] = trigram;
+    }
+
+    // The seen bits are cleared even after a failure, for the shard's next file.
+    for (size_t i = 0; i < count; i++) {
+        uint32_t trigram = shard->distinct[i];
+        shard->seen[trigram >> 6] &= ~(1ULL << (trigram & 63));
+        ok = ok && posting_append(shard, trigram, id);
+    }
+    return ok || builder_fail(builder);
+}
+
+bool index_builder_add_index(index_builder_t *builder, const index_t *index, const uint64_t *live) {
+    shard_t *shard = shard_create(builder);
+    uint32_t file_count = index->header->file_count;
+    auto_free uint32_t *renumber = malloc(((size_t)file_count + 1) * sizeof(uint32_t));
+    if (shard == NULL || renumber == NULL) return false;
+
+    for (uint32_t id = 0; id < file_count; id++) {
+        if (!bit_is_set(live, id)) continue;
+        renumber[id] = atomic_fetch_add(&builder->next_id, 1);
+        if (!add_file_record(shard, renumber[id], index_file_path(index, id), &index->files[id])) return false;
+    }
+
+    // Ids ascend within a posting list and renumbering keeps their order, so the gaps stay positive.
+    for (uint32_t i = 0; i < index->header->trigram_count; i++) {
+        const index_trigram_t *entry = &index->trigrams[i];
+        const uint8_t *in = index->postings + entry->offset;
+        uint32_t id = 0;
+        for (uint32_t j = 0; j < entry->file_count; j++) {
+            uint32_t gap;
+            in = get_varint(in, &gap);
+            id = j ? id + gap : gap;
+            if (bit_is_set(live, id) && !posting_append(shard, entry->trigram, renumber[id])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool index_builder_remove(index_builder_t *builder, const char *path) {
+    if (builder->removed_count == builder->removed_capacity) {
+        size_t capacity = builder->removed_capacity ? builder->removed_capacity * 2 : 64;
+        char **grown = realloc(builder->removed, capacity * sizeof(char *));
+        if (grown == NULL) return false;
+        builder->removed = grown;
+        builder->removed_capacity = capacity;
+    }
+    char *copy = strdup(path);
+    if (copy == NULL) return false;
+    builder->removed[builder->removed_count++] = copy;
+    return true;
+}
+
+bool index_builder_is_empty(const index_builder_t *builder) {
+    return atomic_load(&builder->next_id) == 0 && builder->removed_count == 0;
+}
+
+// Path order of the walk: component by component, so "a/x" sorts before "a-b".
+static int compare_paths(const char *a, const char *b) {
+    while (*a != '\0' && *a == *b) {
+        a++;
+        b++;
+    }
+    unsigned ca = *a == '/' ? 1 : (unsigned char)*a;
+    unsigned cb = *b == '/' ? 1 : (unsigned char)*b;
+    return (ca > cb) - (ca < cb);
+}
+
+static int compare_file_records(const void *a, const void *b) {
+    return compare_paths((*(builder_file_t *const *)a)->path, (*(builder_file_t *const *)b)->path);
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return compare_paths(*(char *const *)a, *(char *const *)b);
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+typedef struct {
+    uint8_t *data;
+    size_t length;
+    size_t capacity;
+} byte_buffer_t;
+
+static bool buffer_reserve(byte_buffer_t *buffer, size_t extra) {
+    if (buffer->length + extra <= buffer->capacity) return true;
+    size_t capacity = buffer->capacity ? buffer->capacity * 2 : 64 * 1024;
+    while (capacity < buffer->length + extra) capacity *= 2;
+    uint8_t *grown = realloc(buffer->data, capacity);
+    if (grown == NULL) return false;
+    buffer->data = grown;
+    buffer->capacity = capacity;
+    return true;
+}
+
+static bool buffer_append(byte_buffer_t *buffer, const void *data, size_t length) {
+    if (!buffer_reserve(buffer, length)) return false;
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+    return true;
+}
+
+/**
+ * Everything index_builder_write() puts together before writing it out.
+ */
+typedef struct {
+    builder_file_t **files; // By final id
+    uint32_t *renumber; // Build id to final id
+    uint32_t file_count;
+    uint32_t *trigrams; // Sorted, distinct
+    size_t trigram_count;
+    byte_buffer_t table; // index_file_t, index_trigram_t and removed path entries
+    byte_buffer_t paths;
+    byte_buffer_t postings;
+} merge_t;
+
+static void merge_destroy(merge_t *merge) {
+    free(merge->files);
+    free(merge->renumber);
+    free(merge->trigrams);
+    free(merge->table.data);
+    free(merge->paths.data);
+    free(merge->postings.data);
+}
+
+// Numbers the files in path order, so query results come out in walk order.
+static bool number_files(index_builder_t *builder, merge_t *merge) {
+    uint32_t spent = atomic_load(&builder->next_id);
+    merge->renumber = malloc(((size_t)spent + 1) * sizeof(uint32_t));
+    merge->files = malloc(((size_t)spent + 1) * sizeof(builder_file_t *));
+    if (merge->renumber == NULL || merge->files == NULL) return false;
+
+    for (shard_t *shard = builder->shards; shard; shard = shard->next) {
+        for (size_t i = 0; i < shard->file_count; i++) merge->files[merge->file_count++] = &shard->files[i];
+    }
+    qsort(merge->files, merge->file_count, sizeof(builder_file_t *), compare_file_records);
+    for (uint32_t i = 0; i < merge->file_count; i++) merge->renumber[merge->files[i]->id] = i;
+    return true;
+}
+
+static bool collect_trigrams(index_builder_t *builder, merge_t *merge) {
+    size_t total = 0;
+    for (shard_t *shard = builder->shards; shard; shard = shard->next) total += shard->posting_count;
+    merge->trigrams = malloc((total + 1) * sizeof(uint32_t));
+    if (merge->trigrams == NULL) return false;
+
+    for (shard_t *shard = builder->shards; shard; shard = shard->next) {
+        for (size_t i = 0; i < shard->posting_capacity; i++) {
+            if (shard->postings[i].key != 0) merge->trigrams[merge->trigram_count++] = shard->postings[i].key - 1;
+        }
+    }
+    qsort(merge->trigrams, merge->trigram_count, sizeof(uint32_t), compare_u32);
+    size_t distinct = 0;
+    for (size_t i = 0; i < merge->trigram_count; i++) {
+        if (distinct == 0 || merge->trigrams[distinct - 1] != merge->trigrams[i]) {
+            merge->trigrams[distinct++] = merge->trigrams[i];
+        }
+    }
+    merge->trigram_count = distinct;
+    return true;
+}
+
+// Joins every shard's list for 'trigram' under the final ids and appends it to the postings.
+static bool merge_posting(index_builder_t *builder, merge_t *merge, uint32_t trigram, uint32_t **ids,
+                          size_t *capacity, index_trigram_t *entry) {
+    size_t count = 0;
+    for (shard_t *shard = builder->shards; shard; shard = shard->next) {
+        const posting_t *posting = find_posting(shard->postings, shard->posting_capacity, trigram);
+        if (posting->key == 0) continue;
+        if (count + posting->count > *capacity) {
+            size_t grown_capacity = (count + posting->count) * 2;
+            uint32_t *grown = realloc(*ids, grown_capacity * sizeof(uint32_t));
+            if (grown == NULL) return false;
+            *ids = grown;
+            *capacity = grown_capacity;
+        }
+        const uint8_t *in = posting->data;
+        uint32_t id = 0;
+        for (uint32_t i = 0; i < posting->count; i++) {
+            uint32_t gap;
+            in = get_varint(in, &gap);
+            id = i ? id + gap : gap;
+            (*ids)[count++] = merge->renumber[id];
+        }
+    }
+    qsort(*ids, count, sizeof(uint32_t), compare_u32);
+
+    *entry = (index_trigram_t){ .trigram = trigram, .file_count = (uint32_t)count, .offset = merge->postings.length };
+    if (!buffer_reserve(&merge->postings, count * 5)) return false;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t gap = i ? (*ids)[i] - (*ids)[i - 1] : (*ids)[i];
+        merge->postings.length += put_varint(merge->postings.data + merge->postings.length, gap);
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void *data, size_t length) {
+    const char *pos = data;
+    while (length > 0) {
+        ssize_t written = write(fd, pos, length);
+        if (written <= 0) return false;
+        pos += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+static uint64_t new_base_id(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t id = ((uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec) ^ ((uint64_t)getpid() << 40);
+    return id ? id : 1;
+}
+
+static bool write_index(const char *filename, uint64_t base_id, uint32_t removed_count, const merge_t *merge) {
+    index_header_t header = {
+        .version = INDEX_VERSION,
+        .file_count = merge->file_count,
+        .trigram_count = (uint32_t)merge->trigram_count,
+        .removed_count = removed_count,
+        .base_id = base_id ? base_id : new_base_id(),
+        .files_offset = sizeof(index_header_t),
+    };
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.trigrams_offset = header.files_offset + merge->file_count * sizeof(index_file_t);
+    header.removed_offset = header.trigrams_offset + merge->trigram_count * sizeof(index_trigram_t);
+    header.paths_offset = header.files_offset + merge->table.length;
+    header.postings_offset = header.paths_offset + merge->paths.length;
+    header.length = header.postings_offset + merge->postings.length;
+
+    char temporary[PATH_MAX];
+    if (snprintf(temporary, sizeof(temporary), "%s.tmp", filename) >= (int)sizeof(temporary)) return false;
+    auto_close int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    bool ok = write_all(fd, &header, sizeof(header)) && write_all(fd, merge->table.data, merge->table.length) &&
+              write_all(fd, merge->paths.data, merge->paths.length) &&
+              write_all(fd, merge->postings.data, merge->postings.length);
+    // Readers map whatever is at 'filename', so it is only ever replaced whole.
+    if (!ok || rename(temporary, filename) != 0) {
+        unlink(temporary);
+        return false;
+    }
+    return true;
+}
+
+bool index_builder_write(index_builder_t *builder, const char *filename, uint64_t base_id, size_t *file_count,
+                         size_t *trigram_count) {
+    [[gnu::cleanup(merge_destroy)]] merge_t merge = { .files = NULL };
+    if (atomic_load(&builder->failed)) return false;
+    if (!number_files(builder, &merge) || !collect_trigrams(builder, &merge)) return false;
+
+    for (uint32_t i = 0; i < merge.file_count; i++) {
+        const builder_file_t *file = merge.files[i];
+        index_file_t entry = {
+            .path_offset = merge.paths.length, .size = file->size, .mtime_ns = file->mtime_ns, .inode = file->inode
+        };
+        if (!buffer_append(&merge.table, &entry, sizeof(entry)) ||
+            !buffer_append(&merge.paths, file->path, strlen(file->path) + 1)) {
+            return false;
+        }
+    }
+
+    auto_free uint32_t *ids = NULL;
+    size_t capacity = 0;
+    for (size_t i = 0; i < merge.trigram_count; i++) {
+        index_trigram_t entry;
+        if (!merge_posting(builder, &merge, merge.trigrams[i], &ids, &capacity, &entry) ||
+            !buffer_append(&merge.table, &entry, sizeof(entry))) {
+            return false;
+        }
+    }
+
+    qsort(builder->removed, builder->removed_count, sizeof(char *), compare_strings);
+    for (size_t i = 0; i < builder->removed_count; i++) {
+        uint64_t offset = merge.paths.length;
+        if (!buffer_append(&merge.table, &offset, sizeof(offset)) ||
+            !buffer_append(&merge.paths, builder->removed[i], strlen(builder->removed[i]) + 1)) {
+            return false;
+        }
+    }
+
+    if (!write_index(filename, base_id, (uint32_t)builder->removed_count, &merge)) return false;
+    *file_count = merge.file_count;
+    *trigram_count = merge.trigram_count;
+    return true;
+}
+
+bool index_open(index_t *index, const char *filename) {
+    index->region = (struct mmap_region){ .addr = MAP_FAILED, .length = 0 };
+    auto_close int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(index_header_t)) return false;
+
+    void *addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) return false;
+    index->region = (struct mmap_region){ .addr = addr, .length = (size_t)st.st_size };
+
+    const index_header_t *header = addr;
+    const uint64_t files_end = header->files_offset + (uint64_t)header->file_count * sizeof(index_file_t);
+    const uint64_t trigrams_end = header->trigrams_offset + (uint64_t)header->trigram_count * sizeof(index_trigram_t);
+    const uint64_t removed_end = header->removed_offset + (uint64_t)header->removed_count * sizeof(uint64_t);
+    if (memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) != 0 || header->version != INDEX_VERSION ||
+        header->length != (uint64_t)st.st_size || files_end > header->trigrams_offset ||
+        trigrams_end > header->removed_offset || removed_end > header->paths_offset ||
+        header->paths_offset > header->postings_offset ||
+        header->postings_offset > header->length) {
+        index_close(index);
+        return false;
+    }
+
+    const char *base = addr;
+    index->header = header;
+    index->files = (const index_file_t *)(base + header->files_offset);
+    index->trigrams = (const index_trigram_t *)(base + header->trigrams_offset);
+    index->removed = (const uint64_t *)(base + header->removed_offset);
+    index->paths = base + header->paths_offset;
+    index->postings = (const uint8_t *)(base + header->postings_offset);
+    return true;
+}
+
+void index_close(index_t *index) {
+    cleanup_munmap(&index->region);
+}
+
+bool index_query_add_literal(index_query_t *query, const char *literal, size_t length) {
+    index_clause_t *grown = realloc(query->clauses, (query->count + 1) * sizeof(index_clause_t));
+    if (grown == NULL) return false;
+    query->clauses = grown;
+    index_clause_t *clause = &query->clauses[query->count++];
+    *clause = (index_clause_t){ .trigrams = NULL, .count = 0 };
+    if (length < 3) return true;
+
+    clause->trigrams = malloc(length * sizeof(uint32_t));
+    if (clause->trigrams == NULL) return false;
+    for (trigram_iter_t iter = trigram_iter(literal, length); next_trigram(&iter);) {
+        clause->trigrams[clause->count++] = iter.trigram;
+    }
+    qsort(clause->trigrams, clause->count, sizeof(uint32_t), compare_u32);
+    size_t distinct = 0;
+    for (size_t i = 0; i < clause->count; i++) {
+        if (distinct == 0 || clause->trigrams[distinct - 1] != clause->trigrams[i]) {
+            clause->trigrams[distinct++] = clause->trigrams[i];
+        }
+    }
+    clause->count = distinct;
+    return true;
+}
+
+void index_query_destroy(index_query_t *query) {
+    for (size_t i = 0; i < query->count; i++) free(query->clauses[i].trigrams);
+    free(query->clauses);
+    query->clauses = NULL;
+    query->count = 0;
+}
+
+static const index_trigram_t *find_trigram(const index_t *index, uint32_t trigram) {
+    size_t low = 0;
+    size_t high = index->header->trigram_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (index->trigrams[middle].trigram < trigram) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low < index->header->trigram_count && index->trigrams[low].trigram == trigram ? &index->trigrams[low] : NULL;
+}
+
+static int compare_posting_sizes(const void *a, const void *b) {
+    uint32_t x = (*(const index_trigram_t *const *)a)->file_count;
+    uint32_t y = (*(const index_trigram_t *const *)b)->file_count;
+    return (x > y) - (x < y);
+}
+
+// Keeps the ids in 'ids' that are also in the posting list of 'entry'.
+static size_t intersect(const index_t *index, const index_trigram_t *entry, uint32_t *ids, size_t count) {
+    const uint8_t *in = index->postings + entry->offset;
+    uint32_t id = 0;
+    uint32_t remaining = entry->file_count;
+    size_t kept = 0;
+    for (size_t i = 0; i < count && remaining > 0;) {
+        uint32_t gap;
+        in = get_varint(in, &gap);
+        id = remaining == entry->file_count ? gap : id + gap;
+        remaining--;
+        while (i < count && ids[i] < id) i++;
+        if (i < count && ids[i] == id) ids[kept++] = ids[i++];
+    }
+    return kept;
+}
+
+// Files containing every trigram of 'clause', starting from its rarest trigram.
+static bool run_clause(const index_t *index, const index_clause_t *clause, uint32_t *ids, size_t *count) {
+    auto_free const index_trigram_t **entries = malloc(clause->count * sizeof(index_trigram_t *));
+    if (entries == NULL) return false;
+    for (size_t i = 0; i < clause->count; i++) {
+        entries[i] = find_trigram(index, clause->trigrams[i]);
+        if (entries[i] == NULL) {
+            *count = 0; // Some trigram occurs nowhere
+            return true;
+        }
+    }
+    qsort(entries, clause->count, sizeof(index_trigram_t *), compare_posting_sizes);
+
+    const uint8_t *in = index->postings + entries[0]->offset;
+    uint32_t id = 0;
+    for (uint32_t i = 0; i < entries[0]->file_count; i++) {
+        uint32_t gap;
+        in = get_varint(in, &gap);
+        id = i ? id + gap : gap;
+        ids[i] = id;
+    }
+    *count = entries[0]->file_count;
+    for (size_t i = 1; i < clause->count && *count > 0; i++) {
+        *count = intersect(index, entries[i], ids, *count);
+    }
+    return true;
+}
+
+bool index_query_run(const index_t *index, const index_query_t *query, uint32_t **ids, size_t *count) {
+    uint32_t file_count = index->header->file_count;
+    bool everything = query->count == 0;
+    for (size_t i = 0; i < query->count; i++) everything |= query->clauses[i].count == 0;
+
+    *ids = malloc(((size_t)file_count + 1) * sizeof(uint32_t));
+    if (*ids == NULL) return false;
+    *count = 0;
+    if (everything) {
+        for (uint32_t i = 0; i < file_count; i++) (*ids)[i] = i;
+        *count = file_count;
+        return true;
+    }
+
+    // A bitmap over the files unions the clauses and leaves the ids sorted.
+    auto_free uint64_t *hits = calloc((size_t)file_count / 64 + 1, sizeof(uint64_t));
+    auto_free uint32_t *clause_ids = malloc(((size_t)file_count + 1) * sizeof(uint32_t));
+    if (hits == NULL || clause_ids == NULL) {
+        free(*ids);
+        *ids = NULL;
+        return false;
+    }
+    for (size_t i = 0; i < query->count; i++) {
+        size_t clause_count = 0;
+        if (!run_clause(index, &query->clauses[i], clause_ids, &clause_count)) {
+            free(*ids);
+            *ids = NULL;
+            return false;
+        }
+        for (size_t j = 0; j < clause_count; j++) hits[clause_ids[j] / 64] |= 1ULL << (clause_ids[j] % 64);
+    }
+    for (uint32_t i = 0; i < file_count; i++) {
+        if (hits[i / 64] & (1ULL << (i % 64))) (*ids)[(*count)++] = i;
+    }
+    return true;
+}
+
+static bool segment_path(char *buffer, size_t size, const char *directory, size_t number) {
+    int written = number ? snprintf(buffer, size, "%s/%s.%zu", directory, INDEX_FILE_NAME, number)
+                         : snprintf(buffer, size, "%s/%s", directory, INDEX_FILE_NAME);
+    return written >= 0 && (size_t)written < size;
+}
+
+static bool find_file(const index_t *index, const char *path, uint32_t *id) {
+    size_t low = 0;
+    size_t high = index->header->file_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        int order = compare_paths(index_file_path(index, (uint32_t)middle), path);
+        if (order == 0) {
+            *id = (uint32_t)middle;
+            return true;
+        }
+        if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return false;
+}
+
+static bool find_removed(const index_t *index, const char *path) {
+    size_t low = 0;
+    size_t high = index->header->removed_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        int order = compare_paths(index->paths + index->removed[middle], path);
+        if (order == 0) return true;
+        if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return false;
+}
+
+// The record that currently stands for 'path': the one in the newest
+// generation that mentions the path, unless that generation removed it.
+static bool lookup(const index_set_t *set, const char *path, index_ref_t *ref) {
+    for (size_t generation = set->count; generation-- > 0;) {
+        const index_t *index = &set->generations[generation].index;
+        if (find_file(index, path, &ref->id)) {
+            ref->generation = generation;
+            return true;
+        }
+        if (find_removed(index, path)) return false;
+    }
+    return false;
+}
+
+static bool is_current(const index_set_t *set, size_t generation, uint32_t id) {
+    index_ref_t ref;
+    return lookup(set, index_file_path(&set->generations[generation].index, id), &ref) &&
+           ref.generation == generation && ref.id == id;
+}
+
+bool index_set_open(index_set_t *set, const char *directory) {
+    *set = (index_set_t){ .generations = NULL, .count = 0 };
+    for (size_t number = 0;; number++) {
+        char path[PATH_MAX];
+        index_t index;
+        if (!segment_path(path, sizeof(path), directory, number) || !index_open(&index, path)) break;
+        // Left over from a compaction that was interrupted before deleting it.
+        if (number > 0 && index.header->base_id != set->generations[0].index.header->base_id) {
+            index_close(&index);
+            break;
+        }
+
+        index_generation_t *grown = realloc(set->generations, (set->count + 1) * sizeof(index_generation_t));
+        _Atomic(uint64_t) *unchanged = calloc(index.header->file_count / 64 + 1, sizeof(uint64_t));
+        if (grown) set->generations = grown;
+        if (grown == NULL || unchanged == NULL) {
+            free(unchanged);
+            index_close(&index);
+            break;
+        }
+        set->generations[set->count++] = (index_generation_t){
+            .index = index, .unchanged = unchanged, .candidates = NULL
+        };
+    }
+    return set->count > 0;
+}
+
+void index_set_close(index_set_t *set) {
+    for (size_t i = 0; i < set->count; i++) {
+        index_close(&set->generations[i].index);
+        free(set->generations[i].unchanged);
+        free(set->generations[i].candidates);
+    }
+    free(set->generations);
+    *set = (index_set_t){ .generations = NULL, .count = 0 };
+}
+
+bool index_set_find_unchanged(const index_set_t *set, const char *path, const struct stat *st, index_ref_t *ref) {
+    if (!lookup(set, path, ref)) return false;
+    const index_file_t *file = &set->generations[ref->generation].index.files[ref->id];
+    index_file_t now = metadata_of(st);
+    return file->size == now.size && file->mtime_ns == now.mtime_ns && file->inode == now.inode;
+}
+
+void index_set_keep(index_set_t *set, index_ref_t ref) {
+    atomic_fetch_or_explicit(&set->generations[ref.generation].unchanged[ref.id / 64], 1ULL << (ref.id % 64),
+                             memory_order_relaxed);
+}
+
+bool index_set_query(index_set_t *set, const index_query_t *query) {
+    for (size_t i = 0; i < set->count; i++) {
+        index_generation_t *generation = &set->generations[i];
+        auto_free uint32_t *ids = NULL;
+        size_t count = 0;
+        generation->candidates = calloc(generation->index.header->file_count / 64 + 1, sizeof(uint64_t));
+        if (generation->candidates == NULL || !index_query_run(&generation->index, query, &ids, &count)) return false;
+        for (size_t j = 0; j < count; j++) generation->candidates[ids[j] / 64] |= 1ULL << (ids[j] % 64);
+    }
+    return true;
+}
+
+bool index_set_remove_stale(const index_set_t *set, index_builder_t *builder) {
+    for (size_t generation = 0; generation < set->count; generation++) {
+        const index_generation_t *current = &set->generations[generation];
+        for (uint32_t id = 0; id < current->index.header->file_count; id++) {
+            bool unchanged = (atomic_load_explicit(&current->unchanged[id / 64], memory_order_relaxed) >> (id % 64)) & 1;
+            if (!unchanged && is_current(set, generation, id) &&
+                !index_builder_remove(builder, index_file_path(&current->index, id))) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool index_set_write_segment(const index_set_t *set, index_builder_t *builder, const char *directory,
+                             size_t *file_count, size_t *trigram_count) {
+    char path[PATH_MAX];
+    return segment_path(path, sizeof(path), directory, set->count) &&
+           index_builder_write(builder, path, set->generations[0].index.header->base_id, file_count, trigram_count);
+}
+
+bool index_set_compact(const index_set_t *set, const char *directory, size_t *file_count, size_t *trigram_count) {
+    index_builder_t *builder = index_builder_create();
+    if (builder == NULL) return false;
+    bool ok = true;
+    for (size_t generation = 0; generation < set->count && ok; generation++) {
+        const index_t *index = &set->generations[generation].index;
+        auto_free uint64_t *live = calloc(index->header->file_count / 64 + 1, sizeof(uint64_t));
+        ok = live != NULL;
+        for (uint32_t id = 0; ok && id < index->header->file_count; id++) {
+            if (is_current(set, generation, id)) live[id / 64] |= 1ULL << (id % 64);
+        }
+        ok = ok && index_builder_add_index(builder, index, live);
+    }
+
+    // The new base has a new id, so the old segments no longer apply to it even before they are deleted.
+    char path[PATH_MAX];
+    ok = ok && segment_path(path, sizeof(path), directory, 0) &&
+         index_builder_write(builder, path, 0, file_count, trigram_count);
+    index_builder_destroy(builder);
+    for (size_t number = 1; ok && number < set->count; number++) {
+        if (segment_path(path, sizeof(path), directory, number)) unlink(path);
+    }
+    return ok;
+}
@@ -0,0 +1,73 @@
+#include "io.h"
+#include <errno.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+io_stats_t io_stats;
+
+enum { IO_BUFFER_ALIGN = 4096 };
+
+static bool io_buffer_reserve(io_buffer_t *buffer, size_t size) {
+    if (size <= buffer->capacity) return true;
+    size_t capacity = (size + IO_BUFFER_ALIGN - 1) & ~((size_t)IO_BUFFER_ALIGN - 1);
+    char *data = aligned_alloc(IO_BUFFER_ALIGN, capacity);
+    if (data == NULL) return false;
+    free(buffer->data);
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return true;
+}
+
+static bool io_read(int fd, size_t size, io_buffer_t *buffer, io_view_t *view) {
+    if (!io_buffer_reserve(buffer, size)) return false;
+
+    size_t total = 0;
+    while (total < size) {
+        ssize_t got = pread(fd, buffer->data + total, size - total, (off_t)total);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) return false;
+        if (got == 0) break; // Truncated since fstat(); search what is there
+        total += (size_t)got;
+    }
+
+    view->data = buffer->data;
+    view->length = total;
+    atomic_fetch_add_explicit(&io_stats.files_read, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&io_stats.bytes_read, total, memory_order_relaxed);
+    return true;
+}
+
+static bool io_map(int fd, size_t size, const io_config_t *config, io_view_t *view) {
+    int flags = MAP_PRIVATE;
+    bool populate = size <= config->populate_limit;
+#ifdef MAP_POPULATE
+    if (populate) flags |= MAP_POPULATE;
+#endif
+    void *addr = mmap(NULL, size, PROT_READ, flags, fd, 0);
+    if (addr == MAP_FAILED) return false;
+    madvise(addr, size, MADV_SEQUENTIAL);
+
+    view->region = (struct mmap_region){ .addr = addr, .length = size };
+    view->data = addr;
+    view->length = size;
+    atomic_fetch_add_explicit(&io_stats.files_mapped, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&io_stats.bytes_mapped, size, memory_order_relaxed);
+    if (populate) atomic_fetch_add_explicit(&io_stats.files_populated, 1, memory_order_relaxed);
+    return true;
+}
+
+bool io_load(int fd, size_t size, const io_config_t *config, io_buffer_t *buffer, io_view_t *view) {
+    *view = (io_view_t){ .data = NULL, .length = 0, .region = { .addr = MAP_FAILED, .length = 0 } };
+    if (size < config->mmap_threshold) {
+        return io_read(fd, size, buffer, view);
+    }
+    return io_map(fd, size, config, view);
+}
+
+void io_advise_willneed(const char *data, size_t length) {
+    // madvise() wants a page aligned start.
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)data & ~(page - 1);
+    madvise((void *)start, length + ((uintptr_t)data - start), MADV_WILLNEED);
+}
@@ -0,0 +1,152 @@
+#include "literal.h"
+#include "simd.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LITERAL_HAVE_X86 1
+#endif
+
+static inline unsigned char fold_ascii(unsigned char byte) {
+    return (byte >= 'A' && byte <= 'Z') ? (unsigned char)(byte | 0x20) : byte;
+}
+
+static inline bool is_ascii_alpha(unsigned char byte) {
+    return fold_ascii(byte) >= 'a' && fold_ascii(byte) <= 'z';
+}
+
+static bool literal_equal_at(const literal_t *literal, const char *candidate) {
+    if (!literal->caseless) {
+        return memcmp(candidate, literal->needle, literal->length) == 0;
+    }
+    const unsigned char *hay = (const unsigned char *)candidate;
+    const unsigned char *needle = (const unsigned char *)literal->needle;
+    for (size_t i = 0; i < literal->length; i++) {
+        if (fold_ascii(hay[i]) != needle[i]) return false;
+    }
+    return true;
+}
+
+static const char *literal_search_scalar(const literal_t *literal, const char *haystack, size_t length) {
+    if (literal->length > length) return NULL;
+    const char *last = haystack + (length - literal->length);
+
+    if (!literal->caseless) {
+        const char *pos = haystack;
+        while (pos <= last) {
+            pos = memchr(pos, literal->needle[0], (size_t)(last - pos) + 1);
+            if (pos == NULL) return NULL;
+            if (literal_equal_at(literal, pos)) return pos;
+            pos++;
+        }
+        return NULL;
+    }
+
+    unsigned char first = (unsigned char)literal->needle[0];
+    for (const char *pos = haystack; pos <= last; pos++) {
+        if (fold_ascii((unsigned char)*pos) == first && literal_equal_at(literal, pos)) return pos;
+    }
+    return NULL;
+}
+
+#ifdef LITERAL_HAVE_X86
+
+/*
+ * Both vector kernels scan for positions whose first byte matches needle[0]
+ * and whose byte at 'length - 1' matches the last needle byte. With caseless
+ * search a letter anchor is compared after OR-ing 0x20 into the haystack;
+ * the few non-letters that fold onto it are rejected by verification.
+ */
+
+static const char *literal_search_sse2(const literal_t *literal, const char *haystack, size_t length) {
+    size_t needle_len = literal->length;
+    if (needle_len > length) return NULL;
+
+    unsigned char first = (unsigned char)literal->needle[0];
+    unsigned char last = (unsigned char)literal->needle[needle_len - 1];
+    bool fold_first = literal->caseless && is_ascii_alpha(first);
+    bool fold_last = literal->caseless && is_ascii_alpha(last);
+
+    const __m128i first_vec = _mm_set1_epi8((char)first);
+    const __m128i last_vec = _mm_set1_epi8((char)last);
+    const __m128i first_fold = _mm_set1_epi8(fold_first ? 0x20 : 0);
+    const __m128i last_fold = _mm_set1_epi8(fold_last ? 0x20 : 0);
+
+    size_t pos = 0;
+    for (; pos + needle_len - 1 + 16 <= length; pos += 16) {
+        __m128i block_first = _mm_or_si128(_mm_loadu_si128((const __m128i *)(haystack + pos)), first_fold);
+        __m128i block_last = _mm_or_si128(_mm_loadu_si128((const __m128i *)(haystack + pos + needle_len - 1)), last_fold);
+        unsigned mask = (unsigned)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(block_first, first_vec), _mm_cmpeq_epi8(block_last, last_vec)));
+        while (mask != 0) {
+            size_t candidate = pos + (size_t)__builtin_ctz(mask);
+            if (literal_equal_at(literal, haystack + candidate)) return haystack + candidate;
+            mask &= mask - 1;
+        }
+    }
+
+    return literal_search_scalar(literal, haystack + pos, length - pos);
+}
+
+[[gnu::target("avx2")]]
+static const char *literal_search_avx2(const literal_t *literal, const char *haystack, size_t length) {
+    size_t needle_len = literal->length;
+    if (needle_len > length) return NULL;
+
+    unsigned char first = (unsigned char)literal->needle[0];
+    unsigned char last = (unsigned char)literal->needle[needle_len - 1];
+    bool fold_first = literal->caseless && is_ascii_alpha(first);
+    bool fold_last = literal->caseless && is_ascii_alpha(last);
+
+    const __m256i first_vec = _mm256_set1_epi8((char)first);
+    const __m256i last_vec = _mm256_set1_epi8((char)last);
+    const __m256i first_fold = _mm256_set1_epi8(fold_first ? 0x20 : 0);
+    const __m256i last_fold = _mm256_set1_epi8(fold_last ? 0x20 : 0);
+
+    size_t pos = 0;
+    for (; pos + needle_len - 1 + 32 <= length; pos += 32) {
+        __m256i block_first = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(haystack + pos)), first_fold);
+        __m256i block_last = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(haystack + pos + needle_len - 1)), last_fold);
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(block_first, first_vec), _mm256_cmpeq_epi8(block_last, last_vec)));
+        while (mask != 0) {
+            size_t candidate = pos + (size_t)__builtin_ctz(mask);
+            if (literal_equal_at(literal, haystack + candidate)) return haystack + candidate;
+            mask &= mask - 1;
+        }
+    }
+
+    return literal_search_sse2(literal, haystack + pos, length - pos);
+}
+
+#endif // LITERAL_HAVE_X86
+
+bool literal_init(literal_t *literal, const char *needle, size_t length, bool caseless) {
+    *literal = (literal_t){ .needle = NULL, .length = 0, .caseless = caseless, .search = literal_search_scalar };
+    if (length == 0) return false;
+
+    literal->needle = malloc(length);
+    if (literal->needle == NULL) return false;
+    for (size_t i = 0; i < length; i++) {
+        unsigned char byte = (unsigned char)needle[i];
+        literal->needle[i] = (char)(caseless ? fold_ascii(byte) : byte);
+    }
+    literal->length = length;
+
+#ifdef LITERAL_HAVE_X86
+    switch (simd_level()) {
+        case SIMD_LEVEL_AVX2: literal->search = literal_search_avx2; break;
+        case SIMD_LEVEL_SSE2: literal->search = literal_search_sse2; break;
+        case SIMD_LEVEL_SCALAR: break;
+    }
+#endif
+    return true;
+}
+
+void literal_destroy(literal_t *literal) {
+    free(literal->needle);
+    literal->needle = NULL;
+    literal->length = 0;
+}
@@ -1,3 +1,7 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,65 +13,359 @@
 #include "discovery.h"
 #include "worker.h"
 #include "matcher.h"
+#include "order.h"
+#include "index.h"
+#include "stream.h"
+#include "decompress.h"
+#include "stats.h"
+#include "cpu.h"
+#include "scaler.h"
 
 
 static void print_usage(const char *progname) {
     fprintf(stderr, "Usage: %s [OPTIONS] PATTERN [PATH...]\n", progname);
+    fprintf(stderr, "       (PATH '-', and no PATH without -r, read standard input)\n");
+    fprintf(stderr, "       %s [OPTIONS] -e PATTERN... | -f FILE... [PATH...]\n", progname);
+    fprintf(stderr, "       %s --index-build | --index-update [OPTIONS] [DIR]\n", progname);
     fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -e, --regexp=PATTERN   Use PATTERN for matching; may be given more than once\n");
+    fprintf(stderr, "  -f, --file=FILE        Take patterns from FILE, one per line\n");
+    fprintf(stderr, "  -F, --fixed-strings    Interpret PATTERN as a fixed string, not a regular expression\n");
     fprintf(stderr, "  -i, --ignore-case      Ignore case distinctions\n");
     fprintf(stderr, "  -n, --line-number      Print line number with output lines\n");
     fprintf(stderr, "  -r, --recursive        Read all files under each directory, recursively\n");
-    fprintf(stderr, "  -w, --workers=NUM      Number of worker threads (default: auto)\n");
+    fprintf(stderr, "  -l, --files-with-matches  Print only the names of files with a match\n");
+    fprintf(stderr, "  -L, --files-without-match Print only the names of files without a match\n");
+    fprintf(stderr, "  -c, --count            Print only the number of matching lines per file\n");
+    fprintf(stderr, "  -q, --quiet            Print nothing; exit with 0 at the first match, 1 if there is none\n");
+    fprintf(stderr, "  -m, --max-count=NUM    Stop reading a file after NUM matching lines\n");
+    fprintf(stderr, "  -w, --workers=NUM|auto Number of worker threads (default: auto, one per available CPU)\n");
+    fprintf(stderr, "  --adaptive[=MAX]       Add workers, up to MAX (default: 4 times -w), while they wait on I/O,\n");
+    fprintf(stderr, "                         and drop them again once the CPUs are saturated\n");
+    fprintf(stderr, "  --pin                  Pin each worker thread to one CPU\n");
+    fprintf(stderr, "  --largest-first        Stat files as directories are listed and search the largest first\n");
     fprintf(stderr, "  -I                     Process a binary file as if it did not contain matching data (default)\n");
-    fprintf(stderr, "  --include=GLOB         Search only files whose base name matches GLOB\n");
-    fprintf(stderr, "  --exclude=GLOB         Skip files whose base name matches GLOB\n");
+    fprintf(stderr, "  -z, --decompress       Search gzip and zstd files through their decompressed contents\n");
+    fprintf(stderr, "  --include=GLOB         Search only files matching GLOB (base name, or path if GLOB has a '/')\n");
+    fprintf(stderr, "  --exclude=GLOB         Skip files and directories matching GLOB; 'dir/' and 'dir/*' prune dir\n");
+    fprintf(stderr, "  --gitignore            Skip what .gitignore, .ignore and .git/info/exclude ignore, and .git\n");
+    fprintf(stderr, "  --ordered, --sort=path Print files in a stable, sorted order\n");
+    fprintf(stderr, "  --chunk-size=SIZE      Split files larger than SIZE (K, M, G suffixes; 0 = never)\n");
+    fprintf(stderr, "                         into chunks searched in parallel (default: 64M)\n");
+    fprintf(stderr, "  --mmap-threshold=SIZE  Map files of at least SIZE, read smaller ones (default: 128K)\n");
+    fprintf(stderr, "  --populate-limit=SIZE  Pre-fault mapped files up to SIZE (default: 16M)\n");
+    fprintf(stderr, "  --io-uring             Batch stat/open/read through io_uring (if built with it)\n");
+    fprintf(stderr, "  --index-build          Write a trigram index of DIR (default: .) to DIR/" INDEX_FILE_NAME "\n");
+    fprintf(stderr, "  --index-update         Re-index only files of DIR that changed since, as a new index segment\n");
+    fprintf(stderr, "  --index                Search DIR, skipping unchanged files its index rules out\n");
+    fprintf(stderr, "  --stats[=json]         Print counts and per-phase, per-thread timings to stderr at the end\n");
+}
+
+// Parses a byte count with an optional K, M or G suffix.
+static bool parse_size(const char *text, size_t *size) {
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (end == text || errno != 0 || text[0] == '-') return false;
+    unsigned shift = 0;
+    switch (*end) {
+        case 'K': case 'k': shift = 10; end++; break;
+        case 'M': case 'm': shift = 20; end++; break;
+        case 'G': case 'g': shift = 30; end++; break;
+        default: break;
+    }
+    if (*end != '\0' || value > (SIZE_MAX >> shift)) return false;
+    *size = (size_t)value << shift;
+    return true;
+}
+
+// Output held back by --ordered beyond this goes to a temporary file.
+enum { ORDER_MEMORY_CAP = 64 * 1024 * 1024 };
+
+enum { DEFAULT_CHUNK_SIZE = 64 * 1024 * 1024 };
+
+// Appends each newline-separated line of 'text' as its own pattern, like grep.
+static void add_patterns(char ***patterns, size_t *count, const char *text, size_t length) {
+    const char *end = text + length;
+    const char *line = text;
+    while (true) {
+        const char *newline = memchr(line, '\n', (size_t)(end - line));
+        const char *line_end = newline ? newline : end;
+        *patterns = realloc(*patterns, sizeof(char*) * (*count + 2));
+        (*patterns)[(*count)++] = strndup(line, (size_t)(line_end - line));
+        (*patterns)[*count] = NULL;
+        if (newline == NULL) break;
+        line = newline + 1;
+    }
+}
+
+static bool add_pattern_file(char ***patterns, size_t *count, const char *path) {
+    auto_file FILE *file = strcmp(path, "-") == 0 ? NULL : fopen(path, "r");
+    FILE *input = strcmp(path, "-") == 0 ? stdin : file;
+    if (input == NULL) return false;
+
+    auto_free char *line = NULL;
+    size_t capacity = 0;
+    ssize_t line_len;
+    while ((line_len = getline(&line, &capacity, input)) != -1) {
+        if (line_len > 0 && line[line_len - 1] == '\n') line_len--;
+        add_patterns(patterns, count, line, (size_t)line_len);
+    }
+    return true;
+}
+
+static bool is_directory(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Inputs that cannot be mapped: stdin ("-"), pipes, terminals and other devices, sockets.
+static bool is_stream(const char *path) {
+    struct stat st;
+    return strcmp(path, "-") == 0 ||
+           (stat(path, &st) == 0 && (S_ISFIFO(st.st_mode) || S_ISCHR(st.st_mode) || S_ISSOCK(st.st_mode)));
+}
+
+// Searches a stream on the calling thread. Standard input is only labelled when there are other inputs.
+static bool search_stream(const char *path, bool only_input, const grep_config_t *grep_cfg, bool ignore_binary,
+                          size_t *matches) {
+    if (strcmp(path, "-") == 0) {
+        return stream_search(STDIN_FILENO, only_input ? NULL : "(standard input)", grep_cfg, ignore_binary, matches);
+    }
+    auto_close int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open '%s': %s.\n", path, strerror(errno));
+        return false;
+    }
+    return stream_search(fd, path, grep_cfg, ignore_binary, matches);
+}
+
+// Searches the streams in turn; with -q a match ends the workers' search too.
+static bool search_streams(const char *const *streams, size_t count, bool only_input, const grep_config_t *grep_cfg,
+                           bool ignore_binary, work_queue_t *queue) {
+    bool ok = true;
+    for (size_t i = 0; i < count && !work_queue_is_cancelled(queue); i++) {
+        size_t matches = 0;
+        ok &= search_stream(streams[i], only_input, grep_cfg, ignore_binary, &matches);
+        if (matches > 0 && grep_cfg->report == MATCHER_REPORT_QUIET) work_queue_cancel(queue);
+    }
+    return ok;
+}
+
+typedef enum { INDEX_MODE_NONE, INDEX_MODE_BUILD, INDEX_MODE_UPDATE, INDEX_MODE_QUERY } index_mode_t;
+
+// Marks the indexed files that may match: those containing every trigram of
+// at least one pattern's required literal.
+static bool query_index(index_set_t *set, const grep_config_t *grep_cfg, const char *const *patterns,
+                        size_t pattern_count) {
+    auto_index_query index_query_t query = { .clauses = NULL, .count = 0 };
+    for (size_t i = 0; i < pattern_count; i++) {
+        auto_free char *literal = malloc(strlen(patterns[i]) + 1);
+        if (literal == NULL) return false;
+        size_t length = matcher_required_literal(patterns[i], grep_cfg->fixed_strings, literal);
+        if (!index_query_add_literal(&query, literal, length)) return false;
+    }
+    return index_set_query(set, &query);
+}
+
+// Writes what an update walk found as a new segment, and compacts the index once there are too many.
+static bool finish_index_update(index_set_t *set, index_builder_t *builder, const char *directory) {
+    size_t file_count = 0;
+    size_t trigram_count = 0;
+    if (!index_set_remove_stale(set, builder)) return false;
+    if (index_builder_is_empty(builder)) {
+        fprintf(stderr, "Index of %s is up to date\n", directory);
+        return true;
+    }
+    if (!index_set_write_segment(set, builder, directory, &file_count, &trigram_count)) return false;
+    fprintf(stderr, "Re-indexed %zu files (%zu trigrams) into segment %zu of %s\n", file_count, trigram_count,
+            set->count, directory);
+
+    index_set_close(set);
+    if (!index_set_open(set, directory) || set->count - 1 <= INDEX_SEGMENT_LIMIT) return true;
+    if (!index_set_compact(set, directory, &file_count, &trigram_count)) return false;
+    fprintf(stderr, "Compacted the index of %s: %zu files (%zu trigrams)\n", directory, file_count, trigram_count);
+    return true;
 }
 
 int main(int argc, char *argv[]) {
-    grep_config_t grep_cfg = { .code = NULL, .case_insensitive = false, .line_numbering = false };
-    auto_str_array char **include_patterns = NULL;
-    auto_str_array char **exclude_patterns = NULL;
-    discovery_config_t disc_cfg = { 
-        .include_patterns = NULL, .include_count = 0, 
-        .exclude_patterns = NULL, .exclude_count = 0, 
-        .ignore_binary = true, .recursive = false 
+    auto_grep_config grep_config_t grep_cfg = {
+        .code = NULL, .case_insensitive = false, .line_numbering = false, .fixed_strings = false,
+        .report = MATCHER_REPORT_LINES, .max_count = SIZE_MAX
+    };
+    auto_str_array char **patterns = NULL;
+    size_t pattern_count = 0;
+    bool have_pattern_option = false;
+    auto_discovery_config discovery_config_t disc_cfg = {
+        .ignore_binary = true, .recursive = false, .size_schedule = false, .order = NULL
     };
 
     static struct option long_options[] = {
+        {"regexp",      required_argument, 0, 'e'},
+        {"file",        required_argument, 0, 'f'},
+        {"fixed-strings", no_argument, 0, 'F'},
         {"ignore-case", no_argument, 0, 'i'},
         {"line-number", no_argument, 0, 'n'},
         {"recursive",   no_argument, 0, 'r'},
         {"workers",     required_argument, 0, 'w'},
+        {"decompress",  no_argument, 0, 'z'},
+        {"files-with-matches", no_argument, 0, 'l'},
+        {"files-without-match", no_argument, 0, 'L'},
+        {"count",       no_argument, 0, 'c'},
+        {"quiet",       no_argument, 0, 'q'},
+        {"silent",      no_argument, 0, 'q'},
+        {"max-count",   required_argument, 0, 'm'},
         {"include",     required_argument, 0, 1},
         {"exclude",     required_argument, 0, 2},
+        {"ordered",     no_argument, 0, 3},
+        {"sort",        required_argument, 0, 4},
+        {"chunk-size",  required_argument, 0, 5},
+        {"mmap-threshold", required_argument, 0, 6},
+        {"populate-limit", required_argument, 0, 7},
+        {"io-uring",    no_argument, 0, 8},
+        {"gitignore",   no_argument, 0, 9},
+        {"index-build", no_argument, 0, 10},
+        {"index",       no_argument, 0, 11},
+        {"index-update", no_argument, 0, 12},
+        {"stats",       optional_argument, 0, 13},
+        {"pin",         no_argument, 0, 14},
+        {"adaptive",    optional_argument, 0, 15},
+        {"largest-first", no_argument, 0, 16},
         {"help",        no_argument, 0, 'h'},
         {0, 0, 0, 0}
     };
 
-    int num_workers = 3;
+    size_t num_workers = 0; // 0: one per available CPU
+    size_t max_workers = 0; // Above 'num_workers' with --adaptive; 0: four times as many
+    bool adaptive = false;
+    bool pin = false;
+    bool ordered = false;
+    bool use_io_uring = false;
+    bool decompress = false;
+    bool quiet = false;
+    bool stats_enabled = false;
+    bool stats_json = false;
+    index_mode_t index_mode = INDEX_MODE_NONE;
+    size_t chunk_size = DEFAULT_CHUNK_SIZE;
+    io_config_t io_config = {
+        .mmap_threshold = IO_DEFAULT_MMAP_THRESHOLD, .populate_limit = IO_DEFAULT_POPULATE_LIMIT
+    };
     int opt;
-    while ((opt = getopt_long(argc, argv, "inrw:Ih", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "e:f:Finrw:IzlLcqm:h", long_options, NULL)) != -1) {
         switch (opt) {
+            case 'e':
+                add_patterns(&patterns, &pattern_count, optarg, strlen(optarg));
+                have_pattern_option = true;
+                break;
+            case 'f':
+                if (!add_pattern_file(&patterns, &pattern_count, optarg)) {
+                    fprintf(stderr, "Error: Cannot read pattern file '%s'.\n", optarg);
+                    return 1;
+                }
+                have_pattern_option = true;
+                break;
+            case 'F': grep_cfg.fixed_strings = true; break;
             case 'i': grep_cfg.case_insensitive = true; break;
             case 'n': grep_cfg.line_numbering = true; break;
             case 'r': disc_cfg.recursive = true; break;
             case 'w':
-                num_workers = atoi(optarg);
-                if (num_workers <= 0) {
+                if (strcmp(optarg, "auto") == 0) {
+                    num_workers = 0;
+                } else if (atoi(optarg) <= 0) {
                     fprintf(stderr, "Error: Number of workers must be at least 1.\n");
                     return 1;
+                } else {
+                    num_workers = (size_t)atoi(optarg);
                 }
                 break;
             case 'I': disc_cfg.ignore_binary = true; break;
+            case 'l': grep_cfg.report = MATCHER_REPORT_FILES_WITH_MATCHES; break;
+            case 'L': grep_cfg.report = MATCHER_REPORT_FILES_WITHOUT_MATCH; break;
+            case 'c': grep_cfg.report = MATCHER_REPORT_COUNT; break;
+            case 'q': quiet = true; break;
+            case 'm': {
+                char *end;
+                errno = 0;
+                unsigned long long count = strtoull(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || errno != 0 || optarg[0] == '-') {
+                    fprintf(stderr, "Error: Invalid match count '%s'.\n", optarg);
+                    return 1;
+                }
+                grep_cfg.max_count = count > SIZE_MAX ? SIZE_MAX : (size_t)count;
+                break;
+            }
+            case 'z':
+                decompress = decompress_available();
+                if (!decompress) fprintf(stderr, "Warning: Built without zlib or zstd; -z has no effect.\n");
+                break;
             case 1: // --include
-                include_patterns = realloc(include_patterns, sizeof(char*) * (disc_cfg.include_count + 2));
-                include_patterns[disc_cfg.include_count++] = strdup(optarg);
-                include_patterns[disc_cfg.include_count] = NULL;
+                discovery_add_include(&disc_cfg, optarg);
                 break;
             case 2: // --exclude
-                exclude_patterns = realloc(exclude_patterns, sizeof(char*) * (disc_cfg.exclude_count + 2));
-                exclude_patterns[disc_cfg.exclude_count++] = strdup(optarg);
-                exclude_patterns[disc_cfg.exclude_count] = NULL;
+                discovery_add_exclude(&disc_cfg, optarg);
+                break;
+            case 3: // --ordered
+                ordered = true;
+                break;
+            case 4: // --sort
+                if (strcmp(optarg, "path") != 0) {
+                    fprintf(stderr, "Error: Unsupported sort key '%s'.\n", optarg);
+                    return 1;
+                }
+                ordered = true;
+                break;
+            case 5: // --chunk-size
+                if (!parse_size(optarg, &chunk_size)) {
+                    fprintf(stderr, "Error: Invalid chunk size '%s'.\n", optarg);
+                    return 1;
+                }
+                break;
+            case 6: // --mmap-threshold
+            case 7: // --populate-limit
+                if (!parse_size(optarg, opt == 6 ? &io_config.mmap_threshold : &io_config.populate_limit)) {
+                    fprintf(stderr, "Error: Invalid size '%s'.\n", optarg);
+                    return 1;
+                }
+                break;
+            case 8: // --io-uring
+#ifndef CGREP_HAVE_IO_URING
+                fprintf(stderr, "Warning: Built without io_uring support; using blocking I/O.\n");
+#endif
+                use_io_uring = true;
+                break;
+            case 9: // --gitignore
+                disc_cfg.use_ignore_files = true;
+                break;
+            case 10: // --index-build
+                index_mode = INDEX_MODE_BUILD;
+                break;
+            case 11: // --index
+                index_mode = INDEX_MODE_QUERY;
+                break;
+            case 12: // --index-update
+                index_mode = INDEX_MODE_UPDATE;
+                break;
+            case 13: // --stats
+                if (optarg != NULL && strcmp(optarg, "json") != 0) {
+                    fprintf(stderr, "Error: Unsupported stats format '%s'.\n", optarg);
+                    return 1;
+                }
+                stats_enabled = true;
+                stats_json = optarg != NULL;
+                break;
+            case 14: // --pin
+                pin = true;
+                break;
+            case 15: // --adaptive
+                if (optarg != NULL && atoi(optarg) <= 0) {
+                    fprintf(stderr, "Error: Maximum number of workers must be at least 1.\n");
+                    return 1;
+                }
+                adaptive = true;
+                max_workers = optarg != NULL ? (size_t)atoi(optarg) : 0;
+                break;
+            case 16: // --largest-first
+                disc_cfg.size_schedule = true;
                 break;
             case 'h': print_usage(argv[0]); return 0;
             default:
@@ -76,53 +374,209 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (optind >= argc) {
-        fprintf(stderr, "Error: Pattern is required.\n");
-        print_usage(argv[0]);
+    size_t cpus = cpu_count_available();
+    if (num_workers == 0) num_workers = cpus;
+    if (!adaptive) {
+        max_workers = num_workers;
+    } else if (max_workers == 0) {
+        max_workers = 4 * num_workers;
+    } else if (max_workers < num_workers) {
+        num_workers = max_workers;
+    }
+
+    if (quiet) {
+        // Nothing is printed, so there is nothing to order either.
+        grep_cfg.report = MATCHER_REPORT_QUIET;
+        ordered = false;
+    }
+
+    if (index_mode == INDEX_MODE_BUILD || index_mode == INDEX_MODE_UPDATE) {
+        // Workers still set up a matcher; an empty fixed string needs no state.
+        add_patterns(&patterns, &pattern_count, "", 0);
+        grep_cfg.fixed_strings = true;
+        ordered = false;
+    } else if (!have_pattern_option) {
+        if (optind >= argc) {
+            fprintf(stderr, "Error: Pattern is required.\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        add_patterns(&patterns, &pattern_count, argv[optind], strlen(argv[optind]));
+        optind++;
+    }
+
+    if (!matcher_compile(&grep_cfg, (const char *const *)patterns, pattern_count)) return 1;
+
+    // This thread (initial discovery, streams) and each worker get a record.
+    auto_stats stats_t stats = { .threads = NULL };
+    if (stats_enabled) {
+        if (!stats_init(&stats, max_workers + 1)) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            return 1;
+        }
+        stats_thread_begin(&stats, "main");
+    }
+    const char *index_root = optind < argc ? argv[optind] : ".";
+    auto_index_set index_set_t index_set = { .generations = NULL, .count = 0 };
+    if (index_mode != INDEX_MODE_NONE) {
+        if (argc - optind > 1 || !is_directory(index_root)) {
+            fprintf(stderr, "Error: --index, --index-build and --index-update take a single directory.\n");
+            return 1;
+        }
+        if (decompress) {
+            fprintf(stderr, "Error: -z cannot be used with an index, which holds raw file contents.\n");
+            return 1;
+        }
+        // The index indexes the whole tree, and the io_uring reader does not consult it.
+        disc_cfg.recursive = true;
+        use_io_uring = false;
+        discovery_add_exclude(&disc_cfg, INDEX_FILE_NAME "*");
+    }
+    if (!discovery_compile_filters(&disc_cfg)) return 1;
+
+    if ((index_mode == INDEX_MODE_QUERY || index_mode == INDEX_MODE_UPDATE) &&
+        !index_set_open(&index_set, index_root)) {
+        fprintf(stderr, index_mode == INDEX_MODE_QUERY
+                            ? "Warning: No usable index in '%s' (see --index-build); searching the whole tree.\n"
+                            : "Warning: No usable index in '%s'; building a new one.\n",
+                index_root);
+        index_mode = index_mode == INDEX_MODE_QUERY ? INDEX_MODE_NONE : INDEX_MODE_BUILD;
+    }
+    if (index_mode == INDEX_MODE_QUERY &&
+        !query_index(&index_set, &grep_cfg, (const char *const *)patterns, pattern_count)) {
+        fprintf(stderr, "Error: Out of memory querying the index.\n");
         return 1;
     }
 
-    const char *pattern = argv[optind++];
-    auto_pcre2_code pcre2_code *code = matcher_compile(pattern, grep_cfg.case_insensitive);
-    if (code == NULL) return 1;
-    grep_cfg.code = code;
-    disc_cfg.include_patterns = include_patterns;
-    disc_cfg.exclude_patterns = exclude_patterns;
+    order_t order;
+    if (ordered) {
+        order_init(&order, ORDER_MEMORY_CAP);
+        disc_cfg.order = &order;
+    }
 
     auto_work_queue work_queue_t queue = {0};
-    work_queue_init(&queue);
-    queue.pending_items = 1; // Prevent workers from exiting while we are still discovering
+    work_queue_init(&queue, max_workers);
+    work_queue_hold(&queue); // Prevent workers from exiting while we are still discovering
 
-    if (optind >= argc) {
-        discover_files(".", &disc_cfg, &queue);
+    // Streams are searched by this thread; the workers take everything else.
+    const char *streams[argc + 1];
+    size_t stream_count = 0;
+    size_t input_count = (size_t)(argc - optind);
+    if (optind >= argc && (disc_cfg.recursive || index_mode != INDEX_MODE_NONE)) {
+        discover_files(".", NULL, &disc_cfg, &queue);
+    } else if (optind >= argc) {
+        streams[stream_count++] = "-";
+        input_count = 1;
     } else {
         for (; optind < argc; optind++) {
             struct stat path_stat;
-            if (lstat(argv[optind], &path_stat) == 0) {
+            if (index_mode == INDEX_MODE_NONE && is_stream(argv[optind])) {
+                streams[stream_count++] = argv[optind];
+            } else if (lstat(argv[optind], &path_stat) == 0) {
                 if (S_ISDIR(path_stat.st_mode)) {
                     if (disc_cfg.recursive || strcmp(argv[optind], ".") == 0) {
-                        discover_files(argv[optind], &disc_cfg, &queue);
+                        discover_files(argv[optind], NULL, &disc_cfg, &queue);
                     }
                 } else {
-                    work_queue_push(&queue, argv[optind]);
+                    discover_push_root(argv[optind], &disc_cfg, &queue);
                 }
             }
         }
     }
 
-    pthread_t workers[num_workers];
-    worker_args_t wargs = { .queue = &queue, .grep_config = &grep_cfg, .discovery_config = &disc_cfg };
+    if (disc_cfg.order) order_finish(disc_cfg.order, NULL, NULL); // All command line paths have slots
 
-    for (int i = 0; i < num_workers; i++) {
-        pthread_create(&workers[i], NULL, worker_thread, &wargs);
+    index_builder_t *builder = NULL;
+    if ((index_mode == INDEX_MODE_BUILD || index_mode == INDEX_MODE_UPDATE) &&
+        (builder = index_builder_create()) == NULL) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return 1;
     }
 
-    // Now that initial discovery is done and workers are started, decrement the sentinel
+    pthread_t workers[max_workers];
+    atomic_bool workers_failed = false;
+    worker_args_t wargs = {
+        .queue = &queue, .grep_config = &grep_cfg, .discovery_config = &disc_cfg, .chunk_size = chunk_size,
+        .io_config = io_config,
+        .use_io_uring = use_io_uring,
+        .decompress = decompress,
+        .index_builder = builder,
+        .index_set = index_mode == INDEX_MODE_QUERY || index_mode == INDEX_MODE_UPDATE ? &index_set : NULL,
+        .stats = stats_enabled ? &stats : NULL,
+        .failed = &workers_failed
+    };
+
+    // Workers past 'num_workers' park until the scaler activates them.
+    worker_scaler_t scaler = { .queue = NULL };
+    if (adaptive) worker_scaler_start(&scaler, &queue, cpus, num_workers, max_workers);
+
+    for (size_t i = 0; i < max_workers; i++) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (pin) cpu_pin_attr(&attr, i);
+        pthread_create(&workers[i], &attr, worker_thread, &wargs);
+        pthread_attr_destroy(&attr);
+    }
+
+    // Now that initial discovery is done and workers are started, release the hold
     work_queue_item_done(&queue);
 
-    for (int i = 0; i < num_workers; i++) {
+    // With --ordered, streams follow the files so their output is not interleaved.
+    bool streams_ok = true;
+    if (disc_cfg.order == NULL) {
+        streams_ok = search_streams(streams, stream_count, input_count == 1, &grep_cfg, disc_cfg.ignore_binary, &queue);
+    }
+
+    stats_phase_t previous = stats_enter(STATS_PHASE_IDLE);
+    for (size_t i = 0; i < max_workers; i++) {
         pthread_join(workers[i], NULL);
     }
+    stats_leave(previous);
+    if (adaptive) {
+        worker_scaler_stop(&scaler);
+        stats.adaptive.start = num_workers;
+        stats.adaptive.peak = scaler.peak;
+        stats.adaptive.end = work_queue_active_workers(&queue);
+    }
+    if (disc_cfg.order) {
+        order_destroy(disc_cfg.order);
+        streams_ok = search_streams(streams, stream_count, input_count == 1, &grep_cfg, disc_cfg.ignore_binary, &queue);
+    }
+
+    // A worker that could not search cancelled the rest, so the results are incomplete.
+    if (atomic_load(&workers_failed)) {
+        index_builder_destroy(builder);
+        return 1;
+    }
+
+    if (index_mode == INDEX_MODE_UPDATE) {
+        bool updated = finish_index_update(&index_set, builder, index_root);
+        index_builder_destroy(builder);
+        if (!updated) {
+            fprintf(stderr, "Error: Cannot update the index in '%s'.\n", index_root);
+            return 1;
+        }
+    } else if (index_mode == INDEX_MODE_BUILD) {
+        char index_path[PATH_MAX];
+        size_t file_count = 0;
+        size_t trigram_count = 0;
+        bool written = snprintf(index_path, sizeof(index_path), "%s/%s", index_root, INDEX_FILE_NAME) <
+                           (int)sizeof(index_path) &&
+                       index_builder_write(builder, index_path, 0, &file_count, &trigram_count);
+        index_builder_destroy(builder);
+        if (!written) {
+            fprintf(stderr, "Error: Cannot write the index in '%s'.\n", index_root);
+            return 1;
+        }
+        fprintf(stderr, "Indexed %zu files (%zu trigrams) into %s\n", file_count, trigram_count, index_path);
+    }
+
+    if (stats_enabled) {
+        stats_thread_end();
+        stats_print(&stats, stats_json);
+    }
 
-    return 0;
+    // -q answers through its exit status alone: 0 once anything matched.
+    if (grep_cfg.report == MATCHER_REPORT_QUIET) return work_queue_is_cancelled(&queue) ? 0 : 1;
+    return streams_ok ? 0 : 1;
 }
@@ -1,15 +1,337 @@
 #include "matcher.h"
 #include "raii.h"
+#include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "output.h"
+#include "simd.h"
+#include "stats.h"
 
-pcre2_code* matcher_compile(const char *pattern, bool case_insensitive) {
+/*
+ * Required literal extraction.
+ *
+ * Walks the top level of the pattern collecting runs of literal characters
+ * that every match must contain, and keeps the longest one. Anything that is
+ * not obviously a plain literal ends the current run: groups and classes are
+ * skipped whole, and a quantifier that allows zero repetitions takes back the
+ * character it applies to. Constructs that could change what a literal means
+ * (option settings, \Q...\E, numeric escapes, top-level alternation) make the
+ * scanner give up, which only costs the prefilter, never a match.
+ */
+
+static const char *skip_class(const char *pos) {
+    const char *cursor = pos + 1;
+    if (*cursor == '^') cursor++;
+    if (*cursor == ']') cursor++;
+    while (*cursor != '\0') {
+        if (*cursor == '\\') {
+            if (cursor[1] == '\0') return NULL;
+            cursor += 2;
+        } else if (cursor[0] == '[' && cursor[1] == ':') {
+            const char *close = strstr(cursor + 2, ":]");
+            if (close == NULL) return NULL;
+            cursor = close + 2;
+        } else if (*cursor == ']') {
+            return cursor + 1;
+        } else {
+            cursor++;
+        }
+    }
+    return NULL;
+}
+
+static const char *skip_group(const char *pos) {
+    int depth = 0;
+    const char *cursor = pos;
+    while (*cursor != '\0') {
+        if (*cursor == '\\') {
+            if (cursor[1] == '\0') return NULL;
+            cursor += 2;
+        } else if (*cursor == '[') {
+            cursor = skip_class(cursor);
+            if (cursor == NULL) return NULL;
+        } else {
+            if (*cursor == '(') depth++;
+            if (*cursor == ')') depth--;
+            cursor++;
+            if (depth == 0) return cursor;
+        }
+    }
+    return NULL;
+}
+
+// Returns the position after a quantifier at 'pos' (or 'pos' itself if there is
+// none) and its minimum repeat count; NULL for a '{' this scanner cannot classify.
+static const char *parse_quantifier(const char *pos, unsigned long *min_repeat) {
+    const char *cursor = pos;
+    *min_repeat = 1;
+    if (*cursor == '*' || *cursor == '?') {
+        *min_repeat = 0;
+        cursor++;
+    } else if (*cursor == '+') {
+        cursor++;
+    } else if (*cursor == '{') {
+        char *digits_end;
+        if (!isdigit((unsigned char)cursor[1])) return NULL;
+        *min_repeat = strtoul(cursor + 1, &digits_end, 10);
+        cursor = digits_end;
+        if (*cursor == ',') {
+            cursor++;
+            while (isdigit((unsigned char)*cursor)) cursor++;
+        }
+        if (*cursor != '}') return NULL;
+        cursor++;
+    } else {
+        return pos;
+    }
+    if (*cursor == '?' || *cursor == '+') cursor++; // Lazy or possessive
+    return cursor;
+}
+
+static bool group_is_plain(const char *pos) {
+    if (pos[1] != '?') return true;
+    // Non-capturing, lookaround, atomic, branch-reset and named groups; everything
+    // else after "(?" sets options, recurses or is a comment.
+    return strchr(":=!<>|'", pos[2]) != NULL || strncmp(pos + 2, "P<", 2) == 0;
+}
+
+static size_t extract_required_literal(const char *pattern, char *best) {
+    size_t pattern_len = strlen(pattern);
+    auto_free char *run = malloc(pattern_len + 1);
+    if (run == NULL) return 0;
+
+    size_t run_len = 0;
+    size_t best_len = 0;
+    bool after_literal = false;
+    const char *pos = pattern;
+
+    while (*pos != '\0') {
+        unsigned long min_repeat;
+        const char *after = parse_quantifier(pos, &min_repeat);
+        if (after == NULL) return 0;
+        if (after != pos) {
+            if (after_literal && min_repeat == 0) run_len--;
+            if (run_len > best_len) {
+                memcpy(best, run, run_len);
+                best_len = run_len;
+            }
+            run_len = 0;
+            after_literal = false;
+            pos = after;
+            continue;
+        }
+
+        bool literal = false;
+        char literal_char = *pos;
+        if (*pos == '\\') {
+            unsigned char next = (unsigned char)pos[1];
+            if (next == '\0') return 0;
+            if (!isalnum(next)) {
+                literal = true;
+                literal_char = (char)next;
+            } else if (strchr("dDwWsShHvVbBAzZGKRXntrfea", next) == NULL) {
+                return 0; // \x, \Q, backreferences, \p{...} and friends
+            }
+            pos += 2;
+        } else if (*pos == '[') {
+            pos = skip_class(pos);
+            if (pos == NULL) return 0;
+        } else if (*pos == '(') {
+            if (!group_is_plain(pos)) return 0;
+            pos = skip_group(pos);
+            if (pos == NULL) return 0;
+        } else if (*pos == '|' || *pos == ')') {
+            return 0;
+        } else if (*pos == '.' || *pos == '^' || *pos == '$' || *pos == '\n') {
+            pos++;
+        } else {
+            literal = true;
+            pos++;
+        }
+
+        if (literal) {
+            run[run_len++] = literal_char;
+        } else {
+            if (run_len > best_len) {
+                memcpy(best, run, run_len);
+                best_len = run_len;
+            }
+            run_len = 0;
+        }
+        after_literal = literal;
+    }
+
+    if (run_len > best_len) {
+        memcpy(best, run, run_len);
+        best_len = run_len;
+    }
+    return best_len;
+}
+
+// Escapes that can match a newline: \s, \n, \v, \R, \D, \W, \H, \X and \C. Any
+// other letter or digit escape that is not known to exclude it (\x, \o, \c,
+// \p, \Q...) is treated as one that can. So are the subject assertions \A, \z,
+// \Z and \G, which would hold at every candidate line's start or end.
+static bool escape_may_match_newline(char next) {
+    if (strchr("snvRDWHXC", next) != NULL) return true;
+    return isalnum((unsigned char)next) && strchr("SVNhdwbBKtrfeaE", next) == NULL;
+}
+
+static bool class_may_match_newline(const char *pos, const char **end) {
+    const char *cursor = pos + 1;
+    if (*cursor == '^') return true;
+    if (*cursor == ']') cursor++;
+    int previous = -1; // The last literal character, for ranges
+    while (*cursor != '\0' && *cursor != ']') {
+        if (*cursor == '\\') {
+            if (cursor[1] == '\0' || escape_may_match_newline(cursor[1])) return true;
+            previous = isalnum((unsigned char)cursor[1]) ? -1 : (unsigned char)cursor[1];
+            cursor += 2;
+        } else if (cursor[0] == '[' && cursor[1] == ':') {
+            // Only classes that cannot hold a newline: no [:space:], [:cntrl:] or negations.
+            static const char *const safe[] = { "alnum", "alpha", "blank", "digit", "graph", "lower",
+                                                "print", "punct", "upper", "word", "xdigit" };
+            const char *close = strstr(cursor + 2, ":]");
+            if (close == NULL) return true;
+            bool known = false;
+            for (size_t i = 0; i < sizeof(safe) / sizeof(safe[0]) && !known; i++) {
+                known = strlen(safe[i]) == (size_t)(close - cursor - 2) && strncmp(cursor + 2, safe[i], strlen(safe[i])) == 0;
+            }
+            if (!known) return true;
+            previous = -1;
+            cursor = close + 2;
+        } else if (cursor[0] == '-' && previous >= 0 && cursor[1] != ']' && cursor[1] != '\0') {
+            // A range from a literal: it spans a newline unless both ends are above it.
+            if (previous <= '\n' || cursor[1] == '\\' || (unsigned char)cursor[1] <= '\n') return true;
+            previous = -1;
+            cursor += 2;
+        } else {
+            if (*cursor == '\n') return true;
+            previous = (unsigned char)*cursor;
+            cursor++;
+        }
+    }
+    if (*cursor == '\0') return true;
+    *end = cursor + 1;
+    return false;
+}
+
+/*
+ * The prefilter hands PCRE2 one candidate line at a time, so it is only sound
+ * for patterns that can never match across a line end. This says whether a
+ * pattern might; anything it does not understand counts as might, which only
+ * costs the prefilter.
+ */
+static bool pattern_may_match_newline(const char *pattern) {
+    const char *pos = pattern;
+    while (*pos != '\0') {
+        if (*pos == '\\') {
+            if (pos[1] == '\0' || escape_may_match_newline(pos[1])) return true;
+            pos += 2;
+        } else if (*pos == '[') {
+            if (class_may_match_newline(pos, &pos)) return true;
+        } else if (pos[0] == '(' && (pos[1] == '*' || (pos[1] == '?' && !group_is_plain(pos)))) {
+            // Verbs can change the newline convention; option settings may turn on (?s).
+            if (pos[1] == '*') return true;
+            for (const char *option = pos + 2; *option != ')' && *option != ':' && *option != '\0'; option++) {
+                if (*option == 's' || (!isalpha((unsigned char)*option) && *option != '-' && *option != '^')) return true;
+            }
+            pos += 2;
+        } else if (*pos == '\n') {
+            return true;
+        } else {
+            pos++;
+        }
+    }
+    return false;
+}
+
+// Falls back to the single code unit PCRE2 itself knows every match contains.
+static size_t pcre2_required_unit(const pcre2_code *code, char *best) {
+    uint32_t type = 0;
+    uint32_t unit = 0;
+    if (pcre2_pattern_info(code, PCRE2_INFO_LASTCODETYPE, &type) == 0 && type == 1 &&
+        pcre2_pattern_info(code, PCRE2_INFO_LASTCODEUNIT, &unit) == 0) {
+        best[0] = (char)unit;
+        return 1;
+    }
+    if (pcre2_pattern_info(code, PCRE2_INFO_FIRSTCODETYPE, &type) == 0 && type == 1 &&
+        pcre2_pattern_info(code, PCRE2_INFO_FIRSTCODEUNIT, &unit) == 0) {
+        best[0] = (char)unit;
+        return 1;
+    }
+    return 0;
+}
+
+enum { PREFILTER_SPACING_FAST_START = 2048, PREFILTER_SPACING_SLOW_START = 64 };
+
+static bool is_plain_literal(const char *pattern) {
+    return pattern[strcspn(pattern, "\\^$.[]|()?*+{}")] == '\0';
+}
+
+size_t matcher_required_literal(const char *pattern, bool fixed_strings, char *best) {
+    if (fixed_strings || is_plain_literal(pattern)) {
+        size_t length = strlen(pattern);
+        memcpy(best, pattern, length);
+        return length;
+    }
+    return extract_required_literal(pattern, best);
+}
+
+// Joins several regexes into one alternation of non-capturing groups.
+static char *join_alternation(const char *const *patterns, size_t count) {
+    size_t total = 1;
+    for (size_t i = 0; i < count; i++) {
+        total += strlen(patterns[i]) + sizeof("(?:)|");
+    }
+    char *joined = malloc(total);
+    if (joined == NULL) return NULL;
+
+    char *pos = joined;
+    for (size_t i = 0; i < count; i++) {
+        pos += sprintf(pos, "%s(?:%s)", i > 0 ? "|" : "", patterns[i]);
+    }
+    return joined;
+}
+
+static bool compile_literals(grep_config_t *config, const char *const *patterns, size_t count) {
+    if (count == 1) {
+        config->engine = MATCHER_ENGINE_FIXED;
+        size_t pattern_len = strlen(patterns[0]);
+        return pattern_len == 0 || literal_init(&config->literal, patterns[0], pattern_len, config->case_insensitive);
+    }
+    config->engine = MATCHER_ENGINE_MULTI_LITERAL;
+    return ac_build(&config->automaton, patterns, count, config->case_insensitive);
+}
+
+bool matcher_compile(grep_config_t *config, const char *const *patterns, size_t count) {
+    bool all_literal = true;
+    for (size_t i = 0; i < count && all_literal; i++) {
+        all_literal = is_plain_literal(patterns[i]);
+    }
+
+    if (config->fixed_strings || all_literal) {
+        if (!compile_literals(config, patterns, count)) {
+            fprintf(stderr, "Error: Could not build the matcher for %zu patterns.\n", count);
+            return false;
+        }
+        return true;
+    }
+
+    auto_free char *joined = NULL;
+    const char *pattern = patterns[0];
+    if (count > 1) {
+        pattern = joined = join_alternation(patterns, count);
+        if (joined == NULL) return false;
+    }
+
+    config->engine = MATCHER_ENGINE_PCRE2;
     int errornumber;
     PCRE2_SIZE erroroffset;
     uint32_t options = PCRE2_MULTILINE;
 
-    if (case_insensitive) {
+    if (config->case_insensitive) {
         options |= PCRE2_CASELESS;
     }
 
@@ -26,85 +348,353 @@ pcre2_code* matcher_compile(const char *pattern, bool case_insensitive) {
         PCRE2_UCHAR buffer[256];
         pcre2_get_error_message(errornumber, buffer, sizeof(buffer));
         fprintf(stderr, "PCRE2 compilation failed at offset %d: %s\n", (int)erroroffset, buffer);
-        return NULL;
+        return false;
     }
 
-    return code;
+    // A failed JIT compile (e.g. no JIT support on this platform) is not an
+    // error: matcher_state_init() notices and the interpreter is used instead.
+    pcre2_jit_compile(code, PCRE2_JIT_COMPLETE);
+    config->code = code;
+
+    // A match that may span lines would be cut off at the candidate line's end.
+    if (pattern_may_match_newline(pattern)) return true;
+    auto_free char *required = malloc(strlen(pattern) + 1);
+    if (required == NULL) return true;
+    size_t required_len = extract_required_literal(pattern, required);
+    // An inline (?i) may make PCRE2's own code unit caseless even without -i.
+    bool caseless = config->case_insensitive || strstr(pattern, "(?") != NULL;
+    if (required_len == 0) {
+        required_len = pcre2_required_unit(code, required);
+    } else {
+        caseless = config->case_insensitive;
+    }
+    literal_init(&config->literal, required, required_len, caseless);
+
+    // PCRE2 skips ahead quickly on its own when it knows how a match starts, so
+    // the prefilter has to save a lot more bytes per PCRE2 call to pay off.
+    uint32_t first_type = 0;
+    const uint8_t *first_bitmap = NULL;
+    pcre2_pattern_info(code, PCRE2_INFO_FIRSTCODETYPE, &first_type);
+    pcre2_pattern_info(code, PCRE2_INFO_FIRSTBITMAP, (void *)&first_bitmap);
+    config->prefilter_min_spacing = (first_type != 0 || first_bitmap != NULL)
+        ? PREFILTER_SPACING_FAST_START : PREFILTER_SPACING_SLOW_START;
+
+    return true;
 }
 
-void matcher_process_buffer(const char *filename, const char *buffer, size_t length, const grep_config_t *config) {
-    if (config->code == NULL) return;
+void matcher_config_destroy(grep_config_t *config) {
+    cleanup_pcre2_code(&config->code);
+    literal_destroy(&config->literal);
+    ac_destroy(&config->automaton);
+}
 
-    auto_pcre2_match_data pcre2_match_data *match_data = pcre2_match_data_create_from_pattern(config->code, NULL);
-    if (match_data == NULL) return;
+enum { JIT_STACK_START = 32 * 1024, JIT_STACK_MAX = 1024 * 1024 };
 
-    PCRE2_SIZE start_offset = 0;
-    int return_code;
-    unsigned int line_number = 1;
-    const char *last_line_start = buffer;
+bool matcher_state_init(matcher_state_t *state, const grep_config_t *config) {
+    *state = (matcher_state_t){ .match_data = NULL, .match_context = NULL, .jit_stack = NULL, .use_jit = false };
+    output_buffer_init(&state->output);
+    if (config->engine != MATCHER_ENGINE_PCRE2) return true;
+    if (config->code == NULL) return false;
 
-    while (start_offset < length) {
-        return_code = pcre2_match(
+    state->match_data = pcre2_match_data_create_from_pattern(config->code, NULL);
+    state->match_context = pcre2_match_context_create(NULL);
+    if (state->match_data == NULL || state->match_context == NULL) return false;
+
+    size_t jit_size = 0;
+    if (pcre2_pattern_info(config->code, PCRE2_INFO_JITSIZE, &jit_size) == 0 && jit_size > 0) {
+        state->jit_stack = pcre2_jit_stack_create(JIT_STACK_START, JIT_STACK_MAX, NULL);
+        if (state->jit_stack != NULL) {
+            pcre2_jit_stack_assign(state->match_context, NULL, state->jit_stack);
+            state->use_jit = true;
+        }
+    }
+
+    return true;
+}
+
+void matcher_state_destroy(matcher_state_t *state) {
+    output_buffer_destroy(&state->output);
+    cleanup_pcre2_match_data(&state->match_data);
+    cleanup_pcre2_match_context(&state->match_context);
+    if (state->jit_stack) {
+        pcre2_jit_stack_free(state->jit_stack);
+        state->jit_stack = NULL;
+    }
+}
+
+static const char *find_line_start(const char *buffer, const char *pos) {
+    const char *newline = simd_rfind_byte(buffer, (size_t)(pos - buffer), '\n');
+    return newline ? newline + 1 : buffer;
+}
+
+static const char *find_line_end(const char *pos, const char *end) {
+    const char *newline = simd_find_byte(pos, (size_t)(end - pos), '\n');
+    return newline ? newline : end;
+}
+
+static int matcher_match(const grep_config_t *config, matcher_state_t *state,
+                         const char *buffer, size_t length, size_t start_offset) {
+    if (state->use_jit) {
+        return pcre2_jit_match(
             config->code,
             (PCRE2_SPTR)buffer,
             length,
             start_offset,
             0,
-            match_data,
-            NULL
+            state->match_data,
+            state->match_context
         );
+    }
+    return pcre2_match(
+        config->code,
+        (PCRE2_SPTR)buffer,
+        length,
+        start_offset,
+        0,
+        state->match_data,
+        state->match_context
+    );
+}
+
+static void print_line(output_buffer_t *out, const char *filename, const grep_config_t *config,
+                       unsigned int line_number, const char *line_start, size_t length, bool has_newline) {
+    if (filename) {
+        output_write(out, filename, strlen(filename));
+        output_write(out, ":", 1);
+    }
+    if (config->line_numbering) {
+        output_write_uint(out, line_number);
+        output_write(out, ":", 1);
+    }
+    // Take the line's own newline along when there is one, saving a separate piece.
+    output_write_ref(out, line_start, length);
+    if (!has_newline) output_write(out, "\n", 1);
+}
+
+// Where matching lines go: printed right away, or collected for a file chunk
+// whose line numbers are only known once the chunks before it are counted.
+typedef struct {
+    output_buffer_t *out;
+    const char *filename;
+    matcher_lines_t *lines;
+    size_t matches;
+    size_t limit; // Matching lines to find before the search stops
+} match_sink_t;
+
+// Returns true once the sink's limit is reached.
+static bool report_line(match_sink_t *sink, const grep_config_t *config, unsigned int line_number,
+                        const char *line_start, const char *line_end, const char *buffer_end) {
+    sink->matches++;
+    if (config->report != MATCHER_REPORT_LINES) {
+        if (sink->lines) sink->lines->count++; // Counted, not formatted
+        return sink->matches >= sink->limit;
+    }
+
+    bool has_newline = line_end < buffer_end;
+    size_t length = (size_t)(line_end - line_start) + (has_newline ? 1 : 0);
+    if (sink->lines == NULL) {
+        print_line(sink->out, sink->filename, config, line_number, line_start, length, has_newline);
+        return sink->matches >= sink->limit;
+    }
+
+    matcher_lines_t *lines = sink->lines;
+    if (lines->count == lines->capacity) {
+        size_t capacity = lines->capacity ? lines->capacity * 2 : 64;
+        matcher_line_t *items = realloc(lines->items, capacity * sizeof(*items));
+        if (items == NULL) return sink->matches >= sink->limit;
+        lines->items = items;
+        lines->capacity = capacity;
+    }
+    lines->items[lines->count++] = (matcher_line_t){
+        .start = line_start, .length = length, .line_number = line_number
+    };
+    return sink->matches >= sink->limit;
+}
+
+static unsigned int count_lines(const char *start, const char *end) {
+    return (unsigned int)simd_count_byte(start, (size_t)(end - start), '\n');
+}
+
+// Returns a pointer into the first line from 'pos' on that holds a match.
+static const char *literal_engine_find(const grep_config_t *config, const char *pos, size_t length) {
+    if (config->engine == MATCHER_ENGINE_MULTI_LITERAL) {
+        return ac_find(&config->automaton, pos, length);
+    }
+    // An empty needle matches every line.
+    if (config->literal.length == 0) return pos;
+    return literal_find(&config->literal, pos, length);
+}
+
+// Newlines in the whole buffer, when a collecting caller needs them to number the next chunk.
+static unsigned int total_newlines(const match_sink_t *sink, const grep_config_t *config, unsigned int line_number,
+                                   const char *last_line_start, const char *buffer_end) {
+    if (sink->lines == NULL || !config->line_numbering) return 0;
+    return line_number - 1 + count_lines(last_line_start, buffer_end);
+}
+
+// Shared by the FIXED and MULTI_LITERAL engines, neither of which needs PCRE2.
+static unsigned int literal_engine_search(const char *buffer, size_t length,
+                                          const grep_config_t *config, match_sink_t *sink) {
+    const char *buffer_end = buffer + length;
+    const char *pos = buffer;
+    unsigned int line_number = 1;
+    const char *last_line_start = buffer;
+
+    while (pos < buffer_end && sink->limit > 0) {
+        const char *hit = literal_engine_find(config, pos, (size_t)(buffer_end - pos));
+        if (hit == NULL) break;
+
+        const char *line_start = find_line_start(pos, hit);
+        const char *line_end = find_line_end(hit, buffer_end);
+
+        if (config->line_numbering) {
+            line_number += count_lines(last_line_start, line_start);
+            last_line_start = line_start;
+        }
+        if (report_line(sink, config, line_number, line_start, line_end, buffer_end)) break;
+
+        if (line_end == buffer_end) break;
+        pos = line_end + 1;
+    }
+    return total_newlines(sink, config, line_number, last_line_start, buffer_end);
+}
+
+// Once candidate lines are denser than config->prefilter_min_spacing, per-line
+// PCRE2 calls cost more than letting PCRE2 scan the rest of the buffer in one go.
+enum { PREFILTER_MIN_CANDIDATES = 32 };
+
+static unsigned int search_buffer(const char *buffer, size_t length, const grep_config_t *config,
+                                  matcher_state_t *state, match_sink_t *sink) {
+    if (config->engine != MATCHER_ENGINE_PCRE2) {
+        return literal_engine_search(buffer, length, config, sink);
+    }
+    if (config->code == NULL || state->match_data == NULL) return 0;
+
+    pcre2_match_data *match_data = state->match_data;
+    const char *buffer_end = buffer + length;
+    PCRE2_SIZE start_offset = 0;
+    int return_code;
+    unsigned int line_number = 1;
+    const char *last_line_start = buffer;
+    bool prefilter = config->literal.length > 0;
+    size_t candidates = 0;
+
+    while (start_offset < length && sink->limit > 0) {
+        size_t subject_length = length;
+        const char *line_start = NULL;
+        const char *line_end = NULL;
+
+        if (prefilter) {
+            // Only lines holding the required literal can match, so PCRE2 only
+            // ever sees those lines; no hit means the rest of the buffer is done.
+            const char *hit = literal_find(&config->literal, buffer + start_offset, length - start_offset);
+            if (hit == NULL) break;
+            line_start = find_line_start(buffer + start_offset, hit);
+            line_end = find_line_end(hit + config->literal.length, buffer_end);
+            start_offset = line_start - buffer;
+            subject_length = (line_end < buffer_end ? line_end + 1 : line_end) - buffer;
+            if (++candidates >= PREFILTER_MIN_CANDIDATES &&
+                subject_length / candidates < config->prefilter_min_spacing) {
+                prefilter = false;
+            }
+        }
+
+        return_code = matcher_match(config, state, buffer, subject_length, start_offset);
 
         if (return_code < 0) {
             if (return_code != PCRE2_ERROR_NOMATCH) {
                 fprintf(stderr, "Matching error %d\n", return_code);
+                break;
             }
-            break;
+            if (subject_length == length) break;
+            start_offset = subject_length;
+            continue;
         }
 
         PCRE2_SIZE *ovector = pcre2_get_ovector_pointer(match_data);
-        
-        // Find line start and end for the match
-        const char *match_start = buffer + ovector[0];
-        const char *line_start = match_start;
-        while (line_start > buffer && *(line_start - 1) != '\n') {
-            line_start--;
+
+        // Find line start and end for the match (already known for a prefiltered line)
+        if (subject_length == length) {
+            line_start = find_line_start(buffer, buffer + ovector[0]);
+            line_end = find_line_end(buffer + ovector[1], buffer_end);
         }
 
         // Count lines up to match
         if (config->line_numbering) {
-            for (const char *ptr_pos = last_line_start; ptr_pos < line_start; ptr_pos++) {
-                if (*ptr_pos == '\n') line_number++;
-            }
+            line_number += count_lines(last_line_start, line_start);
             last_line_start = line_start;
         }
 
-        const char *line_end = buffer + ovector[1];
-        while (line_end < buffer + length && *line_end != '\n') {
-            line_end++;
-        }
+        if (report_line(sink, config, line_number, line_start, line_end, buffer_end)) break;
 
-        // Output match (Thread-safe printing will be handled in output.c eventually)
-        // For now, let's just use printf, but we'll need a mutex or a better way later.
-        // We'll wrap this in a thread-safe output function.
-        
-        if (filename && config->line_numbering) {
-            output_printf("%s:%u:%.*s\n", filename, line_number, (int)(line_end - line_start), line_start);
-        } else if (filename) {
-            output_printf("%s:%.*s\n", filename, (int)(line_end - line_start), line_start);
-        } else if (config->line_numbering) {
-            output_printf("%u:%.*s\n", line_number, (int)(line_end - line_start), line_start);
-        } else {
-            output_printf("%.*s\n", (int)(line_end - line_start), line_start);
-        }
-
-        // Move to next line to avoid multiple matches on same line if desired, 
-        // or just move past the current match. Standard grep shows the line once if it matches.
-        // But if multiple matches are on the same line, standard grep only prints the line once 
-        // unless -o is used. We are doing a subset. Let's print the line once per match or 
-        // move to next line.
+        // Standard grep shows the line once if it matches, so continue from the next line.
         start_offset = line_end - buffer;
         if (start_offset < length && buffer[start_offset] == '\n') {
             start_offset++;
         }
     }
+    return total_newlines(sink, config, line_number, last_line_start, buffer_end);
+}
+
+size_t matcher_match_limit(const grep_config_t *config) {
+    if (config->report == MATCHER_REPORT_LINES || config->report == MATCHER_REPORT_COUNT) return config->max_count;
+    return config->max_count < 1 ? config->max_count : 1;
+}
+
+size_t matcher_process_buffer(const char *filename, const char *buffer, size_t length,
+                              const grep_config_t *config, matcher_state_t *state, size_t limit) {
+    match_sink_t sink = { .out = &state->output, .filename = filename, .lines = NULL, .matches = 0, .limit = limit };
+    stats_phase_t previous = stats_enter(STATS_PHASE_MATCH);
+    stats_count(STATS_BYTES, length);
+    search_buffer(buffer, length, config, state, &sink);
+    stats_leave(previous);
+    return sink.matches;
+}
+
+unsigned int matcher_collect_lines(const char *buffer, size_t length, const grep_config_t *config,
+                                   matcher_state_t *state, matcher_lines_t *lines, size_t limit) {
+    match_sink_t sink = { .out = NULL, .filename = NULL, .lines = lines, .matches = 0, .limit = limit };
+    stats_phase_t previous = stats_enter(STATS_PHASE_MATCH);
+    stats_count(STATS_BYTES, length);
+    unsigned int newlines = search_buffer(buffer, length, config, state, &sink);
+    stats_leave(previous);
+    return newlines;
+}
+
+void matcher_print_lines(const char *filename, const grep_config_t *config, const matcher_lines_t *lines,
+                         unsigned int line_offset, output_buffer_t *out) {
+    if (config->report != MATCHER_REPORT_LINES) return;
+    for (size_t i = 0; i < lines->count; i++) {
+        const matcher_line_t *line = &lines->items[i];
+        bool has_newline = line->length > 0 && line->start[line->length - 1] == '\n';
+        print_line(out, filename, config, line_offset + line->line_number, line->start, line->length, has_newline);
+    }
+}
+
+void matcher_lines_destroy(matcher_lines_t *lines) {
+    free(lines->items);
+    *lines = (matcher_lines_t){ .items = NULL, .count = 0, .capacity = 0 };
+}
+
+void matcher_report_file(const char *filename, const grep_config_t *config, size_t matches,
+                         output_buffer_t *out) {
+    const char *name = filename ? filename : "(standard input)";
+    switch (config->report) {
+        case MATCHER_REPORT_FILES_WITH_MATCHES:
+        case MATCHER_REPORT_FILES_WITHOUT_MATCH:
+            if ((matches > 0) == (config->report == MATCHER_REPORT_FILES_WITH_MATCHES)) {
+                output_write(out, name, strlen(name));
+                output_write(out, "\n", 1);
+            }
+            break;
+        case MATCHER_REPORT_COUNT:
+            if (filename) {
+                output_write(out, filename, strlen(filename));
+                output_write(out, ":", 1);
+            }
+            output_write_uint(out, (unsigned int)matches);
+            output_write(out, "\n", 1);
+            break;
+        default: break;
+    }
 }
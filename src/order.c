@@ -0,0 +1,156 @@
+#include "order.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+enum { SPILL_READ_CHUNK = 64 * 1024 };
+
+void order_init(order_t *order, size_t memory_cap) {
+    *order = (order_t){ .cursor = &order->root, .memory_cap = memory_cap, .spill = NULL };
+    pthread_mutex_init(&order->mutex, NULL);
+}
+
+order_slot_t *order_append_child(order_t *order, order_slot_t *parent) {
+    if (parent == NULL) parent = &order->root;
+    order_slot_t *slot = calloc(1, sizeof(*slot));
+    if (slot == NULL) return NULL;
+    slot->parent = parent;
+    if (parent->last_child) {
+        parent->last_child->next_sibling = slot;
+    } else {
+        parent->first_child = slot;
+    }
+    parent->last_child = slot;
+    return slot;
+}
+
+// Depth-first successor of a resolved slot. Slots left behind for good (a
+// leaf, or a directory whose last child is done) are freed on the way.
+static order_slot_t *order_advance(order_t *order, order_slot_t *slot) {
+    if (slot->first_child) return slot->first_child;
+    while (slot != &order->root) {
+        order_slot_t *parent = slot->parent;
+        order_slot_t *next = slot->next_sibling;
+        free(slot->data);
+        free(slot);
+        if (next) return next;
+        slot = parent;
+    }
+    return NULL;
+}
+
+static void emit_spilled(order_t *order, off_t offset, size_t length) {
+    char chunk[SPILL_READ_CHUNK];
+    int fd = fileno(order->spill);
+    while (length > 0) {
+        ssize_t got = pread(fd, chunk, length < sizeof(chunk) ? length : sizeof(chunk), offset);
+        if (got <= 0) return;
+        output_write_raw(chunk, (size_t)got);
+        offset += got;
+        length -= (size_t)got;
+    }
+}
+
+// Emits every resolved slot from the cursor on. Called with the mutex held;
+// the mutex is dropped while writing, with 'emitting' keeping others out.
+static void emit_ready(order_t *order) {
+    if (order->emitting) return;
+    order->emitting = true;
+    while (order->cursor && order->cursor->resolved) {
+        order_slot_t *slot = order->cursor;
+        char *data = slot->data;
+        size_t length = slot->length;
+        bool spilled = slot->spilled;
+        off_t spill_offset = slot->spill_offset;
+        slot->data = NULL;
+        order->cursor = order_advance(order, slot);
+        if (length == 0) {
+            free(data);
+            continue;
+        }
+
+        pthread_mutex_unlock(&order->mutex);
+        if (spilled) {
+            emit_spilled(order, spill_offset, length);
+        } else {
+            output_write_raw(data, length);
+            free(data);
+        }
+        pthread_mutex_lock(&order->mutex);
+        if (!spilled) order->buffered -= length;
+    }
+    order->emitting = false;
+}
+
+void order_finish(order_t *order, order_slot_t *slot, output_buffer_t *out) {
+    if (slot == NULL) slot = &order->root;
+    size_t length = out ? out->pending : 0;
+
+    pthread_mutex_lock(&order->mutex);
+    if (slot == order->cursor && !order->emitting) {
+        // Next in line: write straight from the worker's buffer.
+        if (length > 0) {
+            order->emitting = true;
+            pthread_mutex_unlock(&order->mutex);
+            output_end_file(out);
+            pthread_mutex_lock(&order->mutex);
+            order->emitting = false;
+        }
+        slot->resolved = true;
+        emit_ready(order);
+        pthread_mutex_unlock(&order->mutex);
+        return;
+    }
+    if (length == 0) {
+        slot->resolved = true;
+        pthread_mutex_unlock(&order->mutex);
+        return;
+    }
+
+    bool spill = order->buffered + length > order->memory_cap;
+    if (spill && order->spill == NULL) {
+        order->spill = tmpfile();
+        spill = order->spill != NULL; // No temporary file: hold it in memory regardless
+    }
+    off_t spill_offset = order->spill_end;
+    if (spill) {
+        order->spill_end += (off_t)length;
+    } else {
+        order->buffered += length;
+    }
+    pthread_mutex_unlock(&order->mutex);
+
+    char *data = NULL;
+    bool spilled_ok = false;
+    if (spill) {
+        spilled_ok = output_spill_to(out, fileno(order->spill), spill_offset);
+    } else {
+        data = malloc(length);
+        if (data) output_copy_to(out, data);
+    }
+    output_discard(out);
+
+    pthread_mutex_lock(&order->mutex);
+    if (spill ? !spilled_ok : data == NULL) {
+        if (!spill) order->buffered -= length;
+        length = 0; // Out of memory or disk: the output is lost
+    }
+    slot->data = data;
+    slot->length = length;
+    slot->spilled = spill;
+    slot->spill_offset = spill_offset;
+    slot->resolved = true;
+    emit_ready(order);
+    pthread_mutex_unlock(&order->mutex);
+}
+
+void order_destroy(order_t *order) {
+    // Only slots the cursor has not passed are still allocated.
+    for (order_slot_t *slot = order->cursor; slot; slot = order_advance(order, slot)) {
+    }
+    order->cursor = NULL;
+    if (order->spill) {
+        fclose(order->spill);
+        order->spill = NULL;
+    }
+    pthread_mutex_destroy(&order->mutex);
+}
@@ -1,15 +1,213 @@
-#include "raii.h"
-#include <stdio.h>
+#include "output.h"
+#include "stats.h"
+#include <errno.h>
 #include <pthread.h>
-#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 static pthread_mutex_t g_output_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-void output_printf(const char *fmt, ...) {
-    va_list args;
-    va_start(args, fmt);
+enum {
+    OUTPUT_COPY_MAX = 256,           // Pieces shorter than this are copied rather than referenced
+    OUTPUT_FLUSH_BYTES = 1024 * 1024, // Flush a file early once this much is buffered
+    OUTPUT_MAX_SEGMENTS = 8192,
+    OUTPUT_IOV_BATCH = 1024,          // Linux's IOV_MAX
+};
+
+void output_buffer_init(output_buffer_t *out) {
+    *out = (output_buffer_t){ .segments = NULL, .scratch = NULL, .holds_lock = false, .capture = false, .copy = false };
+}
+
+static void write_all(struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t written = writev(STDOUT_FILENO, iov, count);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return; // Nowhere to report a failing stdout; drop the output
+        }
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= (size_t)written;
+        }
+    }
+}
+
+static const char *segment_data(const output_buffer_t *out, const output_segment_t *segment) {
+    return segment->base ? segment->base : out->scratch + segment->offset;
+}
+
+// Writes out all buffered segments, leaving the output lock held.
+static void flush_segments(output_buffer_t *out) {
+    stats_phase_t previous = stats_enter(STATS_PHASE_OUTPUT_LOCK);
+    if (!out->holds_lock) {
+        pthread_mutex_lock(&g_output_mutex);
+        out->holds_lock = true;
+    }
+    stats_enter(STATS_PHASE_OUTPUT);
+
+    struct iovec iov[OUTPUT_IOV_BATCH];
+    int count = 0;
+    for (size_t i = 0; i < out->segment_count; i++) {
+        const output_segment_t *segment = &out->segments[i];
+        iov[count++] = (struct iovec){ .iov_base = (void *)segment_data(out, segment), .iov_len = segment->length };
+        if (count == OUTPUT_IOV_BATCH) {
+            write_all(iov, count);
+            count = 0;
+        }
+    }
+    write_all(iov, count);
+    stats_leave(previous);
+
+    out->segment_count = 0;
+    out->scratch_used = 0;
+    out->pending = 0;
+}
+
+static bool reserve_segment(output_buffer_t *out) {
+    if (out->segment_count < out->segment_capacity) return true;
+    size_t capacity = out->segment_capacity ? out->segment_capacity * 2 : 64;
+    output_segment_t *segments = realloc(out->segments, capacity * sizeof(*segments));
+    if (segments == NULL) return false;
+    out->segments = segments;
+    out->segment_capacity = capacity;
+    return true;
+}
+
+static bool reserve_scratch(output_buffer_t *out, size_t length) {
+    if (out->scratch_capacity - out->scratch_used >= length) return true;
+    size_t capacity = out->scratch_capacity ? out->scratch_capacity : 4096;
+    while (capacity - out->scratch_used < length) capacity *= 2;
+    char *scratch = realloc(out->scratch, capacity);
+    if (scratch == NULL) return false;
+    out->scratch = scratch;
+    out->scratch_capacity = capacity;
+    return true;
+}
+
+// Bytes that cannot be buffered go straight out behind whatever was buffered.
+static void write_through(output_buffer_t *out, const char *data, size_t length) {
+    flush_segments(out);
+    struct iovec iov = { .iov_base = (void *)data, .iov_len = length };
+    write_all(&iov, 1);
+}
+
+static void append(output_buffer_t *out, const char *data, size_t length, bool copy) {
+    if (length == 0) return;
+    if (!out->capture && (out->pending >= OUTPUT_FLUSH_BYTES || out->segment_count >= OUTPUT_MAX_SEGMENTS)) {
+        flush_segments(out);
+    }
+
+    if (copy) {
+        output_segment_t *last = out->segment_count ? &out->segments[out->segment_count - 1] : NULL;
+        if (!reserve_scratch(out, length)) {
+            write_through(out, data, length);
+            return;
+        }
+        memcpy(out->scratch + out->scratch_used, data, length);
+        out->pending += length;
+        // Consecutive copies share one segment, so a short line costs one iovec or less.
+        if (last && last->base == NULL && last->offset + last->length == out->scratch_used) {
+            last->length += length;
+            out->scratch_used += length;
+            return;
+        }
+        if (!reserve_segment(out)) {
+            out->pending -= length;
+            write_through(out, data, length);
+            return;
+        }
+        out->segments[out->segment_count++] = (output_segment_t){ .base = NULL, .offset = out->scratch_used, .length = length };
+        out->scratch_used += length;
+        return;
+    }
+
+    if (!reserve_segment(out)) {
+        write_through(out, data, length);
+        return;
+    }
+    out->segments[out->segment_count++] = (output_segment_t){ .base = data, .offset = 0, .length = length };
+    out->pending += length;
+}
+
+void output_write(output_buffer_t *out, const char *data, size_t length) {
+    append(out, data, length, true);
+}
+
+void output_write_ref(output_buffer_t *out, const char *data, size_t length) {
+    append(out, data, length, out->capture || out->copy || length < OUTPUT_COPY_MAX);
+}
+
+void output_write_uint(output_buffer_t *out, unsigned int value) {
+    char digits[16];
+    char *pos = digits + sizeof(digits);
+    do {
+        *--pos = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    output_write(out, pos, (size_t)(digits + sizeof(digits) - pos));
+}
+
+void output_end_file(output_buffer_t *out) {
+    if (out->segment_count > 0) flush_segments(out);
+    if (out->holds_lock) {
+        pthread_mutex_unlock(&g_output_mutex);
+        out->holds_lock = false;
+    }
+}
+
+void output_yield(output_buffer_t *out) {
+    if (out->holds_lock) output_end_file(out);
+}
+
+void output_copy_to(const output_buffer_t *out, char *dest) {
+    for (size_t i = 0; i < out->segment_count; i++) {
+        memcpy(dest, segment_data(out, &out->segments[i]), out->segments[i].length);
+        dest += out->segments[i].length;
+    }
+}
+
+bool output_spill_to(const output_buffer_t *out, int fd, off_t offset) {
+    for (size_t i = 0; i < out->segment_count; i++) {
+        const char *data = segment_data(out, &out->segments[i]);
+        size_t length = out->segments[i].length;
+        while (length > 0) {
+            ssize_t written = pwrite(fd, data, length, offset);
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) return false;
+            data += written;
+            length -= (size_t)written;
+            offset += written;
+        }
+    }
+    return true;
+}
+
+void output_discard(output_buffer_t *out) {
+    out->segment_count = 0;
+    out->scratch_used = 0;
+    out->pending = 0;
+}
+
+void output_write_raw(const char *data, size_t length) {
+    struct iovec iov = { .iov_base = (void *)data, .iov_len = length };
+    stats_phase_t previous = stats_enter(STATS_PHASE_OUTPUT_LOCK);
     pthread_mutex_lock(&g_output_mutex);
-    vprintf(fmt, args);
+    stats_enter(STATS_PHASE_OUTPUT);
+    write_all(&iov, 1);
     pthread_mutex_unlock(&g_output_mutex);
-    va_end(args);
+    stats_leave(previous);
+}
+
+void output_buffer_destroy(output_buffer_t *out) {
+    output_end_file(out);
+    free(out->segments);
+    free(out->scratch);
+    *out = (output_buffer_t){ .segments = NULL, .scratch = NULL, .holds_lock = false, .capture = false, .copy = false };
 }
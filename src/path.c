@@ -0,0 +1,131 @@
+#include "path.h"
+#include "ignore.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static atomic_int held_dirs;
+
+static path_chunk_t *path_chunk_of(const path_node_t *node) {
+    return (path_chunk_t *)((uintptr_t)node & ~((uintptr_t)PATH_CHUNK_SIZE - 1));
+}
+
+static void path_chunk_put(path_chunk_t *chunk) {
+    if (atomic_fetch_sub(&chunk->live, 1) == 1) {
+        free(chunk);
+    }
+}
+
+static path_chunk_t *path_chunk_create(void) {
+    path_chunk_t *chunk = aligned_alloc(PATH_CHUNK_SIZE, PATH_CHUNK_SIZE);
+    if (!chunk) return NULL;
+    atomic_init(&chunk->live, 1); // The owning arena's bias
+    chunk->used = 0;
+    return chunk;
+}
+
+static void *path_arena_alloc(path_arena_t *arena, size_t size) {
+    static const size_t capacity = PATH_CHUNK_SIZE - offsetof(path_chunk_t, data);
+    size = (size + alignof(path_node_t) - 1) & ~(alignof(path_node_t) - 1);
+    if (size > capacity) return NULL;
+
+    path_chunk_t *chunk = arena->current;
+    if (!chunk || chunk->used + size > capacity) {
+        path_chunk_t *fresh = path_chunk_create();
+        if (!fresh) return NULL;
+        if (chunk) path_chunk_put(chunk);
+        arena->current = chunk = fresh;
+    }
+
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    atomic_fetch_add(&chunk->live, 1);
+    return ptr;
+}
+
+path_node_t *path_node_create(path_arena_t *arena, path_node_t *parent, const char *name) {
+    size_t name_len = strlen(name);
+    if (name_len > UINT16_MAX) return NULL;
+
+    path_node_t *node = path_arena_alloc(arena, sizeof(path_node_t) + name_len + 1);
+    if (!node) return NULL;
+
+    node->parent = parent ? path_node_retain(parent) : NULL;
+    node->order_slot = NULL;
+    node->chunk = NULL;
+    node->ignore = NULL;
+    atomic_init(&node->refs, 1);
+    node->dir_fd = -1;
+    node->name_len = (uint16_t)name_len;
+    node->type = DT_UNKNOWN;
+    node->work_class = 0;
+    memcpy(node->name, name, name_len + 1);
+    return node;
+}
+
+path_node_t *path_node_retain(path_node_t *node) {
+    atomic_fetch_add_explicit(&node->refs, 1, memory_order_relaxed);
+    return node;
+}
+
+void path_node_release(path_node_t *node) {
+    while (node && atomic_fetch_sub_explicit(&node->refs, 1, memory_order_acq_rel) == 1) {
+        path_node_t *parent = node->parent;
+        if (node->dir_fd >= 0) {
+            close(node->dir_fd);
+            atomic_fetch_sub_explicit(&held_dirs, 1, memory_order_relaxed);
+        }
+        ignore_rules_release(node->ignore);
+        path_chunk_put(path_chunk_of(node));
+        node = parent;
+    }
+}
+
+bool path_node_hold_dir(path_node_t *node, int fd) {
+    if (atomic_fetch_add_explicit(&held_dirs, 1, memory_order_relaxed) >= PATH_HELD_DIR_LIMIT) {
+        atomic_fetch_sub_explicit(&held_dirs, 1, memory_order_relaxed);
+        return false;
+    }
+    node->dir_fd = fd;
+    return true;
+}
+
+int path_node_open(const path_node_t *node, const char *path, int flags) {
+    if (node->parent && node->parent->dir_fd >= 0) {
+        return openat(node->parent->dir_fd, node->name, flags | O_CLOEXEC);
+    }
+    return open(path, flags | O_CLOEXEC);
+}
+
+int path_node_lstat(const path_node_t *node, const char *path, struct stat *st) {
+    if (node->parent && node->parent->dir_fd >= 0) {
+        return fstatat(node->parent->dir_fd, node->name, st, AT_SYMLINK_NOFOLLOW);
+    }
+    return lstat(path, st);
+}
+
+size_t path_node_format(const path_node_t *node, char *buffer, size_t size) {
+    size_t length = 0;
+    for (const path_node_t *iter = node; iter; iter = iter->parent) {
+        length += iter->name_len + (iter->parent ? 1 : 0);
+    }
+    if (length == 0 || length >= size) return 0;
+
+    size_t pos = length;
+    buffer[pos] = '\0';
+    for (const path_node_t *iter = node; iter; iter = iter->parent) {
+        pos -= iter->name_len;
+        memcpy(buffer + pos, iter->name, iter->name_len);
+        if (iter->parent) buffer[--pos] = '/';
+    }
+    return length;
+}
+
+void path_arena_destroy(path_arena_t *arena) {
+    if (arena->current) {
+        path_chunk_put(arena->current);
+        arena->current = NULL;
+    }
+}
@@ -0,0 +1,101 @@
+#include "scaler.h"
+#include <time.h>
+
+enum { SCALER_TICK_MS = 20 };
+
+// Below this share of the usable CPUs, with no worker out of work, the workers are taken to be blocked.
+static const double SCALER_BLOCKED_SHARE = 0.5;
+// At or above this share, the CPUs are saturated and extra threads only add switching.
+static const double SCALER_BUSY_SHARE = 0.9;
+
+static double clock_seconds(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static size_t next_count(const worker_scaler_t *scaler, size_t active, double cpus_used) {
+    size_t running = active < scaler->cpus ? active : scaler->cpus;
+    bool starved = atomic_load(&scaler->queue->sleepers) > 0;
+    if (!starved && cpus_used < SCALER_BLOCKED_SHARE * (double)running && active < scaler->max_workers) {
+        // Grow by half, so a tree on a slow network filesystem gets deep queues within a few ticks.
+        size_t step = active / 2 > 0 ? active / 2 : 1;
+        return active + step < scaler->max_workers ? active + step : scaler->max_workers;
+    }
+    if (cpus_used >= SCALER_BUSY_SHARE * (double)scaler->cpus && active > scaler->min_workers) {
+        size_t step = (active - scaler->min_workers + 1) / 2;
+        return active - step;
+    }
+    return active;
+}
+
+static void *scaler_thread(void *arg) {
+    worker_scaler_t *scaler = arg;
+    double wall = clock_seconds(CLOCK_MONOTONIC);
+    double cpu = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+
+    pthread_mutex_lock(&scaler->mutex);
+    while (!scaler->stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += SCALER_TICK_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&scaler->cond, &scaler->mutex, &deadline);
+        if (scaler->stop || atomic_load(&scaler->queue->done)) break;
+
+        double wall_now = clock_seconds(CLOCK_MONOTONIC);
+        double cpu_now = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+        if (wall_now - wall < SCALER_TICK_MS / 2000.0) continue; // Woken early: too short to judge
+        double cpus_used = (cpu_now - cpu) / (wall_now - wall);
+        wall = wall_now;
+        cpu = cpu_now;
+
+        size_t active = work_queue_active_workers(scaler->queue);
+        size_t count = next_count(scaler, active, cpus_used);
+        if (count == active) continue;
+        work_queue_set_active_workers(scaler->queue, count);
+        if (count > scaler->peak) scaler->peak = count;
+    }
+    pthread_mutex_unlock(&scaler->mutex);
+    return NULL;
+}
+
+bool worker_scaler_start(worker_scaler_t *scaler, work_queue_t *queue, size_t cpus, size_t min_workers,
+                         size_t max_workers) {
+    scaler->queue = queue;
+    scaler->cpus = cpus;
+    scaler->min_workers = min_workers;
+    scaler->max_workers = max_workers;
+    scaler->peak = min_workers;
+    scaler->stop = false;
+    work_queue_set_active_workers(queue, min_workers);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&scaler->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&scaler->mutex, NULL);
+    if (pthread_create(&scaler->thread, NULL, scaler_thread, scaler) != 0) {
+        pthread_cond_destroy(&scaler->cond);
+        pthread_mutex_destroy(&scaler->mutex);
+        scaler->queue = NULL;
+        return false;
+    }
+    return true;
+}
+
+void worker_scaler_stop(worker_scaler_t *scaler) {
+    if (scaler->queue == NULL) return;
+    pthread_mutex_lock(&scaler->mutex);
+    scaler->stop = true;
+    pthread_cond_signal(&scaler->cond);
+    pthread_mutex_unlock(&scaler->mutex);
+    pthread_join(scaler->thread, NULL);
+    pthread_cond_destroy(&scaler->cond);
+    pthread_mutex_destroy(&scaler->mutex);
+    scaler->queue = NULL;
+}
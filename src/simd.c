@@ -0,0 +1,177 @@
+#include "simd.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_HAVE_X86 1
+#endif
+
+typedef const char *(*find_byte_fn)(const char *buffer, size_t length, char byte);
+typedef size_t (*count_byte_fn)(const char *buffer, size_t length, char byte);
+
+static const char *find_byte_scalar(const char *buffer, size_t length, char byte) {
+    return memchr(buffer, byte, length);
+}
+
+static const char *rfind_byte_scalar(const char *buffer, size_t length, char byte) {
+    while (length > 0) {
+        length--;
+        if (buffer[length] == byte) return buffer + length;
+    }
+    return NULL;
+}
+
+static size_t count_byte_scalar(const char *buffer, size_t length, char byte) {
+    size_t count = 0;
+    for (size_t i = 0; i < length; i++) {
+        count += buffer[i] == byte;
+    }
+    return count;
+}
+
+#ifdef SIMD_HAVE_X86
+
+/*
+ * Counting keeps one 8-bit counter per lane: each compare yields -1 for a
+ * match, which is subtracted from the counter. After at most 255 blocks the
+ * lanes are summed with PSADBW before they can overflow.
+ */
+enum { COUNT_BLOCKS_PER_FLUSH = 255 };
+
+static const char *find_byte_sse2(const char *buffer, size_t length, char byte) {
+    const __m128i needle = _mm_set1_epi8(byte);
+    size_t pos = 0;
+    for (; pos + 16 <= length; pos += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(buffer + pos));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+        if (mask != 0) return buffer + pos + (size_t)__builtin_ctz(mask);
+    }
+    return find_byte_scalar(buffer + pos, length - pos, byte);
+}
+
+static const char *rfind_byte_sse2(const char *buffer, size_t length, char byte) {
+    const __m128i needle = _mm_set1_epi8(byte);
+    size_t end = length;
+    for (; end >= 16; end -= 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(buffer + end - 16));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+        if (mask != 0) return buffer + end - 16 + (size_t)(31 - __builtin_clz(mask));
+    }
+    return rfind_byte_scalar(buffer, end, byte);
+}
+
+static size_t count_byte_sse2(const char *buffer, size_t length, char byte) {
+    const __m128i needle = _mm_set1_epi8(byte);
+    const __m128i zero = _mm_setzero_si128();
+    size_t count = 0;
+    size_t pos = 0;
+    while (length - pos >= 16) {
+        size_t blocks = (length - pos) / 16;
+        if (blocks > COUNT_BLOCKS_PER_FLUSH) blocks = COUNT_BLOCKS_PER_FLUSH;
+        __m128i lanes = zero;
+        for (size_t i = 0; i < blocks; i++, pos += 16) {
+            __m128i block = _mm_loadu_si128((const __m128i *)(buffer + pos));
+            lanes = _mm_sub_epi8(lanes, _mm_cmpeq_epi8(block, needle));
+        }
+        __m128i sums = _mm_sad_epu8(lanes, zero);
+        count += (size_t)_mm_cvtsi128_si32(sums) + (size_t)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+    }
+    return count + count_byte_scalar(buffer + pos, length - pos, byte);
+}
+
+[[gnu::target("avx2")]]
+static const char *find_byte_avx2(const char *buffer, size_t length, char byte) {
+    const __m256i needle = _mm256_set1_epi8(byte);
+    size_t pos = 0;
+    // Two vectors per iteration keep the loads ahead of the branch.
+    for (; pos + 64 <= length; pos += 64) {
+        __m256i eq_lo = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buffer + pos)), needle);
+        __m256i eq_hi = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buffer + pos + 32)), needle);
+        if (_mm256_testz_si256(_mm256_or_si256(eq_lo, eq_hi), _mm256_or_si256(eq_lo, eq_hi))) continue;
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(eq_lo);
+        if (mask != 0) return buffer + pos + (size_t)__builtin_ctz(mask);
+        mask = (uint32_t)_mm256_movemask_epi8(eq_hi);
+        return buffer + pos + 32 + (size_t)__builtin_ctz(mask);
+    }
+    for (; pos + 32 <= length; pos += 32) {
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buffer + pos)), needle));
+        if (mask != 0) return buffer + pos + (size_t)__builtin_ctz(mask);
+    }
+    return find_byte_sse2(buffer + pos, length - pos, byte);
+}
+
+[[gnu::target("avx2")]]
+static const char *rfind_byte_avx2(const char *buffer, size_t length, char byte) {
+    const __m256i needle = _mm256_set1_epi8(byte);
+    size_t end = length;
+    for (; end >= 32; end -= 32) {
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buffer + end - 32)), needle));
+        if (mask != 0) return buffer + end - 32 + (size_t)(31 - __builtin_clz(mask));
+    }
+    return rfind_byte_sse2(buffer, end, byte);
+}
+
+[[gnu::target("avx2")]]
+static size_t count_byte_avx2(const char *buffer, size_t length, char byte) {
+    const __m256i needle = _mm256_set1_epi8(byte);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t count = 0;
+    size_t pos = 0;
+    while (length - pos >= 32) {
+        size_t blocks = (length - pos) / 32;
+        if (blocks > COUNT_BLOCKS_PER_FLUSH) blocks = COUNT_BLOCKS_PER_FLUSH;
+        __m256i lanes = zero;
+        for (size_t i = 0; i < blocks; i++, pos += 32) {
+            __m256i block = _mm256_loadu_si256((const __m256i *)(buffer + pos));
+            lanes = _mm256_sub_epi8(lanes, _mm256_cmpeq_epi8(block, needle));
+        }
+        __m256i sums = _mm256_sad_epu8(lanes, zero);
+        count += (size_t)_mm256_extract_epi64(sums, 0) + (size_t)_mm256_extract_epi64(sums, 1) +
+                 (size_t)_mm256_extract_epi64(sums, 2) + (size_t)_mm256_extract_epi64(sums, 3);
+    }
+    return count + count_byte_sse2(buffer + pos, length - pos, byte);
+}
+
+#endif // SIMD_HAVE_X86
+
+static simd_level_t level = SIMD_LEVEL_SCALAR;
+static find_byte_fn find_byte_impl = find_byte_scalar;
+static find_byte_fn rfind_byte_impl = rfind_byte_scalar;
+static count_byte_fn count_byte_impl = count_byte_scalar;
+
+// Runs before main(), so the pointers never change once threads exist.
+[[gnu::constructor]]
+static void simd_select_kernels(void) {
+#ifdef SIMD_HAVE_X86
+    __builtin_cpu_init();
+    level = __builtin_cpu_supports("avx2") ? SIMD_LEVEL_AVX2 : SIMD_LEVEL_SSE2;
+    if (level == SIMD_LEVEL_AVX2) {
+        find_byte_impl = find_byte_avx2;
+        rfind_byte_impl = rfind_byte_avx2;
+        count_byte_impl = count_byte_avx2;
+    } else {
+        find_byte_impl = find_byte_sse2;
+        rfind_byte_impl = rfind_byte_sse2;
+        count_byte_impl = count_byte_sse2;
+    }
+#endif
+}
+
+simd_level_t simd_level(void) {
+    return level;
+}
+
+const char *simd_find_byte(const char *buffer, size_t length, char byte) {
+    return find_byte_impl(buffer, length, byte);
+}
+
+const char *simd_rfind_byte(const char *buffer, size_t length, char byte) {
+    return rfind_byte_impl(buffer, length, byte);
+}
+
+size_t simd_count_byte(const char *buffer, size_t length, char byte) {
+    return count_byte_impl(buffer, length, byte);
+}
@@ -0,0 +1,195 @@
+#include "stats.h"
+#include "io.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+_Thread_local stats_thread_t *stats_current = NULL;
+
+static const char *const COUNTER_NAMES[STATS_COUNTER_COUNT] = {
+    "files", "dirs", "bytes", "matches", "binary_skipped", "filtered", "index_skipped", "queue_lock_contended",
+};
+
+static const char *const PHASE_NAMES[STATS_PHASE_COUNT] = {
+    "other", "discovery", "io", "match", "output", "output_lock", "queue_lock", "queue_wait", "idle",
+};
+
+// Narrower headings for the text table.
+static const char *const PHASE_HEADINGS[STATS_PHASE_COUNT] = {
+    "other", "discovery", "io", "match", "output", "out-lock", "q-lock", "q-wait", "idle",
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec;
+}
+
+bool stats_init(stats_t *stats, size_t capacity) {
+    stats->capacity = capacity;
+    atomic_init(&stats->count, 0);
+    stats->start = now_ns();
+    memset(&stats->adaptive, 0, sizeof(stats->adaptive));
+    stats->threads = aligned_alloc(alignof(stats_thread_t), capacity * sizeof(stats_thread_t));
+    if (stats->threads == NULL) return false;
+    memset(stats->threads, 0, capacity * sizeof(stats_thread_t));
+    return true;
+}
+
+void stats_destroy(stats_t *stats) {
+    free(stats->threads);
+    stats->threads = NULL;
+}
+
+void stats_thread_begin(stats_t *stats, const char *role) {
+    size_t index = atomic_fetch_add(&stats->count, 1);
+    if (stats->threads == NULL || index >= stats->capacity) return;
+    stats_thread_t *thread = &stats->threads[index];
+    thread->role = role;
+    thread->phase = STATS_PHASE_OTHER;
+    thread->start = thread->since = now_ns();
+    stats_current = thread;
+}
+
+void stats_thread_end(void) {
+    stats_thread_t *thread = stats_current;
+    if (thread == NULL) return;
+    stats_switch(thread, STATS_PHASE_OTHER);
+    thread->end = thread->since;
+    stats_current = NULL;
+}
+
+stats_phase_t stats_switch(stats_thread_t *thread, stats_phase_t phase) {
+    uint64_t now = now_ns();
+    stats_phase_t previous = thread->phase;
+    thread->ns[previous] += now - thread->since;
+    thread->phase = phase;
+    thread->since = now;
+    return previous;
+}
+
+static double seconds(uint64_t ns) {
+    return (double)ns / 1e9;
+}
+
+static uint64_t lifetime(const stats_thread_t *thread) {
+    return thread->end > thread->start ? thread->end - thread->start : 0;
+}
+
+// Share of the thread's lifetime spent on work rather than waiting for it.
+static double busy_share(const stats_thread_t *thread) {
+    uint64_t total = lifetime(thread);
+    uint64_t waiting = thread->ns[STATS_PHASE_IDLE] + thread->ns[STATS_PHASE_QUEUE_WAIT] +
+                       thread->ns[STATS_PHASE_QUEUE_LOCK];
+    return total > 0 ? 1.0 - (double)waiting / (double)total : 0.0;
+}
+
+static void label(const stats_t *stats, size_t count, size_t index, char *buffer, size_t size) {
+    const char *role = stats->threads[index].role;
+    size_t number = 0;
+    size_t same = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(stats->threads[i].role, role) != 0) continue;
+        if (i < index) number++;
+        same++;
+    }
+    if (same > 1) {
+        snprintf(buffer, size, "%s %zu", role, number);
+    } else {
+        snprintf(buffer, size, "%s", role);
+    }
+}
+
+static void print_json_record(const stats_thread_t *thread) {
+    for (int i = 0; i < STATS_COUNTER_COUNT; i++) {
+        fprintf(stderr, "\"%s\": %llu, ", COUNTER_NAMES[i], (unsigned long long)thread->counters[i]);
+    }
+    fprintf(stderr, "\"time_s\": {");
+    for (int i = 0; i < STATS_PHASE_COUNT; i++) {
+        fprintf(stderr, "%s\"%s\": %.6f", i ? ", " : "", PHASE_NAMES[i], seconds(thread->ns[i]));
+    }
+    fprintf(stderr, "}");
+}
+
+static void print_json(const stats_t *stats, size_t count, const stats_thread_t *total, uint64_t wall) {
+    fprintf(stderr, "{\"wall_s\": %.6f, \"threads\": %zu, \"total\": {", seconds(wall), count);
+    print_json_record(total);
+    fprintf(stderr, "}, \"io\": {\"files_read\": %zu, \"bytes_read\": %zu, \"files_mapped\": %zu, "
+                    "\"bytes_mapped\": %zu, \"files_populated\": %zu}, ",
+            atomic_load(&io_stats.files_read), atomic_load(&io_stats.bytes_read), atomic_load(&io_stats.files_mapped),
+            atomic_load(&io_stats.bytes_mapped), atomic_load(&io_stats.files_populated));
+    if (stats->adaptive.peak > 0) {
+        fprintf(stderr, "\"adaptive_workers\": {\"start\": %zu, \"peak\": %zu, \"end\": %zu}, ", stats->adaptive.start,
+                stats->adaptive.peak, stats->adaptive.end);
+    }
+    fprintf(stderr, "\"per_thread\": [");
+    for (size_t i = 0; i < count; i++) {
+        const stats_thread_t *thread = &stats->threads[i];
+        char name[32];
+        label(stats, count, i, name, sizeof(name));
+        fprintf(stderr, "%s{\"name\": \"%s\", \"lifetime_s\": %.6f, \"busy\": %.4f, ", i ? ", " : "", name,
+                seconds(lifetime(thread)), busy_share(thread));
+        print_json_record(thread);
+        fprintf(stderr, "}");
+    }
+    fprintf(stderr, "]}\n");
+}
+
+static void print_row(const char *name, const stats_thread_t *thread, bool busy) {
+    fprintf(stderr, "  %-10s %8llu %10.1f", name, (unsigned long long)thread->counters[STATS_FILES],
+            (double)thread->counters[STATS_BYTES] / 1e6);
+    for (int i = 1; i < STATS_PHASE_COUNT; i++) fprintf(stderr, " %9.3f", seconds(thread->ns[i]));
+    fprintf(stderr, " %9.3f", seconds(thread->ns[STATS_PHASE_OTHER]));
+    if (busy) fprintf(stderr, " %5.1f%%", busy_share(thread) * 100);
+    fprintf(stderr, "\n");
+}
+
+static void print_text(const stats_t *stats, size_t count, const stats_thread_t *total, uint64_t wall) {
+    const uint64_t *c = total->counters;
+    fprintf(stderr, "--- stats: %.3f s wall, %zu threads ---\n", seconds(wall), count);
+    fprintf(stderr, "  %llu files searched, %llu directories listed\n", (unsigned long long)c[STATS_FILES],
+            (unsigned long long)c[STATS_DIRS]);
+    fprintf(stderr, "  skipped: %llu binary, %llu filtered, %llu ruled out by the index\n",
+            (unsigned long long)c[STATS_BINARY_SKIPS], (unsigned long long)c[STATS_FILTERED],
+            (unsigned long long)c[STATS_INDEX_SKIPS]);
+    fprintf(stderr, "  %.1f MB scanned (%.3f GB/s), %llu matching lines, %llu contended queue locks\n",
+            (double)c[STATS_BYTES] / 1e6, wall > 0 ? (double)c[STATS_BYTES] / (double)wall : 0.0,
+            (unsigned long long)c[STATS_MATCHES], (unsigned long long)c[STATS_QUEUE_CONTENDED]);
+    fprintf(stderr, "  io: %zu files read (%.1f MB), %zu mapped (%.1f MB), %zu of them populated up front\n",
+            atomic_load(&io_stats.files_read), (double)atomic_load(&io_stats.bytes_read) / 1e6,
+            atomic_load(&io_stats.files_mapped), (double)atomic_load(&io_stats.bytes_mapped) / 1e6,
+            atomic_load(&io_stats.files_populated));
+    if (stats->adaptive.peak > 0) {
+        fprintf(stderr, "  adaptive workers: %zu at the start, %zu at the peak, %zu at the end\n", stats->adaptive.start,
+                stats->adaptive.peak, stats->adaptive.end);
+    }
+    fprintf(stderr, "  times in seconds:\n  %-10s %8s %10s", "thread", "files", "MB");
+    for (int i = 1; i < STATS_PHASE_COUNT; i++) fprintf(stderr, " %9s", PHASE_HEADINGS[i]);
+    fprintf(stderr, " %9s %6s\n", PHASE_HEADINGS[STATS_PHASE_OTHER], "busy");
+    for (size_t i = 0; i < count; i++) {
+        char name[32];
+        label(stats, count, i, name, sizeof(name));
+        print_row(name, &stats->threads[i], true);
+    }
+    print_row("total", total, false);
+}
+
+void stats_print(const stats_t *stats, bool json) {
+    if (stats->threads == NULL) return;
+    uint64_t wall = now_ns() - stats->start;
+    size_t count = atomic_load(&stats->count);
+    if (count > stats->capacity) count = stats->capacity;
+
+    stats_thread_t total;
+    memset(&total, 0, sizeof(total));
+    for (size_t i = 0; i < count; i++) {
+        for (int j = 0; j < STATS_COUNTER_COUNT; j++) total.counters[j] += stats->threads[i].counters[j];
+        for (int j = 0; j < STATS_PHASE_COUNT; j++) total.ns[j] += stats->threads[i].ns[j];
+    }
+    if (json) {
+        print_json(stats, count, &total, wall);
+    } else {
+        print_text(stats, count, &total, wall);
+    }
+}
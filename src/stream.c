@@ -0,0 +1,214 @@
+#define _GNU_SOURCE // pipe2
+#include "stream.h"
+#include "discovery.h"
+#include "output.h"
+#include "simd.h"
+#include "stats.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+    char *data;
+    size_t capacity;
+    size_t length; // Bytes to search: whole lines, or everything left at the end of the input
+    bool full; // Guarded by stream->mutex: read and waiting to be searched
+    bool last; // Nothing follows this block
+} stream_block_t;
+
+typedef struct {
+    int fd;
+    stream_block_t blocks[2];
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool stopped; // Guarded by 'mutex': the searcher needs no more input
+    int wake[2]; // Written by stop_stream() to wake a reader waiting for input
+    int error; // errno of a failed read, set before the last block is handed over
+} stream_t;
+
+static bool grow_block(stream_block_t *block, size_t minimum) {
+    if (block->capacity >= minimum) return true;
+    size_t capacity = block->capacity;
+    while (capacity < minimum) capacity *= 2;
+    char *data = realloc(block->data, capacity);
+    if (data == NULL) return false;
+    block->data = data;
+    block->capacity = capacity;
+    return true;
+}
+
+static bool input_ready(int fd) {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+    return poll(&pfd, 1, 0) > 0;
+}
+
+// Blocks until the input is readable; returns false if the stream was stopped meanwhile.
+static bool wait_for_input(stream_t *stream) {
+    struct pollfd fds[2] = {
+        { .fd = stream->fd, .events = POLLIN, .revents = 0 },
+        { .fd = stream->wake[0], .events = POLLIN, .revents = 0 }, // Ignored by poll() if -1
+    };
+    while (poll(fds, 2, -1) < 0) {
+        if (errno != EINTR) return true; // Let read() block, or report the error
+    }
+    return fds[1].revents == 0;
+}
+
+static void stop_stream(stream_t *stream) {
+    pthread_mutex_lock(&stream->mutex);
+    stream->stopped = true;
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->mutex);
+    if (stream->wake[1] >= 0) {
+        ssize_t written;
+        do written = write(stream->wake[1], "", 1); while (written < 0 && errno == EINTR);
+    }
+}
+
+// Reads after the 'filled' bytes already in the block until it ends with at
+// least one whole line and is either full or has drained the input for now.
+// Returns the end of the block's last line; *eof is set at the end of the input.
+static size_t fill_block(stream_t *stream, stream_block_t *block, size_t *filled, bool *eof) {
+    const char *newline = simd_rfind_byte(block->data, *filled, '\n');
+    size_t lines_end = newline ? (size_t)(newline - block->data) + 1 : 0;
+    while (true) {
+        // A line longer than the block: make room for the rest of it.
+        if (*filled == block->capacity && !grow_block(block, block->capacity + 1)) {
+            stream->error = ENOMEM;
+            break;
+        }
+        if (!wait_for_input(stream)) break;
+        ssize_t n = read(stream->fd, block->data + *filled, block->capacity - *filled);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n < 0) stream->error = errno;
+            break;
+        }
+        newline = simd_rfind_byte(block->data + *filled, (size_t)n, '\n');
+        *filled += (size_t)n;
+        if (newline) lines_end = (size_t)(newline - block->data) + 1;
+        if (lines_end > 0 && (*filled == block->capacity || !input_ready(stream->fd))) return lines_end;
+    }
+    *eof = true;
+    return *filled;
+}
+
+static void *stream_reader(void *arg) {
+    stream_t *stream = arg;
+    const char *carry = NULL; // The partial line ending the previous block
+    size_t carry_length = 0;
+    for (size_t i = 0;; i ^= 1) {
+        stream_block_t *block = &stream->blocks[i];
+        pthread_mutex_lock(&stream->mutex);
+        while (block->full && !stream->stopped) pthread_cond_wait(&stream->cond, &stream->mutex);
+        bool stopped = stream->stopped;
+        pthread_mutex_unlock(&stream->mutex);
+        if (stopped) return NULL;
+
+        // The previous block is only being searched, so its tail can be read meanwhile.
+        bool eof = false;
+        size_t filled = 0;
+        if (grow_block(block, carry_length + (STREAM_BLOCK_SIZE / 2))) {
+            memcpy(block->data, carry, carry_length);
+            filled = carry_length;
+            block->length = fill_block(stream, block, &filled, &eof);
+        } else {
+            stream->error = ENOMEM;
+            block->length = 0;
+            eof = true;
+        }
+        carry = block->data + block->length;
+        carry_length = filled - block->length;
+
+        pthread_mutex_lock(&stream->mutex);
+        block->last = eof;
+        block->full = true;
+        pthread_cond_broadcast(&stream->cond);
+        pthread_mutex_unlock(&stream->mutex);
+        if (eof) return NULL;
+    }
+}
+
+bool stream_search(int fd, const char *label, const grep_config_t *config, bool ignore_binary, size_t *matches) {
+    stream_t stream = { .fd = fd, .stopped = false, .wake = { -1, -1 }, .error = 0 };
+    if (pipe2(stream.wake, O_CLOEXEC | O_NONBLOCK) != 0) stream.wake[0] = stream.wake[1] = -1;
+    for (size_t i = 0; i < 2; i++) {
+        stream.blocks[i] = (stream_block_t){
+            .data = malloc(STREAM_BLOCK_SIZE), .capacity = STREAM_BLOCK_SIZE, .length = 0, .full = false, .last = false
+        };
+    }
+    pthread_mutex_init(&stream.mutex, NULL);
+    pthread_cond_init(&stream.cond, NULL);
+
+    auto_matcher_state matcher_state_t matcher_state;
+    bool initialized = matcher_state_init(&matcher_state, config);
+    pthread_t reader;
+    bool started = initialized && stream.blocks[0].data != NULL && stream.blocks[1].data != NULL &&
+                   pthread_create(&reader, NULL, stream_reader, &stream) == 0;
+    if (!started) {
+        fprintf(stderr, "Error: Cannot start reading '%s'.\n", label ? label : "-");
+    }
+
+    size_t limit = matcher_match_limit(config);
+    *matches = 0;
+    bool first = true;
+    bool binary = false;
+    unsigned int line_offset = 0;
+    for (size_t i = 0; started && !binary && *matches < limit; i ^= 1) {
+        stream_block_t *block = &stream.blocks[i];
+        stats_phase_t previous = stats_enter(STATS_PHASE_IO);
+        pthread_mutex_lock(&stream.mutex);
+        while (!block->full) pthread_cond_wait(&stream.cond, &stream.mutex);
+        pthread_mutex_unlock(&stream.mutex);
+        stats_leave(previous);
+
+        // Like a file, a binary stream is judged by how it starts, and skipped.
+        if (first && ignore_binary && is_binary(block->data, block->length)) {
+            stats_count(STATS_BINARY_SKIPS, 1);
+            binary = true;
+        }
+        first = false;
+        if (!binary) {
+            matcher_lines_t lines = { .items = NULL, .count = 0, .capacity = 0 };
+            unsigned int newlines = matcher_collect_lines(block->data, block->length, config, &matcher_state, &lines,
+                                                          limit - *matches);
+            matcher_print_lines(label, config, &lines, line_offset, &matcher_state.output);
+            output_end_file(&matcher_state.output);
+            *matches += lines.count;
+            matcher_lines_destroy(&lines);
+            line_offset += newlines;
+        }
+
+        bool last = block->last;
+        pthread_mutex_lock(&stream.mutex);
+        block->full = false;
+        pthread_cond_broadcast(&stream.cond);
+        pthread_mutex_unlock(&stream.mutex);
+        if (last) break;
+    }
+
+    if (started) {
+        // Past the end of the input this is a no-op; after -m or -l was settled it ends a reader still waiting.
+        stop_stream(&stream);
+        pthread_join(reader, NULL);
+        if (!binary) matcher_report_file(label, config, *matches, &matcher_state.output);
+        output_end_file(&matcher_state.output);
+        stats_count(STATS_FILES, 1);
+        stats_count(STATS_MATCHES, *matches);
+    }
+    if (started && stream.error != 0) {
+        fprintf(stderr, "Error: Cannot read '%s': %s.\n", label ? label : "-", strerror(stream.error));
+    }
+    for (size_t i = 0; i < 2; i++) {
+        free(stream.blocks[i].data);
+        if (stream.wake[i] >= 0) close(stream.wake[i]);
+    }
+    pthread_mutex_destroy(&stream.mutex);
+    pthread_cond_destroy(&stream.cond);
+    return started && stream.error == 0;
+}
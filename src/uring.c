@@ -0,0 +1,252 @@
+#define _GNU_SOURCE // struct statx
+#include "uring.h"
+#include "io.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <liburing.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+enum { URING_BUFFER_ALIGN = 4096 };
+
+typedef enum { SLOT_FREE, SLOT_STATX, SLOT_OPEN, SLOT_READ, SLOT_READY } slot_stage_t;
+
+/**
+ * One path on its way through statx, openat and read. At most one of its
+ * operations is in the ring at a time.
+ */
+typedef struct {
+    slot_stage_t stage;
+    void *user;
+    bool want_data;
+    bool has_data;
+    int fd;
+    int error;
+    struct statx stx;
+    char *buffer; // Reused across paths, grown up to max_read
+    size_t capacity;
+    size_t length;
+    char path[PATH_MAX];
+} uring_slot_t;
+
+struct uring_reader {
+    struct io_uring ring;
+    uring_slot_t *slots;
+    unsigned depth;
+    unsigned *free_slots; // Stack of slot indices
+    unsigned free_count;
+    unsigned *ready; // FIFO of finished slot indices
+    unsigned ready_head;
+    unsigned ready_count;
+    unsigned in_flight; // Operations queued or submitted but not completed
+    unsigned queued; // Operations prepared since the last submit
+    size_t max_read;
+};
+
+static bool probe_supported(struct io_uring *ring) {
+    struct io_uring_probe *probe = io_uring_get_probe_ring(ring);
+    if (probe == NULL) return false;
+    bool supported = io_uring_opcode_supported(probe, IORING_OP_STATX) &&
+                     io_uring_opcode_supported(probe, IORING_OP_OPENAT) &&
+                     io_uring_opcode_supported(probe, IORING_OP_READ);
+    io_uring_free_probe(probe);
+    return supported;
+}
+
+uring_reader_t *uring_reader_create(unsigned depth, size_t max_read) {
+    uring_reader_t *reader = calloc(1, sizeof(uring_reader_t));
+    if (reader == NULL) return NULL;
+    if (io_uring_queue_init(depth, &reader->ring, 0) < 0) {
+        free(reader);
+        return NULL;
+    }
+
+    reader->slots = calloc(depth, sizeof(uring_slot_t));
+    reader->free_slots = malloc(depth * sizeof(unsigned));
+    reader->ready = malloc(depth * sizeof(unsigned));
+    if (reader->slots == NULL || reader->free_slots == NULL || reader->ready == NULL ||
+        !probe_supported(&reader->ring)) {
+        uring_reader_destroy(reader);
+        return NULL;
+    }
+
+    reader->depth = depth;
+    reader->max_read = max_read;
+    for (unsigned i = 0; i < depth; i++) {
+        reader->slots[i].fd = -1;
+        reader->free_slots[reader->free_count++] = depth - 1 - i;
+    }
+    return reader;
+}
+
+void uring_reader_destroy(uring_reader_t *reader) {
+    if (reader == NULL) return;
+    io_uring_queue_exit(&reader->ring);
+    if (reader->slots != NULL) {
+        for (unsigned i = 0; i < reader->depth; i++) {
+            if (reader->slots[i].fd >= 0) close(reader->slots[i].fd);
+            free(reader->slots[i].buffer);
+        }
+    }
+    free(reader->slots);
+    free(reader->free_slots);
+    free(reader->ready);
+    free(reader);
+}
+
+bool uring_reader_has_room(const uring_reader_t *reader) {
+    return reader->free_count > 0;
+}
+
+unsigned uring_reader_pending(const uring_reader_t *reader) {
+    return reader->depth - reader->free_count;
+}
+
+// The ring has an entry per slot and a slot has one operation in it at most,
+// so an SQE is always available.
+static struct io_uring_sqe *slot_sqe(uring_reader_t *reader, uring_slot_t *slot) {
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&reader->ring);
+    io_uring_sqe_set_data(sqe, slot);
+    reader->in_flight++;
+    reader->queued++;
+    return sqe;
+}
+
+static void slot_finish(uring_reader_t *reader, uring_slot_t *slot, int error) {
+    if (slot->fd >= 0) {
+        close(slot->fd);
+        slot->fd = -1;
+    }
+    slot->error = error;
+    slot->stage = SLOT_READY;
+    unsigned index = (unsigned)(slot - reader->slots);
+    reader->ready[(reader->ready_head + reader->ready_count++) % reader->depth] = index;
+}
+
+static bool slot_reserve(uring_slot_t *slot, size_t size) {
+    if (size <= slot->capacity) return true;
+    size_t capacity = (size + URING_BUFFER_ALIGN - 1) & ~((size_t)URING_BUFFER_ALIGN - 1);
+    char *buffer = aligned_alloc(URING_BUFFER_ALIGN, capacity);
+    if (buffer == NULL) return false;
+    free(slot->buffer);
+    slot->buffer = buffer;
+    slot->capacity = capacity;
+    return true;
+}
+
+static void slot_complete(uring_reader_t *reader, uring_slot_t *slot, int res) {
+    if (res < 0) {
+        slot_finish(reader, slot, -res);
+        return;
+    }
+
+    size_t size = (size_t)slot->stx.stx_size;
+    switch (slot->stage) {
+    case SLOT_STATX:
+        // Anything but a small wanted regular file is left to the caller.
+        if (!S_ISREG(slot->stx.stx_mode) || !slot->want_data || size == 0 ||
+            size >= reader->max_read || !slot_reserve(slot, size)) {
+            slot_finish(reader, slot, 0);
+            return;
+        }
+        slot->stage = SLOT_OPEN;
+        io_uring_prep_openat(slot_sqe(reader, slot), AT_FDCWD, slot->path, O_RDONLY | O_CLOEXEC, 0);
+        return;
+    case SLOT_OPEN:
+        slot->fd = res;
+        slot->stage = SLOT_READ;
+        slot->length = 0;
+        io_uring_prep_read(slot_sqe(reader, slot), slot->fd, slot->buffer, (unsigned)size, 0);
+        return;
+    case SLOT_READ:
+        slot->length += (size_t)res;
+        if (res > 0 && slot->length < size) { // Short read
+            io_uring_prep_read(slot_sqe(reader, slot), slot->fd, slot->buffer + slot->length,
+                               (unsigned)(size - slot->length), slot->length);
+            return;
+        }
+        // A file truncated since statx() is searched for what is there.
+        slot->has_data = true;
+        atomic_fetch_add_explicit(&io_stats.files_read, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&io_stats.bytes_read, slot->length, memory_order_relaxed);
+        slot_finish(reader, slot, 0);
+        return;
+    default:
+        return;
+    }
+}
+
+bool uring_reader_submit(uring_reader_t *reader, const char *path, bool want_data, void *user) {
+    size_t length = strlen(path);
+    if (reader->free_count == 0 || length >= PATH_MAX) return false;
+
+    uring_slot_t *slot = &reader->slots[reader->free_slots[--reader->free_count]];
+    memcpy(slot->path, path, length + 1);
+    slot->stage = SLOT_STATX;
+    slot->user = user;
+    slot->want_data = want_data;
+    slot->has_data = false;
+    slot->error = 0;
+    slot->length = 0;
+    io_uring_prep_statx(slot_sqe(reader, slot), AT_FDCWD, slot->path, AT_SYMLINK_NOFOLLOW,
+                        STATX_TYPE | STATX_SIZE, &slot->stx);
+    return true;
+}
+
+bool uring_reader_next(uring_reader_t *reader, uring_result_t *result) {
+    while (reader->ready_count == 0) {
+        if (reader->in_flight == 0) return false;
+
+        int ret = io_uring_submit_and_wait(&reader->ring, 1);
+        if (ret < 0 && ret != -EINTR) {
+            // The ring is unusable; fail what is left so the caller can move on.
+            for (unsigned i = 0; i < reader->depth; i++) {
+                uring_slot_t *slot = &reader->slots[i];
+                if (slot->stage != SLOT_FREE && slot->stage != SLOT_READY) slot_finish(reader, slot, -ret);
+            }
+            reader->in_flight = 0;
+            if (reader->ready_count == 0) return false;
+            break;
+        }
+        reader->queued = 0;
+
+        struct io_uring_cqe *cqe;
+        while (io_uring_peek_cqe(&reader->ring, &cqe) == 0) {
+            uring_slot_t *slot = io_uring_cqe_get_data(cqe);
+            int res = cqe->res;
+            io_uring_cqe_seen(&reader->ring, cqe);
+            reader->in_flight--;
+            slot_complete(reader, slot, res);
+        }
+    }
+
+    // Get follow-up operations moving while the caller works on this result.
+    if (reader->queued > 0) {
+        io_uring_submit(&reader->ring);
+        reader->queued = 0;
+    }
+
+    uring_slot_t *slot = &reader->slots[reader->ready[reader->ready_head]];
+    reader->ready_head = (reader->ready_head + 1) % reader->depth;
+    reader->ready_count--;
+
+    *result = (uring_result_t){
+        .user = slot->user,
+        .path = slot->path,
+        .error = slot->error,
+        .mode = slot->error == 0 ? (mode_t)slot->stx.stx_mode : 0,
+        .size = slot->error == 0 ? (size_t)slot->stx.stx_size : 0,
+        .data = slot->has_data ? slot->buffer : NULL,
+        .length = slot->has_data ? slot->length : 0,
+    };
+    return true;
+}
+
+void uring_reader_release(uring_reader_t *reader, const uring_result_t *result) {
+    uring_slot_t *slot = (uring_slot_t *)((const char *)result->path - offsetof(uring_slot_t, path));
+    slot->stage = SLOT_FREE;
+    reader->free_slots[reader->free_count++] = (unsigned)(slot - reader->slots);
+}
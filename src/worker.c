@@ -1,132 +1,840 @@
 #include "worker.h"
 #include "raii.h"
 #include "discovery.h"
+#include "order.h"
+#include "chunk.h"
+#include "io.h"
+#include "index.h"
+#include "decompress.h"
+#include "stats.h"
+#include "simd.h"
+#ifdef CGREP_HAVE_IO_URING
+#include "uring.h"
+#endif
+#include <dirent.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <stdio.h>
 #include <string.h>
 
-void work_queue_init(work_queue_t *queue) {
-    queue->capacity = 1024;
-    queue->items = malloc(queue->capacity * sizeof(char *));
-    queue->head = 0;
-    queue->tail = 0;
-    queue->pending_items = 0;
+enum { INITIAL_RING_CAPACITY = 256, INITIAL_INJECTOR_CAPACITY = 1024 };
+
+static _Thread_local struct {
+    const work_queue_t *queue;
+    size_t index;
+} tls_worker = { NULL, 0 };
+
+static work_local_t *local_worker(const work_queue_t *queue) {
+    if (tls_worker.queue != queue) return NULL;
+    return &queue->locals[tls_worker.index];
+}
+
+static work_ring_t *work_ring_create(int64_t capacity) {
+    work_ring_t *ring = malloc(sizeof(work_ring_t) + ((size_t)capacity * sizeof(_Atomic(path_node_t *))));
+    ring->capacity = capacity;
+    ring->retired = NULL;
+    return ring;
+}
+
+static _Atomic(path_node_t *) *work_ring_slot(work_ring_t *ring, int64_t index) {
+    return &ring->slots[index & (ring->capacity - 1)];
+}
+
+static work_ring_t *work_deque_grow(work_deque_t *deque, work_ring_t *ring, int64_t top, int64_t bottom) {
+    work_ring_t *bigger = work_ring_create(ring->capacity * 2);
+    for (int64_t i = top; i < bottom; i++) {
+        atomic_store_explicit(work_ring_slot(bigger, i),
+                              atomic_load_explicit(work_ring_slot(ring, i), memory_order_relaxed),
+                              memory_order_relaxed);
+    }
+    bigger->retired = ring;
+    atomic_store_explicit(&deque->ring, bigger, memory_order_release);
+    return bigger;
+}
+
+// Owner only.
+static void work_deque_push(work_deque_t *deque, path_node_t *item) {
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    work_ring_t *ring = atomic_load_explicit(&deque->ring, memory_order_relaxed);
+    if (bottom - top > ring->capacity - 1) {
+        ring = work_deque_grow(deque, ring, top, bottom);
+    }
+    atomic_store_explicit(work_ring_slot(ring, bottom), item, memory_order_relaxed);
+    // seq_cst (not just release) so the following load of 'sleepers' cannot be reordered before it.
+    atomic_store(&deque->bottom, bottom + 1);
+}
+
+// Owner only.
+static path_node_t *work_deque_take(work_deque_t *deque) {
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    work_ring_t *ring = atomic_load_explicit(&deque->ring, memory_order_relaxed);
+    atomic_store(&deque->bottom, bottom);
+    int64_t top = atomic_load(&deque->top);
+
+    if (top > bottom) {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    path_node_t *item = atomic_load_explicit(work_ring_slot(ring, bottom), memory_order_relaxed);
+    if (top == bottom) {
+        // Last item: race against thieves for it.
+        if (!atomic_compare_exchange_strong(&deque->top, &top, top + 1)) {
+            item = NULL;
+        }
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return item;
+}
+
+// Any thread. Returns NULL when empty or when the race for the top item was lost.
+static path_node_t *work_deque_steal(work_deque_t *deque) {
+    int64_t top = atomic_load(&deque->top);
+    int64_t bottom = atomic_load(&deque->bottom);
+    if (top >= bottom) return NULL;
+
+    work_ring_t *ring = atomic_load_explicit(&deque->ring, memory_order_acquire);
+    path_node_t *item = atomic_load_explicit(work_ring_slot(ring, top), memory_order_relaxed);
+    if (!atomic_compare_exchange_strong(&deque->top, &top, top + 1)) {
+        return NULL;
+    }
+    return item;
+}
+
+static bool work_deque_is_empty(work_deque_t *deque) {
+    return atomic_load(&deque->top) >= atomic_load(&deque->bottom);
+}
+
+// Takes a work queue mutex; with --stats, waiting for it is counted and timed.
+static void lock_queue_mutex(pthread_mutex_t *mutex) {
+    if (stats_current == NULL) {
+        pthread_mutex_lock(mutex);
+    } else if (pthread_mutex_trylock(mutex) != 0) {
+        stats_count(STATS_QUEUE_CONTENDED, 1);
+        stats_phase_t previous = stats_enter(STATS_PHASE_QUEUE_LOCK);
+        pthread_mutex_lock(mutex);
+        stats_leave(previous);
+    }
+}
+
+static void work_injector_push(work_injector_t *injector, path_node_t *item) {
+    lock_queue_mutex(&injector->mutex);
+    work_fifo_t *fifo = &injector->fifos[item->work_class];
+    if (fifo->tail == fifo->capacity) {
+        fifo->capacity = fifo->capacity ? fifo->capacity * 2 : INITIAL_INJECTOR_CAPACITY;
+        fifo->items = realloc(fifo->items, fifo->capacity * sizeof(path_node_t *));
+    }
+    fifo->items[fifo->tail++] = item;
+    atomic_fetch_add(&injector->count, 1);
+    pthread_mutex_unlock(&injector->mutex);
+}
+
+// Takes the oldest item of the first non-empty class in [first, last).
+static path_node_t *work_injector_pop(work_injector_t *injector, int first, int last) {
+    if (atomic_load(&injector->count) == 0) return NULL;
+
+    lock_queue_mutex(&injector->mutex);
+    path_node_t *item = NULL;
+    for (int class = first; class < last && item == NULL; class++) {
+        work_fifo_t *fifo = &injector->fifos[class];
+        if (fifo->head == fifo->tail) continue;
+        item = fifo->items[fifo->head++];
+        atomic_fetch_sub(&injector->count, 1);
+        // Auto-Reset optimization
+        if (fifo->head == fifo->tail) {
+            fifo->head = 0;
+            fifo->tail = 0;
+        }
+    }
+    pthread_mutex_unlock(&injector->mutex);
+    return item;
+}
+
+void work_queue_init(work_queue_t *queue, size_t num_workers) {
+    queue->num_workers = num_workers;
+    queue->locals = aligned_alloc(alignof(work_local_t), (num_workers > 0 ? num_workers : 1) * sizeof(work_local_t));
+    for (size_t i = 0; i < num_workers; i++) {
+        work_local_t *local = &queue->locals[i];
+        for (int class = 0; class < WORK_CLASS_COUNT; class++) {
+            atomic_init(&local->deques[class].top, 0);
+            atomic_init(&local->deques[class].bottom, 0);
+            atomic_init(&local->deques[class].ring, work_ring_create(INITIAL_RING_CAPACITY));
+        }
+        atomic_init(&local->pushed, 0);
+        atomic_init(&local->completed, 0);
+        local->arena.current = NULL;
+    }
+    atomic_init(&queue->registered, 0);
+    for (int class = 0; class < WORK_CLASS_MEDIUM; class++) atomic_init(&queue->rare[class], 0);
+
+    work_injector_t *injector = &queue->injector;
+    for (int class = 0; class < WORK_CLASS_COUNT; class++) {
+        injector->fifos[class] = (work_fifo_t){ .items = NULL, .head = 0, .tail = 0, .capacity = 0 };
+    }
+    pthread_mutex_init(&injector->mutex, NULL);
+    atomic_init(&injector->count, 0);
+    atomic_init(&injector->pushed, 0);
+    atomic_init(&injector->completed, 0);
+    injector->arena.current = NULL;
+
     pthread_mutex_init(&queue->mutex, NULL);
     pthread_cond_init(&queue->cond, NULL);
-    queue->done = false;
+    atomic_init(&queue->sleepers, 0);
+    atomic_init(&queue->active, num_workers);
+    pthread_cond_init(&queue->park_cond, NULL);
+    atomic_init(&queue->done, false);
+    atomic_init(&queue->cancelled, false);
 }
 
-void work_queue_push(work_queue_t *queue, const char *filename) {
-    pthread_mutex_lock(&queue->mutex);
-    
-    if (queue->tail == queue->capacity) {
-        queue->capacity *= 2;
-        queue->items = realloc(queue->items, queue->capacity * sizeof(char *));
+void work_queue_register_worker(work_queue_t *queue) {
+    size_t index = atomic_fetch_add(&queue->registered, 1);
+    if (index < queue->num_workers) {
+        tls_worker.queue = queue;
+        tls_worker.index = index;
     }
-    
-    queue->items[queue->tail++] = strdup(filename);
-    queue->pending_items++;
-    
+}
+
+void work_queue_set_active_workers(work_queue_t *queue, size_t count) {
+    lock_queue_mutex(&queue->mutex);
+    atomic_store(&queue->active, count);
+    pthread_cond_broadcast(&queue->park_cond);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+static bool is_parked(const work_queue_t *queue) {
+    return tls_worker.queue == queue && !atomic_load(&queue->done) && tls_worker.index >= atomic_load(&queue->active);
+}
+
+static void park_while_inactive(work_queue_t *queue) {
+    if (!is_parked(queue)) return;
+    stats_phase_t previous = stats_enter(STATS_PHASE_IDLE);
+    lock_queue_mutex(&queue->mutex);
+    while (is_parked(queue)) pthread_cond_wait(&queue->park_cond, &queue->mutex);
+    pthread_mutex_unlock(&queue->mutex);
+    stats_leave(previous);
+}
+
+static void work_queue_wake_one(work_queue_t *queue) {
+    if (atomic_load(&queue->sleepers) == 0) return;
+    lock_queue_mutex(&queue->mutex);
     pthread_cond_signal(&queue->cond);
     pthread_mutex_unlock(&queue->mutex);
 }
 
-char* work_queue_pop(work_queue_t *queue) {
-    pthread_mutex_lock(&queue->mutex);
-    
-    while (queue->head == queue->tail && !queue->done) {
-        pthread_cond_wait(&queue->cond, &queue->mutex);
+path_node_t *work_queue_new_node(work_queue_t *queue, path_node_t *parent, const char *name) {
+    work_local_t *local = local_worker(queue);
+    if (local) {
+        return path_node_create(&local->arena, parent, name);
     }
 
-    if (queue->done && queue->head == queue->tail) {
+    lock_queue_mutex(&queue->injector.mutex);
+    path_node_t *node = path_node_create(&queue->injector.arena, parent, name);
+    pthread_mutex_unlock(&queue->injector.mutex);
+    return node;
+}
+
+void work_queue_push_node(work_queue_t *queue, path_node_t *item) {
+    // Counted before the item is visible, so a taker never sees the count below the items it can find.
+    if (item->work_class < WORK_CLASS_MEDIUM) atomic_fetch_add(&queue->rare[item->work_class], 1);
+    work_local_t *local = local_worker(queue);
+    if (local) {
+        atomic_fetch_add(&local->pushed, 1);
+        work_deque_push(&local->deques[item->work_class], item);
+    } else {
+        atomic_fetch_add(&queue->injector.pushed, 1);
+        work_injector_push(&queue->injector, item);
+    }
+    work_queue_wake_one(queue);
+}
+
+void work_queue_push(work_queue_t *queue, path_node_t *parent, const char *name) {
+    path_node_t *node = work_queue_new_node(queue, parent, name);
+    if (node) work_queue_push_node(queue, node);
+}
+
+void work_queue_hold(work_queue_t *queue) {
+    work_local_t *local = local_worker(queue);
+    atomic_fetch_add(local ? &local->pushed : &queue->injector.pushed, 1);
+}
+
+// Each class in [first, last) across all other workers before the next class.
+static path_node_t *work_queue_try_steal(work_queue_t *queue, const work_local_t *self, int first, int last) {
+    size_t start = self ? (size_t)(self - queue->locals) + 1 : 0;
+    for (int class = first; class < last; class++) {
+        for (size_t i = 0; i < queue->num_workers; i++) {
+            work_local_t *victim = &queue->locals[(start + i) % queue->num_workers];
+            if (victim == self) continue;
+            path_node_t *item = work_deque_steal(&victim->deques[class]);
+            if (item) return item;
+        }
+    }
+    return NULL;
+}
+
+static bool work_local_is_empty(work_local_t *local) {
+    for (int class = 0; class < WORK_CLASS_COUNT; class++) {
+        if (!work_deque_is_empty(&local->deques[class])) return false;
+    }
+    return true;
+}
+
+static bool work_queue_has_work(work_queue_t *queue) {
+    if (atomic_load(&queue->injector.count) > 0) return true;
+    for (size_t i = 0; i < queue->num_workers; i++) {
+        if (!work_local_is_empty(&queue->locals[i])) return true;
+    }
+    return false;
+}
+
+static path_node_t *work_local_take(work_local_t *self, int first, int last) {
+    path_node_t *item = NULL;
+    for (int class = first; self && class < last && !item; class++) {
+        // 'top' only grows, so an empty look is final for the owner and spares take()'s fence.
+        if (!work_deque_is_empty(&self->deques[class])) item = work_deque_take(&self->deques[class]);
+    }
+    return item;
+}
+
+static path_node_t *work_queue_take(work_queue_t *queue, work_local_t *self, int first, int last) {
+    path_node_t *item = work_local_take(self, first, last);
+    if (!item) item = work_injector_pop(&queue->injector, first, last);
+    if (!item) item = work_queue_try_steal(queue, self, first, last);
+    return item;
+}
+
+path_node_t *work_queue_try_pop(work_queue_t *queue) {
+    work_local_t *self = local_worker(queue);
+    path_node_t *item = NULL;
+    for (int class = 0; class < WORK_CLASS_MEDIUM && !item; class++) {
+        if (atomic_load_explicit(&queue->rare[class], memory_order_relaxed) > 0) {
+            item = work_queue_take(queue, self, class, class + 1);
+        }
+    }
+    // The common classes from nearby first; this also finds rare items whose count was not visible yet.
+    if (!item) item = work_queue_take(queue, self, WORK_CLASS_FIRST, WORK_CLASS_COUNT);
+    if (item && item->work_class < WORK_CLASS_MEDIUM) atomic_fetch_sub(&queue->rare[item->work_class], 1);
+    return item;
+}
+
+path_node_t* work_queue_pop(work_queue_t *queue) {
+    park_while_inactive(queue);
+
+    // From the first miss on, the time until work turns up is idle time.
+    bool idle = false;
+    stats_phase_t previous = STATS_PHASE_OTHER;
+    path_node_t *item = NULL;
+    while (!atomic_load(&queue->done)) {
+        item = work_queue_try_pop(queue);
+        if (item) break;
+        if (!idle) previous = stats_enter(STATS_PHASE_IDLE);
+        idle = true;
+
+        // Nothing visible anywhere: sleep until a push or termination. The
+        // sleeper count is published before re-checking for work, and pushers
+        // publish their item before reading it, so a wakeup cannot be lost.
+        lock_queue_mutex(&queue->mutex);
+        atomic_fetch_add(&queue->sleepers, 1);
+        if (!atomic_load(&queue->done) && !work_queue_has_work(queue)) {
+            stats_enter(STATS_PHASE_QUEUE_WAIT);
+            pthread_cond_wait(&queue->cond, &queue->mutex);
+            stats_enter(STATS_PHASE_IDLE);
+        }
+        atomic_fetch_sub(&queue->sleepers, 1);
         pthread_mutex_unlock(&queue->mutex);
-        return NULL;
     }
 
-    char *filename = queue->items[queue->head++];
-    
-    // Auto-Reset optimization
-    if (queue->head == queue->tail) {
-        queue->head = 0;
-        queue->tail = 0;
+    if (idle) stats_leave(previous);
+    return item;
+}
+
+/*
+ * Termination detection. Every pusher counts into its own 'pushed' and every
+ * completer into its own 'completed', so the hot path never touches a shared
+ * counter. All 'completed' counters are summed before any 'pushed' counter;
+ * both only grow and an item is always pushed before it completes, so equal
+ * sums mean that at some instant nothing was pending. Since only pending
+ * items (or holds) produce new items, the queue can never become busy again.
+ */
+static bool work_queue_is_quiescent(work_queue_t *queue) {
+    size_t completed = atomic_load(&queue->injector.completed);
+    for (size_t i = 0; i < queue->num_workers; i++) {
+        completed += atomic_load(&queue->locals[i].completed);
     }
-    
-    pthread_mutex_unlock(&queue->mutex);
-    return filename;
+
+    size_t pushed = atomic_load(&queue->injector.pushed);
+    for (size_t i = 0; i < queue->num_workers; i++) {
+        pushed += atomic_load(&queue->locals[i].pushed);
+    }
+
+    return pushed == completed;
 }
 
 void work_queue_item_done(work_queue_t *queue) {
-    pthread_mutex_lock(&queue->mutex);
-    queue->pending_items--;
-    if (queue->pending_items == 0) {
-        queue->done = true;
-        pthread_cond_broadcast(&queue->cond);
+    work_local_t *local = local_worker(queue);
+    if (local) {
+        atomic_fetch_add(&local->completed, 1);
+        // Work left in our own deques is still pending, no need to scan everyone.
+        if (!work_local_is_empty(local)) return;
+    } else {
+        atomic_fetch_add(&queue->injector.completed, 1);
+    }
+
+    if (work_queue_is_quiescent(queue)) {
+        work_queue_set_done(queue);
     }
-    pthread_mutex_unlock(&queue->mutex);
 }
 
 void work_queue_set_done(work_queue_t *queue) {
-    pthread_mutex_lock(&queue->mutex);
-    queue->done = true;
+    lock_queue_mutex(&queue->mutex);
+    atomic_store(&queue->done, true);
     pthread_cond_broadcast(&queue->cond);
+    pthread_cond_broadcast(&queue->park_cond);
     pthread_mutex_unlock(&queue->mutex);
 }
 
+void work_queue_cancel(work_queue_t *queue) {
+    atomic_store(&queue->cancelled, true);
+    work_queue_set_done(queue);
+}
+
 void work_queue_destroy(work_queue_t *queue) {
-    // Free any remaining strings in the queue
-    for (size_t i = queue->head; i < queue->tail; i++) {
-        free(queue->items[i]);
+    // Release any remaining nodes in the queue
+    for (size_t i = 0; i < queue->num_workers; i++) {
+        for (int class = 0; class < WORK_CLASS_COUNT; class++) {
+            work_deque_t *deque = &queue->locals[i].deques[class];
+            work_ring_t *ring = atomic_load(&deque->ring);
+            for (int64_t j = atomic_load(&deque->top); j < atomic_load(&deque->bottom); j++) {
+                path_node_release(atomic_load(work_ring_slot(ring, j)));
+            }
+            while (ring) {
+                work_ring_t *retired = ring->retired;
+                free(ring);
+                ring = retired;
+            }
+        }
+        path_arena_destroy(&queue->locals[i].arena);
+    }
+    free(queue->locals);
+    queue->locals = NULL;
+
+    work_injector_t *injector = &queue->injector;
+    for (int class = 0; class < WORK_CLASS_COUNT; class++) {
+        work_fifo_t *fifo = &injector->fifos[class];
+        for (size_t i = fifo->head; i < fifo->tail; i++) {
+            path_node_release(fifo->items[i]);
+        }
+        free(fifo->items);
     }
-    free(queue->items);
+    path_arena_destroy(&injector->arena);
+    pthread_mutex_destroy(&injector->mutex);
+
     pthread_mutex_destroy(&queue->mutex);
     pthread_cond_destroy(&queue->cond);
+    pthread_cond_destroy(&queue->park_cond);
+}
+
+// Returns the next chunk this thread should search while chunk 'next' is
+// still being searched elsewhere: the last unclaimed one, so that thieves,
+// which take chunks from the front, and this thread meet in the middle.
+static file_chunk_t *claim_from_back(file_job_t *job, size_t next) {
+    for (size_t i = job->chunk_count; i-- > next + 1;) {
+        if (file_chunk_claim(&job->chunks[i])) return &job->chunks[i];
+    }
+    return NULL;
 }
 
-static void search_file(const char *filename, worker_args_t *args) {
-    auto_close int fd = open(filename, O_RDONLY);
-    if (fd < 0) return;
+// Returns the number of matching lines, up to the file's match limit.
+static size_t search_chunked(const char *filename, path_node_t *node, file_job_t *job,
+                             worker_args_t *args, matcher_state_t *matcher_state) {
+    // Chunk 0 is searched right away, so only the rest are offered to other workers.
+    for (size_t i = 1; i < job->chunk_count; i++) {
+        path_node_t *chunk_node = work_queue_new_node(args->queue, node, "");
+        if (chunk_node == NULL) break; // Unqueued chunks are searched below
+        chunk_node->chunk = &job->chunks[i];
+        file_job_retain(job);
+        work_queue_push_node(args->queue, chunk_node);
+    }
 
+    size_t limit = matcher_match_limit(args->grep_config);
+    size_t matches = 0;
+    unsigned int line_offset = 0;
+    for (size_t next = 0; next < job->chunk_count;) {
+        if (matches >= limit || work_queue_is_cancelled(args->queue)) {
+            // Settled: claim what is left so nobody searches it. Results of chunks
+            // already being searched elsewhere are dropped with the job.
+            for (size_t i = next; i < job->chunk_count; i++) file_chunk_claim(&job->chunks[i]);
+            break;
+        }
+        file_chunk_t *chunk = &job->chunks[next];
+        if (file_chunk_claim(chunk)) {
+            file_chunk_search(chunk, args->grep_config, matcher_state);
+        } else if (!file_chunk_done(chunk)) {
+            file_chunk_t *other = claim_from_back(job, next);
+            if (other) {
+                file_chunk_search(other, args->grep_config, matcher_state);
+                continue;
+            }
+            stats_phase_t previous = stats_enter(STATS_PHASE_IDLE);
+            file_chunk_wait(chunk);
+            stats_leave(previous);
+        }
+
+        // Each chunk stops at the limit on its own; only the first matches of the file count.
+        if (chunk->lines.count > limit - matches) chunk->lines.count = limit - matches;
+        matcher_print_lines(filename, args->grep_config, &chunk->lines, line_offset, &matcher_state->output);
+        matches += chunk->lines.count;
+        matcher_lines_destroy(&chunk->lines);
+        line_offset += chunk->newlines;
+        next++;
+    }
+    return matches;
+}
+
+// Adds the summary -l, -L or -c print for a searched file and, unless --ordered
+// hands the output over later, writes the file's output. With -q the first
+// match ends the whole search.
+static void finish_file(const char *filename, size_t matches, worker_args_t *args, matcher_state_t *matcher_state) {
+    stats_count(STATS_MATCHES, matches);
+    matcher_report_file(filename, args->grep_config, matches, &matcher_state->output);
+    if (args->discovery_config->order == NULL) output_end_file(&matcher_state->output);
+    if (matches > 0 && args->grep_config->report == MATCHER_REPORT_QUIET) work_queue_cancel(args->queue);
+}
+
+// Matches a loaded file and finishes it.
+static void search_contents(const char *filename, const char *data, size_t length, worker_args_t *args,
+                            matcher_state_t *matcher_state) {
+    size_t matches = matcher_process_buffer(filename, data, length, args->grep_config, matcher_state,
+                                            matcher_match_limit(args->grep_config));
+    finish_file(filename, matches, args, matcher_state);
+}
+
+// Searches a compressed file a window at a time: the window's whole lines are
+// matched and written out, and the partial line ending it starts the next one.
+// Matching lines are copied out of the window, so the output lock taken by an
+// early flush can be given back before the next window is decompressed.
+static size_t search_windows(const char *filename, worker_args_t *args, matcher_state_t *matcher_state,
+                             decompressor_t *decompressor, bool *binary) {
+    size_t limit = matcher_match_limit(args->grep_config);
+    size_t matches = 0;
+    size_t filled = 0;
+    unsigned int line_offset = 0;
+    bool first = true;
+    bool end = false;
+    while (!end && matches < limit) {
+        if (filled == decompressor->window_capacity && !decompressor_grow_window(decompressor)) {
+            fprintf(stderr, "Warning: '%s' has a line longer than %d MB; the rest is not searched.\n", filename,
+                    DECOMPRESS_WINDOW_MAX / (1024 * 1024));
+            break;
+        }
+        stats_phase_t previous = stats_enter(STATS_PHASE_IO);
+        ssize_t n = decompressor_read(decompressor, decompressor->window + filled,
+                                      decompressor->window_capacity - filled);
+        stats_leave(previous);
+        if (n < 0) fprintf(stderr, "Warning: '%s' is corrupt or truncated.\n", filename);
+        end = n <= 0;
+        if (n > 0) filled += (size_t)n;
+
+        // The first read fills a whole window unless the data ends first, newline or not.
+        const char *window = decompressor->window;
+        if (first && args->discovery_config->ignore_binary && is_binary(window, filled)) {
+            *binary = true;
+            return 0;
+        }
+        first = false;
+
+        size_t lines_end = filled;
+        if (!end) {
+            const char *newline = simd_rfind_byte(window, filled, '\n');
+            if (newline == NULL) continue; // One line fills the window
+            lines_end = (size_t)(newline - window) + 1;
+        }
+
+        matcher_lines_t lines = { .items = NULL, .count = 0, .capacity = 0 };
+        unsigned int newlines =
+            matcher_collect_lines(window, lines_end, args->grep_config, matcher_state, &lines, limit - matches);
+        matcher_print_lines(filename, args->grep_config, &lines, line_offset, &matcher_state->output);
+        output_yield(&matcher_state->output);
+        matches += lines.count;
+        matcher_lines_destroy(&lines);
+        line_offset += newlines;
+        memmove(decompressor->window, window + lines_end, filled - lines_end);
+        filled -= lines_end;
+    }
+    return matches;
+}
+
+static void search_compressed(const char *filename, compression_t type, const char *data, size_t length,
+                              worker_args_t *args, matcher_state_t *matcher_state, decompressor_t *decompressor) {
+    if (!decompressor_start(decompressor, type, data, length)) {
+        fprintf(stderr, "Warning: Could not start decompressing '%s'.\n", filename);
+        finish_file(filename, 0, args, matcher_state);
+        return;
+    }
+
+    bool binary = false;
+    matcher_state->output.copy = true;
+    size_t matches = search_windows(filename, args, matcher_state, decompressor, &binary);
+    matcher_state->output.copy = false;
+    if (binary) {
+        stats_count(STATS_BINARY_SKIPS, 1);
+        return;
+    }
+    finish_file(filename, matches, args, matcher_state);
+}
+
+// With -z, a compressed file is searched through its decompressed contents.
+static bool search_if_compressed(const char *filename, const char *data, size_t length, worker_args_t *args,
+                                 matcher_state_t *matcher_state, decompressor_t *decompressor) {
+    if (!args->decompress) return false;
+    compression_t type = decompress_detect(data, length);
+    if (type == COMPRESSION_NONE) return false;
+    search_compressed(filename, type, data, length, args, matcher_state, decompressor);
+    return true;
+}
+
+static void search_file(const char *filename, path_node_t *node, worker_args_t *args,
+                        matcher_state_t *matcher_state, io_buffer_t *io_buffer, decompressor_t *decompressor) {
+    stats_count(STATS_FILES, 1);
+    stats_phase_t previous = stats_enter(STATS_PHASE_IO);
+    auto_close int fd = path_node_open(node, filename, O_RDONLY);
     struct stat st;
-    if (fstat(fd, &st) != 0 || st.st_size == 0) return;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        stats_leave(previous);
+        return;
+    }
+    if (st.st_size == 0) {
+        stats_leave(previous);
+        // Nothing to map or index, but -L and -c still report it.
+        if (args->index_builder == NULL) finish_file(filename, 0, args, matcher_state);
+        return;
+    }
 
-    auto_munmap struct mmap_region region = { .addr = MAP_FAILED, .length = (size_t)st.st_size };
-    region.addr = mmap(NULL, region.length, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (region.addr == MAP_FAILED) return;
+    auto_io_view io_view_t view;
+    bool loaded = io_load(fd, (size_t)st.st_size, &args->io_config, io_buffer, &view);
+    stats_leave(previous);
+    if (!loaded) return;
+    if (search_if_compressed(filename, view.data, view.length, args, matcher_state, decompressor)) return;
 
-    if (args->discovery_config->ignore_binary && is_binary(region.addr, region.length)) {
+    if (args->discovery_config->ignore_binary && is_binary(view.data, view.length)) {
+        stats_count(STATS_BINARY_SKIPS, 1);
         return;
     }
 
-    matcher_process_buffer(filename, region.addr, region.length, args->grep_config);
+    if (args->index_builder) {
+        // Out of memory: the index will not be written, so stop reading files for it.
+        if (!index_builder_add(args->index_builder, discovery_relative_path(filename, node), view.data, view.length,
+                               &st)) {
+            work_queue_cancel(args->queue);
+        }
+        return;
+    }
+
+    // Only a mapping can be shared with other workers; a read buffer is this worker's own.
+    if (args->chunk_size > 0 && view.length > args->chunk_size && view.region.addr != MAP_FAILED) {
+        file_job_t *job = file_job_create(view.region.addr, view.region.length, args->chunk_size);
+        if (job != NULL) {
+            view.region.addr = MAP_FAILED; // Unmapped by the job's last reference
+            size_t matches = search_chunked(filename, node, job, args, matcher_state);
+            finish_file(filename, matches, args, matcher_state);
+            file_job_release(job);
+            return;
+        }
+    }
+
+    search_contents(filename, view.data, view.length, args, matcher_state);
 }
 
-void* worker_thread(void *arg) {
-    worker_args_t *args = (worker_args_t*)arg;
-    work_queue_t *queue = args->queue;
+// A slice of a large file, queued by the worker searching it in search_chunked().
+static void search_queued_chunk(file_chunk_t *chunk, worker_args_t *args, matcher_state_t *matcher_state) {
+    if (!work_queue_is_cancelled(args->queue) && file_chunk_claim(chunk)) {
+        file_chunk_search(chunk, args->grep_config, matcher_state);
+    }
+    file_job_release(chunk->job);
+}
 
-    while (true) {
-        auto_free char *path = work_queue_pop(queue);
-        if (path == NULL) break;
+// With an index, a file whose inode, size and mtime match its record is not
+// read: an update keeps the record, a search skips it unless the index says
+// it may match. Changed and new files are read as usual.
+static bool index_wants_file(const char *path, const path_node_t *node, worker_args_t *args) {
+    index_set_t *set = args->index_set;
+    if (set == NULL) return true;
+    struct stat st;
+    index_ref_t ref;
+    if (path_node_lstat(node, path, &st) != 0 ||
+        !index_set_find_unchanged(set, discovery_relative_path(path, node), &st, &ref)) {
+        return true;
+    }
+    if (args->index_builder) {
+        index_set_keep(set, ref);
+        return false;
+    }
+    return index_set_may_match(set, ref);
+}
+
+// Entries the lister classified were filtered by it already; the rest are filtered here.
+static bool wants_file(const char *path, const path_node_t *node, bool listed, const worker_args_t *args) {
+    if (listed || should_process_file(path, node, args->discovery_config)) return true;
+    stats_count(STATS_FILTERED, 1);
+    return false;
+}
+
+static bool wants_directory(const char *path, const path_node_t *node, bool listed, const worker_args_t *args) {
+    if (!args->discovery_config->recursive) return false;
+    if (listed || should_enter_directory(path, node, args->discovery_config)) return true;
+    stats_count(STATS_FILTERED, 1);
+    return false;
+}
+
+static void finish_node(path_node_t *node, worker_args_t *args, matcher_state_t *matcher_state) {
+    // Every queued node has a slot to resolve, even if it produced nothing.
+    if (node->order_slot) order_finish(args->discovery_config->order, node->order_slot, &matcher_state->output);
+    work_queue_item_done(args->queue);
+}
+
+static void process_node(path_node_t *node, worker_args_t *args, matcher_state_t *matcher_state,
+                         io_buffer_t *io_buffer, decompressor_t *decompressor) {
+    if (node->chunk) {
+        search_queued_chunk(node->chunk, args, matcher_state);
+        work_queue_item_done(args->queue);
+        return;
+    }
 
+    char path[PATH_MAX];
+    if (path_node_format(node, path, sizeof(path)) != 0) {
+        // Listed entries carry their d_type and were filtered by the lister;
+        // only roots and unclassified entries need a stat and the filters here.
+        unsigned char type = node->type;
+        bool filtered = type != DT_UNKNOWN;
         struct stat st;
-        if (lstat(path, &st) != 0) {
-            work_queue_item_done(queue);
-            continue;
+        if (type == DT_UNKNOWN && path_node_lstat(node, path, &st) == 0) type = IFTODT(st.st_mode);
+
+        if (type == DT_DIR) {
+            if (wants_directory(path, node, filtered, args)) {
+                discover_directory(path, node, args->discovery_config, args->queue);
+            }
+        } else if (type == DT_REG) {
+            if (wants_file(path, node, filtered, args)) {
+                if (index_wants_file(path, node, args)) {
+                    search_file(path, node, args, matcher_state, io_buffer, decompressor);
+                } else if (args->index_builder == NULL) {
+                    stats_count(STATS_INDEX_SKIPS, 1);
+                    finish_file(path, 0, args, matcher_state); // Ruled out by the index, which -L and -c still report
+                }
+            }
         }
+    }
+    finish_node(node, args, matcher_state);
+}
 
-        if (S_ISDIR(st.st_mode)) {
-            if (args->discovery_config->recursive) {
-                discover_files(path, args->discovery_config, queue);
+#ifdef CGREP_HAVE_IO_URING
+enum { URING_DEPTH = 64 };
+
+static void process_uring_result(const uring_result_t *result, worker_args_t *args, matcher_state_t *matcher_state,
+                                 io_buffer_t *io_buffer, decompressor_t *decompressor) {
+    path_node_t *node = result->user;
+    if (result->error == 0) {
+        bool filtered = node->type != DT_UNKNOWN;
+        if (S_ISDIR(result->mode)) {
+            if (wants_directory(result->path, node, filtered, args)) {
+                discover_directory(result->path, node, args->discovery_config, args->queue);
+            }
+        } else if (S_ISREG(result->mode) && wants_file(result->path, node, filtered, args)) {
+            if (result->data != NULL) {
+                stats_count(STATS_FILES, 1);
+                bool searched = search_if_compressed(result->path, result->data, result->length, args,
+                                                     matcher_state, decompressor);
+                if (!searched && args->discovery_config->ignore_binary && is_binary(result->data, result->length)) {
+                    stats_count(STATS_BINARY_SKIPS, 1);
+                } else if (!searched) {
+                    search_contents(result->path, result->data, result->length, args, matcher_state);
+                }
+            } else if (result->size > 0) {
+                // Too large to read whole: map (and maybe chunk) it the usual way.
+                search_file(result->path, node, args, matcher_state, io_buffer, decompressor);
             }
-        } else if (S_ISREG(st.st_mode)) {
-            if (should_process_file(path, args->discovery_config)) {
-                search_file(path, args);
+        }
+    }
+    finish_node(node, args, matcher_state);
+    path_node_release(node);
+}
+
+/*
+ * Keeps up to URING_DEPTH paths in the ring and searches them as they come
+ * back. The queue is only waited on when nothing is in flight, so a worker
+ * never sleeps on the queue while completions are waiting for it.
+ */
+static void uring_worker_loop(uring_reader_t *reader, worker_args_t *args, matcher_state_t *matcher_state,
+                              io_buffer_t *io_buffer, decompressor_t *decompressor) {
+    while (true) {
+        while (uring_reader_has_room(reader)) {
+            path_node_t *node = uring_reader_pending(reader) == 0 ? work_queue_pop(args->queue)
+                                                                  : work_queue_try_pop(args->queue);
+            if (node == NULL) break;
+
+            char path[PATH_MAX];
+            if (node->chunk == NULL && path_node_format(node, path, sizeof(path)) != 0 &&
+                uring_reader_submit(reader, path,
+                                    node->type != DT_UNKNOWN || should_process_file(path, node, args->discovery_config),
+                                    node)) {
+                continue; // The ring owns the reference until the result is processed
             }
+            process_node(node, args, matcher_state, io_buffer, decompressor);
+            path_node_release(node);
+        }
+
+        uring_result_t result;
+        stats_phase_t previous = stats_enter(STATS_PHASE_IO);
+        bool have_result = uring_reader_next(reader, &result);
+        stats_leave(previous);
+        if (!have_result) break; // Nothing in flight and the queue is finished
+        process_uring_result(&result, args, matcher_state, io_buffer, decompressor);
+        uring_reader_release(reader, &result);
+    }
+}
+#endif
+
+void* worker_thread(void *arg) {
+    worker_args_t *args = (worker_args_t*)arg;
+    work_queue_register_worker(args->queue);
+    if (args->stats) stats_thread_begin(args->stats, "worker");
+
+    auto_matcher_state matcher_state_t matcher_state;
+    if (!matcher_state_init(&matcher_state, args->grep_config)) {
+        // Searching on would report every file as having no match.
+        fprintf(stderr, "Error: Cannot allocate a worker's matcher state.\n");
+        atomic_store(args->failed, true);
+        work_queue_cancel(args->queue);
+        stats_thread_end();
+        return NULL;
+    }
+    matcher_state.output.capture = args->discovery_config->order != NULL;
+    auto_io_buffer io_buffer_t io_buffer = { .data = NULL, .capacity = 0 };
+    auto_decompressor decompressor_t decompressor;
+    decompressor_init(&decompressor);
+
+#ifdef CGREP_HAVE_IO_URING
+    if (args->use_io_uring) {
+        uring_reader_t *reader = uring_reader_create(URING_DEPTH, args->io_config.mmap_threshold);
+        if (reader != NULL) {
+            uring_worker_loop(reader, args, &matcher_state, &io_buffer, &decompressor);
+            uring_reader_destroy(reader);
+            stats_thread_end();
+            return NULL;
         }
+        // The kernel refused the ring (or an opcode it needs): use blocking I/O.
+    }
+#endif
 
-        work_queue_item_done(queue);
+    while (true) {
+        auto_path_node path_node_t *node = work_queue_pop(args->queue);
+        if (node == NULL) break;
+        process_node(node, args, &matcher_state, &io_buffer, &decompressor);
     }
 
+    stats_thread_end();
     return NULL;
 }
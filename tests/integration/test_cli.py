@@ -3,6 +3,8 @@ import os
 import unittest
 import tempfile
 import shutil
+import gzip
+import json
 
 CGREP_BIN = os.path.abspath(os.path.join(os.path.dirname(__file__), "../../build/cgrep"))
 
@@ -76,6 +78,58 @@ class TestCGrep(unittest.TestCase):
         self.assertIn("include.c", res.stdout)
         self.assertNotIn("exclude.h", res.stdout)
 
+    def test_exclude_prunes_directories(self):
+        for rel in ("src/main.c", "src/gen/table.c", "build/out.c", "build/obj/x.c",
+                    "node_modules/pkg/index.js", "README.md", "x/build/y.c"):
+            path = os.path.join(self.test_dir, rel)
+            os.makedirs(os.path.dirname(path), exist_ok=True)
+            with open(path, "w") as f: f.write("match\n")
+
+        def found(*args):
+            res = self.run_cgrep("-r", *args, "match", self.test_dir)
+            self.assertEqual(res.returncode, 0)
+            return sorted(os.path.relpath(line.split(":")[0], self.test_dir) for line in res.stdout.splitlines())
+
+        self.assertEqual(found("--exclude", "build/*", "--exclude", "node_modules"),
+                         ["README.md", "src/gen/table.c", "src/main.c", "x/build/y.c"])
+        self.assertEqual(found("--exclude", "gen/", "--include", "*.c"),
+                         ["build/obj/x.c", "build/out.c", "src/main.c", "x/build/y.c"])
+        self.assertEqual(found("--include", "src/*.c"), ["src/main.c"])
+        self.assertEqual(found("--include", "**/*.c", "--exclude", "build/**"),
+                         ["src/gen/table.c", "src/main.c", "x/build/y.c"])
+        self.assertEqual(found("--include", "*.c", "--exclude", "build/"), ["src/gen/table.c", "src/main.c"])
+
+    def test_gitignore(self):
+        repo = os.path.join(self.test_dir, "repo")
+        files = {
+            ".gitignore": "*.o\n/build/\n*.log\n!keep.log\n",
+            ".git/info/exclude": "*.tmp\n",
+            ".git/config": "match\n",
+            "src/.gitignore": "gen/\n",
+            "src/a.c": "match\n", "src/a.o": "match\n", "src/gen/t.c": "match\n",
+            "build/out.c": "match\n", "lib/build/in.c": "match\n",
+            "x.log": "match\n", "keep.log": "match\n", "scratch.tmp": "match\n",
+            "lib/.ignore": "vendor/*\n!vendor/kept.c\n",
+            "lib/vendor/v.c": "match\n", "lib/vendor/kept.c": "match\n",
+        }
+        for rel, text in files.items():
+            path = os.path.join(repo, rel)
+            os.makedirs(os.path.dirname(path), exist_ok=True)
+            with open(path, "w") as f: f.write(text)
+
+        def found(root, *args):
+            res = self.run_cgrep("-r", *args, "match", root)
+            self.assertEqual(res.returncode, 0)
+            return sorted(os.path.relpath(line.split(":")[0], repo) for line in res.stdout.splitlines())
+
+        expected = ["keep.log", "lib/build/in.c", "lib/vendor/kept.c", "src/a.c"]
+        self.assertEqual(found(repo, "--gitignore"), expected)
+        self.assertEqual(found(repo, "--gitignore", "--ordered"), expected)
+        # Rules above a search root inside the repository still apply.
+        self.assertEqual(found(os.path.join(repo, "lib"), "--gitignore"), ["lib/build/in.c", "lib/vendor/kept.c"])
+        # Without the flag everything is searched.
+        self.assertEqual(len(found(repo)), 11)
+
     def test_binary_skipping(self):
         path = os.path.join(self.test_dir, "binary.dat")
         with open(path, "wb") as f:
@@ -99,5 +153,448 @@ class TestCGrep(unittest.TestCase):
         self.assertNotEqual(res.returncode, 0)
         self.assertIn("Error: Number of workers must be at least 1", res.stderr)
 
+    def test_required_literal_prefilter(self):
+        path = os.path.join(self.test_dir, "literal.txt")
+        with open(path, "w") as f:
+            f.write("foo Bar\nfooxBar\nFOOYBAR\nBar foo\n" + "filler line\n" * 100 + "fooZZBar")
+
+        res = self.run_cgrep(r"foo\w+Bar", path)
+        lines = res.stdout.splitlines()
+        self.assertEqual(len(lines), 2)
+        self.assertIn("fooxBar", res.stdout)
+        self.assertIn("fooZZBar", res.stdout)
+
+        res = self.run_cgrep("-i", "-n", r"foo\w+Bar", path)
+        self.assertEqual(len(res.stdout.splitlines()), 3)
+        self.assertIn("3:FOOYBAR", res.stdout)
+        self.assertIn("105:fooZZBar", res.stdout)
+
+    def test_multiline_pattern_not_prefiltered(self):
+        # Sparse records first, then dense ones: a prefilter would switch off
+        # part way through, so both halves must agree.
+        path = os.path.join(self.test_dir, "multiline.txt")
+        with open(path, "w") as f:
+            for _ in range(10):
+                f.write("foo\nbar\n" + "filler line\n" * 200)
+            f.write("foo\nbar\n" * 40)
+
+        for pattern in [r"foo\sbar", r"foo\nbar", r"foo[^x]bar", r"foo\Wbar"]:
+            res = self.run_cgrep("-c", pattern, path)
+            self.assertEqual(res.stdout.strip(), f"{path}:50", pattern)
+
+        # Subject assertions hold at the end of the file, not of each line.
+        with open(path, "a") as f: f.write("foo\nfoo")
+        for pattern, line in [(r"foo\Z", 2102), (r"foo\z", 2102), (r"\Afoo", 1)]:
+            res = self.run_cgrep("-n", pattern, path)
+            self.assertEqual(res.stdout.splitlines(), ["%s:%d:foo" % (path, line)], pattern)
+
+        res = self.run_cgrep("-n", r"foo\sbar", path)
+        self.assertIn(":1:foo", res.stdout)
+        self.assertIn(":1819:foo", res.stdout)
+        self.assertIn(":2099:foo", res.stdout)
+
+    def test_jit_stack_per_thread(self):
+        # Each long line recurses once per character, past PCRE2's default 32K
+        # JIT stack; every worker needs its own larger one.
+        for i in range(8):
+            with open(os.path.join(self.test_dir, "deep%d.txt" % i), "w") as f:
+                f.write("ab" * 5000 + "c\nab\n" + "ba" * 4000 + "c\n")
+
+        res = self.run_cgrep("-r", "-c", "-w", "4", r"^(a|b)*c$", self.test_dir)
+        self.assertEqual(res.returncode, 0)
+        self.assertEqual(res.stderr, "")
+        self.assertEqual(sorted(line.rsplit(":", 1)[1] for line in res.stdout.splitlines()), ["2"] * 8)
+
+    def test_fixed_strings(self):
+        path = os.path.join(self.test_dir, "fixed.txt")
+        with open(path, "w") as f:
+            f.write("a.b(c)\naxb(c)\nA.B(C)\n")
+
+        res = self.run_cgrep("-F", "a.b(c)", path)
+        self.assertEqual(res.returncode, 0)
+        self.assertEqual(res.stdout.splitlines(), [path + ":a.b(c)"])
+
+        res = self.run_cgrep("-F", "-i", "-n", "a.b(c)", path)
+        self.assertIn("1:a.b(c)", res.stdout)
+        self.assertIn("3:A.B(C)", res.stdout)
+        self.assertNotIn("axb", res.stdout)
+
+    def test_multiple_patterns(self):
+        path = os.path.join(self.test_dir, "multi.txt")
+        with open(path, "w") as f:
+            f.write("she sells\nhis hat\nhers only\nnothing\nHIS CAPS\nabc123\n")
+
+        # All literal: Aho-Corasick
+        res = self.run_cgrep("-e", "he", "-e", "his", path)
+        self.assertEqual(res.returncode, 0)
+        self.assertEqual([l.split(":", 1)[1] for l in res.stdout.splitlines()],
+                         ["she sells", "his hat", "hers only"])
+
+        res = self.run_cgrep("-i", "-n", "-e", "his", "-e", "only", path)
+        self.assertEqual(len(res.stdout.splitlines()), 3)
+        self.assertIn("5:HIS CAPS", res.stdout)
+
+        # Mixed literal and regex: PCRE2 alternation
+        res = self.run_cgrep("-e", "hat", "-e", r"[a-c]+\d+", path)
+        self.assertEqual([l.split(":", 1)[1] for l in res.stdout.splitlines()],
+                         ["his hat", "abc123"])
+
+        pattern_file = os.path.join(self.test_dir, "patterns.lst")
+        with open(pattern_file, "w") as f:
+            f.write("sells\nnothing\n")
+        res = self.run_cgrep("-f", pattern_file, path)
+        self.assertEqual(len(res.stdout.splitlines()), 2)
+        self.assertIn("she sells", res.stdout)
+        self.assertIn("nothing", res.stdout)
+
+        res = self.run_cgrep("-f", os.path.join(self.test_dir, "missing.lst"), path)
+        self.assertNotEqual(res.returncode, 0)
+
+    def test_file_output_not_interleaved(self):
+        # Enough output per file to force early flushes of the worker buffers
+        long_tail = "x" * 300
+        for i in range(8):
+            with open(os.path.join(self.test_dir, "f%d.txt" % i), "w") as f:
+                for j in range(6000):
+                    f.write("match %d %d %s\n" % (i, j, long_tail if j % 3 == 0 else ""))
+
+        res = self.run_cgrep("-r", "-n", "-w", "4", "match", self.test_dir)
+        self.assertEqual(res.returncode, 0)
+        lines = res.stdout.splitlines()
+        self.assertEqual(len(lines), 8 * 6000)
+        files = [line.split(":", 1)[0] for line in lines]
+        runs = [name for k, name in enumerate(files) if k == 0 or files[k - 1] != name]
+        self.assertEqual(len(runs), 8)
+        self.assertEqual(len(set(runs)), 8)
+        first = [line for line in lines if line.startswith(runs[0] + ":")]
+        self.assertEqual(first[5].split(":", 2)[1:], ["6", "match %s 5 " % runs[0][-5]])
+
+    def test_ordered_output(self):
+        for name in ["b", "a/z", "a/m/x", "c/d/e/f"]:
+            subdir = os.path.join(self.test_dir, name)
+            os.makedirs(subdir)
+            for i in (3, 1, 2):
+                with open(os.path.join(subdir, "f%d.txt" % i), "w") as f:
+                    f.write("match %s %d\n" % (name, i) * 50)
+        top = os.path.join(self.test_dir, "top.txt")
+        with open(top, "w") as f:
+            f.write("match top\n")
+
+        outputs = set()
+        for workers in (1, 3, 8):
+            res = self.run_cgrep("-r", "--ordered", "-w", str(workers), "match", self.test_dir, top)
+            self.assertEqual(res.returncode, 0)
+            outputs.add(res.stdout)
+        self.assertEqual(len(outputs), 1)
+
+        lines = outputs.pop().splitlines()
+        self.assertEqual(len(lines), 12 * 50 + 2) # top.txt is also found by the walk
+        files = [line.split(":", 1)[0] for line in lines[:-1]]
+        self.assertEqual(files, sorted(files))
+        self.assertEqual(lines[-1], top + ":match top")
+
+        res = self.run_cgrep("-r", "--sort=path", "match", self.test_dir)
+        self.assertEqual(res.stdout.splitlines(), lines[:-1])
+
+    def test_chunked_large_file(self):
+        path = os.path.join(self.test_dir, "large.log")
+        with open(path, "w") as f:
+            for i in range(20000):
+                f.write("entry %d %s\n" % (i, "hit" if i % 7 == 0 else "miss"))
+            f.write("last hit without newline")
+
+        expected = self.run_cgrep("-n", "--chunk-size=0", "hit", path).stdout
+        self.assertEqual(len(expected.splitlines()), 20000 // 7 + 2)
+        self.assertIn("20001:last hit without newline\n", expected)
+        for chunk_size in ("1K", "4k", "100000"):
+            for workers in ("1", "4"):
+                res = self.run_cgrep("-n", "-w", workers, "--chunk-size=" + chunk_size, "hit", path)
+                self.assertEqual(res.returncode, 0)
+                self.assertEqual(res.stdout, expected)
+
+        res = self.run_cgrep("--chunk-size=12Q", "hit", path)
+        self.assertNotEqual(res.returncode, 0)
+
+    def test_io_uring_matches_blocking_io(self):
+        # Without io_uring support (build or kernel) the flag falls back to blocking I/O.
+        os.makedirs(os.path.join(self.test_dir, "sub"))
+        for i in range(100):
+            with open(os.path.join(self.test_dir, "sub" if i % 2 else "", "f%d.txt" % i), "w") as f:
+                f.write("match %d\nnope\n" % i * (1 + i % 5))
+        with open(os.path.join(self.test_dir, "big.log"), "w") as f:
+            f.write("match big\n" * 20000)
+
+        expected = self.run_cgrep("-rn", "--ordered", "match", self.test_dir).stdout
+        self.assertEqual(len(expected.splitlines()), sum(1 + i % 5 for i in range(100)) + 20000)
+        for workers in ("1", "4"):
+            res = self.run_cgrep("-rn", "--ordered", "--io-uring", "-w", workers, "match", self.test_dir)
+            self.assertEqual(res.returncode, 0)
+            self.assertEqual(res.stdout, expected)
+
+    def test_index_matches_walk(self):
+        files = {
+            "a/one.c": "int Alpha_value = 1;\nbeta\n",
+            "a-b/two.c": "ALPHA\ngamma ray\n",
+            "a/sub/three.txt": "nothing here\nalpha beta gamma\n",
+            "four.md": "al\npha\n",
+            "skip.bin": "alpha\0binary",
+        }
+        for rel, text in files.items():
+            path = os.path.join(self.test_dir, rel)
+            os.makedirs(os.path.dirname(path), exist_ok=True)
+            with open(path, "w") as f: f.write(text)
+
+        res = self.run_cgrep("--index-build", self.test_dir)
+        self.assertEqual(res.returncode, 0)
+        self.assertIn("Indexed 4 files", res.stderr)
+        self.assertTrue(os.path.exists(os.path.join(self.test_dir, ".cgrep-index")))
+
+        queries = [["alpha"], ["-i", "alpha"], ["-F", "-i", "ray"], ["gam+a"], [r"\w+_value"],
+                   ["-e", "beta", "-e", "nothing"], ["a.p"], ["zzz"], ["--include=*.c", "-i", "alpha"]]
+        for query in queries:
+            expected = self.run_cgrep("-r", "--ordered", *query, self.test_dir).stdout
+            res = self.run_cgrep("--index", "--ordered", *query, self.test_dir)
+            self.assertEqual(res.returncode, 0)
+            self.assertEqual(res.stdout, expected, query)
+            res = self.run_cgrep("--index", "-w", "4", *query, self.test_dir)
+            self.assertEqual(sorted(res.stdout.splitlines()), sorted(expected.splitlines()), query)
+
+        # Without an index the whole tree is searched, with a warning.
+        os.remove(os.path.join(self.test_dir, ".cgrep-index"))
+        res = self.run_cgrep("--index", "-i", "alpha", self.test_dir)
+        self.assertIn("Warning", res.stderr)
+        self.assertEqual(len(res.stdout.splitlines()), 3)
+
+    def test_index_update(self):
+        def write(rel, text):
+            path = os.path.join(self.test_dir, rel)
+            os.makedirs(os.path.dirname(path), exist_ok=True)
+            with open(path, "w") as f: f.write(text)
+
+        def check(*patterns):
+            for pattern in patterns:
+                expected = self.run_cgrep("-r", "--ordered", pattern, self.test_dir).stdout
+                res = self.run_cgrep("--index", "--ordered", pattern, self.test_dir)
+                self.assertEqual(res.returncode, 0)
+                self.assertEqual(res.stdout, expected, pattern)
+
+        for i in range(10):
+            write("src/f%d.c" % i, "common line %d\nunique_%d\n" % (i, i))
+        self.run_cgrep("--index-build", self.test_dir)
+        res = self.run_cgrep("--index-update", self.test_dir)
+        self.assertIn("up to date", res.stderr)
+
+        # Edits show up in --index results before the index is updated.
+        write("src/f1.c", "rewritten with fresh_token\n")
+        write("src/new.c", "added fresh_token\n")
+        os.remove(os.path.join(self.test_dir, "src/f2.c"))
+        check("fresh_token", "unique_1", "unique_2", "common")
+
+        res = self.run_cgrep("--index-update", self.test_dir)
+        self.assertEqual(res.returncode, 0)
+        self.assertIn("Re-indexed 2 files", res.stderr)
+        self.assertTrue(os.path.exists(os.path.join(self.test_dir, ".cgrep-index.1")))
+        check("fresh_token", "unique_1", "unique_2", "common")
+
+        # Enough updates merge the segments back into the base.
+        for i in range(4):
+            write("src/g%d.c" % i, "later_%d\n" % i)
+            res = self.run_cgrep("--index-update", self.test_dir)
+            self.assertEqual(res.returncode, 0)
+        self.assertIn("Compacted", res.stderr)
+        self.assertFalse(os.path.exists(os.path.join(self.test_dir, ".cgrep-index.2")))
+        check("fresh_token", "unique_1", "unique_2", "later_", "common")
+
+    def test_stdin_stream(self):
+        # Several blocks' worth, with lines of varying length straddling block boundaries.
+        lines = ["%d %s%s" % (i, "x" * (i * 7919 % 5000), " needle" if i % 97 == 0 else "")
+                 for i in range(1, 3001)]
+        lines.append("y" * (3 * 1024 * 1024) + " needle") # Longer than a block
+        text = "\n".join(lines) + "\nlast needle"
+        expected = ["%d:%s" % (i + 1, line) for i, line in enumerate(text.split("\n")) if "needle" in line]
+
+        res = subprocess.run([CGREP_BIN, "-n", "needle"], input=text, capture_output=True, text=True)
+        self.assertEqual(res.returncode, 0)
+        self.assertEqual(res.stdout.splitlines(), expected)
+
+        # Next to other inputs, standard input is labelled.
+        path = os.path.join(self.test_dir, "file.txt")
+        with open(path, "w") as f: f.write("needle in file\n")
+        res = subprocess.run([CGREP_BIN, "needle", "-", path], input="needle in pipe\n",
+                             capture_output=True, text=True)
+        self.assertEqual(sorted(res.stdout.splitlines()),
+                         ["(standard input):needle in pipe", path + ":needle in file"])
+
+    def test_decompress(self):
+        lines = ["%d %s%s" % (i, "abc" * (i % 50), " ERROR" if i % 101 == 0 else "") for i in range(1, 200001)]
+        text = "\n".join(lines) + "\n"
+        expected = ["%d:%s" % (i + 1, line) for i, line in enumerate(lines) if "ERROR" in line]
+        path = os.path.join(self.test_dir, "app.log.gz")
+        # Two members, as pigz or concatenated rotations write them.
+        with open(path, "wb") as f:
+            f.write(gzip.compress(text[:len(text) // 2].encode()) + gzip.compress(text[len(text) // 2:].encode()))
+
+        res = self.run_cgrep("-z", "-n", "ERROR", path)
+        if "Built without" in res.stderr:
+            self.skipTest("built without zlib")
+        self.assertEqual(res.returncode, 0)
+        self.assertEqual([line[len(path) + 1:] for line in res.stdout.splitlines()], expected)
+
+        # Without -z the compressed file is binary and skipped.
+        self.assertEqual(self.run_cgrep("-n", "ERROR", path).stdout, "")
+
+        with open(path, "rb") as f: data = f.read()
+        with open(path, "wb") as f: f.write(data[:len(data) // 4])
+        res = self.run_cgrep("-z", "ERROR", path)
+        self.assertIn("truncated", res.stderr)
+        self.assertGreater(len(res.stdout.splitlines()), 0)
+
+        # Memory stays bounded: NULs are skipped as binary from the first window, and a
+        # line too long for the largest window ends the search with a warning.
+        with open(path, "wb") as f: f.write(gzip.compress(b"\0" * (20 << 20) + b"\nERROR\n"))
+        res = self.run_cgrep("-z", "ERROR", path)
+        self.assertEqual((res.stdout, res.stderr), ("", ""))
+        with open(path, "wb") as f: f.write(gzip.compress(b"ERROR\n" + b"a" * (20 << 20) + b"\nERROR\n"))
+        res = self.run_cgrep("-z", "-c", "ERROR", path)
+        self.assertEqual(res.stdout, path + ":1\n")
+        self.assertIn("longer than", res.stderr)
+
+        # More output than one early flush holds still comes out whole.
+        many = "".join("ERROR %d %s\n" % (i, "x" * 200) for i in range(20000))
+        with open(path, "wb") as f: f.write(gzip.compress(many.encode()))
+        res = self.run_cgrep("-z", "ERROR", path)
+        self.assertEqual(res.stdout, "".join(path + ":" + line for line in many.splitlines(keepends=True)))
+
+    def test_result_modes(self):
+        hits = os.path.join(self.test_dir, "hits.txt")
+        with open(hits, "w") as f:
+            for i in range(20000):
+                f.write("line %d %s\n" % (i, "hit" if i % 3 == 0 else "miss"))
+        misses = os.path.join(self.test_dir, "misses.txt")
+        with open(misses, "w") as f: f.write("nothing here\n")
+        empty = os.path.join(self.test_dir, "empty.txt")
+        open(empty, "w").close()
+
+        res = self.run_cgrep("-r", "-l", "hit", self.test_dir)
+        self.assertEqual(res.stdout.splitlines(), [hits])
+        res = self.run_cgrep("-r", "-L", "hit", self.test_dir)
+        self.assertEqual(sorted(res.stdout.splitlines()), sorted([misses, empty]))
+        res = self.run_cgrep("-r", "--ordered", "-c", "hit", self.test_dir)
+        self.assertEqual(res.stdout.splitlines(), [empty + ":0", hits + ":6667", misses + ":0"])
+
+        # -m stops at the same lines whether or not the file is searched in chunks.
+        expected = ["%s:%d:line %d hit" % (hits, i + 1, i) for i in range(0, 15, 3)]
+        for chunk_size in ("0", "1K"):
+            res = self.run_cgrep("-n", "-m", "5", "-w", "4", "--chunk-size=" + chunk_size, "hit", hits)
+            self.assertEqual(res.stdout.splitlines(), expected)
+            res = self.run_cgrep("-c", "-m", "100", "--chunk-size=" + chunk_size, "hit", hits)
+            self.assertEqual(res.stdout, hits + ":100\n")
+
+        res = self.run_cgrep("-r", "-q", "hit", self.test_dir)
+        self.assertEqual((res.returncode, res.stdout), (0, ""))
+        res = self.run_cgrep("-r", "-q", "absent", self.test_dir)
+        self.assertEqual((res.returncode, res.stdout), (1, ""))
+
+        # A match settles -m 1 without waiting for the writer to close the pipe.
+        writer = subprocess.Popen(["sh", "-c", "echo hit; sleep 30"], stdout=subprocess.PIPE)
+        try:
+            res = subprocess.run([CGREP_BIN, "-m", "1", "hit"], stdin=writer.stdout, capture_output=True,
+                                 text=True, timeout=10)
+            self.assertEqual(res.stdout, "hit\n")
+        finally:
+            writer.kill()
+            writer.stdout.close()
+            writer.wait()
+
+    def test_stats(self):
+        for i in range(10):
+            with open(os.path.join(self.test_dir, "f%d.txt" % i), "w") as f:
+                f.write("hit\nmiss\nhit again\n" if i % 2 == 0 else "miss\n")
+        with open(os.path.join(self.test_dir, "skip.log"), "w") as f: f.write("hit\n")
+        with open(os.path.join(self.test_dir, "blob.bin"), "wb") as f: f.write(b"hit\0")
+
+        plain = self.run_cgrep("-r", "--exclude", "*.log", "hit", self.test_dir)
+        res = self.run_cgrep("-r", "-w", "3", "--stats=json", "--exclude", "*.log", "hit", self.test_dir)
+        self.assertEqual(res.returncode, 0)
+        self.assertEqual(sorted(res.stdout.splitlines()), sorted(plain.stdout.splitlines()))
+        stats = json.loads(res.stderr)
+        total = stats["total"]
+        self.assertEqual((total["files"], total["dirs"], total["matches"]), (11, 1, 10))
+        self.assertEqual((total["binary_skipped"], total["filtered"]), (1, 1))
+        self.assertEqual(len(stats["per_thread"]), 4) # The main thread and three workers
+        self.assertEqual(sum(t["files"] for t in stats["per_thread"]), 11)
+        self.assertIn("match", total["time_s"])
+        io = stats["io"]
+        searched = [f for f in os.listdir(self.test_dir) if not f.endswith(".log")]
+        size = sum(os.path.getsize(os.path.join(self.test_dir, f)) for f in searched)
+        self.assertEqual(io["files_read"] + io["files_mapped"], 11)
+        self.assertEqual(io["bytes_read"] + io["bytes_mapped"], size)
+        self.assertLessEqual(io["files_populated"], io["files_mapped"])
+
+        res = self.run_cgrep("-r", "--stats", "hit", self.test_dir)
+        self.assertIn("matching lines", res.stderr)
+        self.assertIn("io: 12 files read", res.stderr)
+        self.assertNotIn("stats", self.run_cgrep("-r", "hit", self.test_dir).stderr)
+
+    def test_worker_counts_agree(self):
+        for d in range(4):
+            subdir = os.path.join(self.test_dir, *["d%d" % i for i in range(d + 1)])
+            os.makedirs(subdir)
+            for i in range(20):
+                with open(os.path.join(subdir, "f%d.txt" % i), "w") as f:
+                    f.write("match %d %d\nnope\n" % (d, i))
+
+        expected = None
+        for workers in range(1, 9):
+            res = self.run_cgrep("-r", "-w", str(workers), "match", self.test_dir)
+            self.assertEqual(res.returncode, 0)
+            lines = sorted(res.stdout.splitlines())
+            self.assertEqual(len(lines), 80)
+            if expected is None:
+                expected = lines
+            self.assertEqual(lines, expected)
+
+    def test_worker_sizing(self):
+        for i in range(30):
+            with open(os.path.join(self.test_dir, "f%d.txt" % i), "w") as f:
+                f.write("match %d\nnope\n" % i)
+
+        expected = sorted(self.run_cgrep("-r", "-w", "1", "match", self.test_dir).stdout.splitlines())
+        self.assertEqual(len(expected), 30)
+        for flags in (["-w", "auto"], ["--pin"], ["--adaptive"], ["-w", "2", "--adaptive=6", "--pin"]):
+            res = self.run_cgrep("-r", *flags, "match", self.test_dir)
+            self.assertEqual(res.returncode, 0, flags)
+            self.assertEqual(sorted(res.stdout.splitlines()), expected, flags)
+
+        # Every thread up to the ceiling is started; the scaler moves the active count in between.
+        res = self.run_cgrep("-r", "-w", "2", "--adaptive=6", "--stats=json", "match", self.test_dir)
+        stats = json.loads(res.stderr)
+        self.assertEqual(len(stats["per_thread"]), 7)
+        self.assertEqual(stats["adaptive_workers"]["start"], 2)
+        self.assertTrue(2 <= stats["adaptive_workers"]["peak"] <= 6)
+        self.assertNotIn("adaptive_workers", json.loads(self.run_cgrep("-r", "--stats=json", "match", self.test_dir).stderr))
+        self.assertIn("at least 1", self.run_cgrep("--adaptive=0", "match", self.test_dir).stderr)
+
+    def test_largest_first(self):
+        for d in range(3):
+            subdir = os.path.join(self.test_dir, *["d%d" % i for i in range(d + 1)])
+            os.makedirs(subdir)
+            for i in range(10):
+                with open(os.path.join(subdir, "f%d.txt" % i), "w") as f:
+                    f.write("match %d %d\n" % (d, i))
+        big = os.path.join(self.test_dir, "d0", "d1", "d2", "big.log")
+        with open(big, "w") as f:
+            f.write("match big\n" + "filler line\n" * 200000)
+
+        plain = self.run_cgrep("-r", "match", self.test_dir)
+        for flags in (["-w", "1"], ["-w", "4"], ["-w", "4", "--ordered"], ["-w", "4", "--chunk-size=256K"]):
+            res = self.run_cgrep("-r", "--largest-first", *flags, "match", self.test_dir)
+            self.assertEqual(res.returncode, 0, flags)
+            self.assertEqual(sorted(res.stdout.splitlines()), sorted(plain.stdout.splitlines()), flags)
+
+        # With one worker, the whole tree is listed first and the deepest, biggest file is searched before the rest.
+        res = self.run_cgrep("-r", "-l", "-w", "1", "--largest-first", "match", self.test_dir)
+        self.assertEqual(res.stdout.splitlines()[0], big)
+
 if __name__ == "__main__":
     unittest.main()
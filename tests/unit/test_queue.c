@@ -1,35 +1,51 @@
 #include "unity.h"
 #include "worker.h"
+#include "simd.h"
+#include "order.h"
+#include "io.h"
+#include "discovery.h"
+#include "glob.h"
+#include "cpu.h"
+#include "matcher.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
 
 void setUp(void) {}
 void tearDown(void) {}
 
 void test_queue_basic_push_pop(void) {
     work_queue_t queue;
-    work_queue_init(&queue);
+    work_queue_init(&queue, 2);
 
-    work_queue_push(&queue, "test1.txt");
-    work_queue_push(&queue, "test2.txt");
+    work_queue_push(&queue, NULL, "test1.txt");
+    work_queue_push(&queue, NULL, "test2.txt");
 
-    char *f1 = work_queue_pop(&queue);
-    TEST_ASSERT_EQUAL_STRING("test1.txt", f1);
-    free(f1);
+    char path[64];
+    path_node_t *f1 = work_queue_pop(&queue);
+    path_node_format(f1, path, sizeof(path));
+    TEST_ASSERT_EQUAL_STRING("test1.txt", path);
+    path_node_release(f1);
 
-    char *f2 = work_queue_pop(&queue);
-    TEST_ASSERT_EQUAL_STRING("test2.txt", f2);
-    free(f2);
+    path_node_t *f2 = work_queue_pop(&queue);
+    path_node_format(f2, path, sizeof(path));
+    TEST_ASSERT_EQUAL_STRING("test2.txt", path);
+    path_node_release(f2);
 
     work_queue_destroy(&queue);
 }
 
 void test_queue_done(void) {
     work_queue_t queue;
-    work_queue_init(&queue);
+    work_queue_init(&queue, 2);
 
     work_queue_set_done(&queue);
-    char *file = work_queue_pop(&queue);
+    path_node_t *file = work_queue_pop(&queue);
     TEST_ASSERT_TRUE(file == NULL);
 
     work_queue_destroy(&queue);
@@ -43,14 +59,14 @@ typedef struct {
 void* producer(void *arg) {
     producer_args_t *args = (producer_args_t*)arg;
     for (int i = 0; i < args->count; i++) {
-        work_queue_push(args->queue, "item");
+        work_queue_push(args->queue, NULL, "item");
     }
     return NULL;
 }
 
 void test_queue_concurrent(void) {
     work_queue_t queue;
-    work_queue_init(&queue);
+    work_queue_init(&queue, 2);
 
     pthread_t thread1, thread2;
     producer_args_t args = {&queue, 100};
@@ -60,10 +76,10 @@ void test_queue_concurrent(void) {
 
     int total = 0;
     for (int i = 0; i < 200; i++) {
-        char *file = work_queue_pop(&queue);
+        path_node_t *file = work_queue_pop(&queue);
         if (file) {
             total++;
-            free(file);
+            path_node_release(file);
         }
     }
 
@@ -76,31 +92,430 @@ void test_queue_concurrent(void) {
 
 void test_queue_auto_done(void) {
     work_queue_t queue;
-    work_queue_init(&queue);
+    work_queue_init(&queue, 2);
     
-    work_queue_push(&queue, "item1");
-    work_queue_push(&queue, "item2");
+    work_queue_push(&queue, NULL, "item1");
+    work_queue_push(&queue, NULL, "item2");
     
-    char *f1 = work_queue_pop(&queue);
-    free(f1);
+    path_node_t *f1 = work_queue_pop(&queue);
+    path_node_release(f1);
     work_queue_item_done(&queue);
     
-    char *f2 = work_queue_pop(&queue);
-    free(f2);
+    path_node_t *f2 = work_queue_pop(&queue);
+    path_node_release(f2);
     work_queue_item_done(&queue);
     
     TEST_ASSERT_TRUE(queue.done);
-    char *f3 = work_queue_pop(&queue);
+    path_node_t *f3 = work_queue_pop(&queue);
     TEST_ASSERT_TRUE(f3 == NULL);
     
     work_queue_destroy(&queue);
 }
 
+typedef struct {
+    work_queue_t *queue;
+    atomic_int processed;
+} tree_args_t;
+
+enum { TREE_FANOUT = 6, TREE_DEPTH = 5 };
+
+// Synthetic tree where every inner node has TREE_FANOUT children; workers
+// expand nodes by pushing children below them, like recursive discovery.
+void* tree_worker(void *arg) {
+    tree_args_t *args = (tree_args_t*)arg;
+    work_queue_register_worker(args->queue);
+
+    path_node_t *item;
+    while ((item = work_queue_pop(args->queue)) != NULL) {
+        int depth = 0;
+        for (const path_node_t *iter = item->parent; iter; iter = iter->parent) depth++;
+        if (depth < TREE_DEPTH) {
+            for (int i = 0; i < TREE_FANOUT; i++) {
+                char child[16];
+                snprintf(child, sizeof(child), "c%d", i);
+                work_queue_push(args->queue, item, child);
+            }
+        }
+        atomic_fetch_add(&args->processed, 1);
+        path_node_release(item);
+        work_queue_item_done(args->queue);
+    }
+    return NULL;
+}
+
+void test_path_node_format(void) {
+    path_arena_t arena = { NULL };
+    path_node_t *root = path_node_create(&arena, NULL, "/tmp/dir");
+    path_node_t *sub = path_node_create(&arena, root, "sub");
+    path_node_t *leaf = path_node_create(&arena, sub, "file.c");
+    path_node_release(root);
+    path_node_release(sub);
+
+    char path[64];
+    TEST_ASSERT_EQUAL_INT(19, (int)path_node_format(leaf, path, sizeof(path)));
+    TEST_ASSERT_EQUAL_STRING("/tmp/dir/sub/file.c", path);
+    TEST_ASSERT_EQUAL_INT(0, (int)path_node_format(leaf, path, 10));
+
+    path_node_release(leaf);
+    path_arena_destroy(&arena);
+}
+
+void test_queue_scaling(void) {
+    int expected = 0;
+    for (int level = 0, width = 1; level <= TREE_DEPTH; level++, width *= TREE_FANOUT) {
+        expected += width;
+    }
+
+    for (int num_workers = 1; num_workers <= 8; num_workers++) {
+        work_queue_t queue;
+        work_queue_init(&queue, (size_t)num_workers);
+        tree_args_t args = { .queue = &queue };
+        atomic_init(&args.processed, 0);
+
+        work_queue_hold(&queue);
+        work_queue_push(&queue, NULL, "root");
+
+        pthread_t threads[8];
+        for (int i = 0; i < num_workers; i++) {
+            pthread_create(&threads[i], NULL, tree_worker, &args);
+        }
+        work_queue_item_done(&queue);
+        for (int i = 0; i < num_workers; i++) {
+            pthread_join(threads[i], NULL);
+        }
+
+        TEST_ASSERT_EQUAL_INT(expected, atomic_load(&args.processed));
+        TEST_ASSERT_TRUE(queue.done);
+        work_queue_destroy(&queue);
+    }
+}
+
+// Moves the active worker count around until the tree is searched, like --adaptive does.
+void* toggle_active(void *arg) {
+    work_queue_t *queue = arg;
+    for (size_t i = 0; !atomic_load(&queue->done); i++) {
+        work_queue_set_active_workers(queue, 1 + i % 4);
+        usleep(100);
+    }
+    return NULL;
+}
+
+void test_queue_active_workers(void) {
+    int expected = 0;
+    for (int level = 0, width = 1; level <= TREE_DEPTH; level++, width *= TREE_FANOUT) {
+        expected += width;
+    }
+
+    for (int toggled = 0; toggled <= 1; toggled++) {
+        work_queue_t queue;
+        work_queue_init(&queue, 4);
+        TEST_ASSERT_EQUAL_INT(4, (int)work_queue_active_workers(&queue));
+        work_queue_set_active_workers(&queue, 1);
+        tree_args_t args = { .queue = &queue };
+        atomic_init(&args.processed, 0);
+
+        work_queue_hold(&queue);
+        work_queue_push(&queue, NULL, "root");
+
+        // Parked workers must still exit once the queue is done.
+        pthread_t threads[4];
+        pthread_t toggler;
+        for (int i = 0; i < 4; i++) {
+            pthread_create(&threads[i], NULL, tree_worker, &args);
+        }
+        if (toggled) pthread_create(&toggler, NULL, toggle_active, &queue);
+        work_queue_item_done(&queue);
+        for (int i = 0; i < 4; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        if (toggled) pthread_join(toggler, NULL);
+
+        TEST_ASSERT_EQUAL_INT(expected, atomic_load(&args.processed));
+        work_queue_destroy(&queue);
+    }
+}
+
+// Returns the names in the order they were popped, joined by spaces. Asserts
+// stay on the test's own thread, since a failure jumps back into it.
+void* pop_in_class_order(void *arg) {
+    static const work_class_t classes[] = { WORK_CLASS_SMALL, WORK_CLASS_MEDIUM, WORK_CLASS_HUGE, WORK_CLASS_FIRST,
+                                            WORK_CLASS_LARGE, WORK_CLASS_SMALL };
+    static const char *const names[] = { "first", "huge", "large", "medium", "small" };
+
+    work_queue_t queue;
+    work_queue_init(&queue, 1);
+    if (arg) work_queue_register_worker(&queue);
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        path_node_t *node = work_queue_new_node(&queue, NULL, names[classes[i]]);
+        node->work_class = (uint8_t)classes[i];
+        work_queue_push_node(&queue, node);
+    }
+    char *order = calloc(1, 64);
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        path_node_t *node = work_queue_pop(&queue);
+        if (i > 0) strcat(order, " ");
+        strcat(order, node->name);
+        path_node_release(node);
+    }
+    for (int class = 0; class < WORK_CLASS_MEDIUM; class++) {
+        if (atomic_load(&queue.rare[class]) != 0) strcat(order, " (rare count left)");
+    }
+    work_queue_destroy(&queue);
+    return order;
+}
+
+void test_queue_class_order(void) {
+    // Once through the injector, once through a registered worker's own deques
+    // (on a thread of its own, which the registration does not outlive).
+    char *order = pop_in_class_order(NULL);
+    TEST_ASSERT_EQUAL_STRING("first huge large medium small small", order);
+    free(order);
+
+    static bool registered = true;
+    pthread_t thread;
+    pthread_create(&thread, NULL, pop_in_class_order, &registered);
+    pthread_join(thread, (void **)&order);
+    TEST_ASSERT_EQUAL_STRING("first huge large medium small small", order);
+    free(order);
+}
+
+void test_cpu_count_available(void) {
+    size_t cpus = cpu_count_available();
+    TEST_ASSERT_TRUE(cpus >= 1);
+    TEST_ASSERT_TRUE(cpus <= (size_t)sysconf(_SC_NPROCESSORS_CONF));
+}
+
+void test_simd_kernels(void) {
+    // Cross every vector width and both edges of the counting flush interval.
+    enum { SIMD_TEST_SIZE = 300 * 32 + 77 };
+    static char buffer[SIMD_TEST_SIZE];
+    for (size_t i = 0; i < sizeof(buffer); i++) {
+        buffer[i] = (i * 7919 % 61 == 0) ? '\n' : 'a';
+    }
+
+    size_t lengths[] = { 0, 1, 15, 16, 17, 31, 32, 33, 63, 64, 65, 200, 255 * 32, 255 * 32 + 1, sizeof(buffer) - 3 };
+    for (size_t offset = 0; offset < 3; offset++) {
+        for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+            const char *start = buffer + offset;
+            size_t length = lengths[l];
+            size_t expected_count = 0;
+            const char *expected_first = NULL;
+            const char *expected_last = NULL;
+            for (size_t i = 0; i < length; i++) {
+                if (start[i] != '\n') continue;
+                expected_count++;
+                if (expected_first == NULL) expected_first = start + i;
+                expected_last = start + i;
+            }
+            TEST_ASSERT_EQUAL_INT((int)expected_count, (int)simd_count_byte(start, length, '\n'));
+            TEST_ASSERT_TRUE(expected_first == simd_find_byte(start, length, '\n'));
+            TEST_ASSERT_TRUE(expected_last == simd_rfind_byte(start, length, '\n'));
+            TEST_ASSERT_FALSE(simd_contains_byte(start, length, '\0'));
+        }
+    }
+}
+
+static void finish_with(order_t *order, order_slot_t *slot, output_buffer_t *out, const char *text) {
+    output_write(out, text, strlen(text));
+    order_finish(order, slot, out);
+}
+
+void test_order_reorders_and_spills(void) {
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    FILE *capture = tmpfile();
+    dup2(fileno(capture), STDOUT_FILENO);
+
+    order_t order;
+    order_init(&order, 16);
+    order_slot_t *first = order_append_child(&order, NULL);
+    order_slot_t *dir = order_append_child(&order, NULL);
+    order_slot_t *last = order_append_child(&order, NULL);
+    order_finish(&order, NULL, NULL);
+    order_slot_t *child1 = order_append_child(&order, dir);
+    order_slot_t *child2 = order_append_child(&order, dir);
+
+    output_buffer_t out;
+    output_buffer_init(&out);
+    out.capture = true;
+    finish_with(&order, last, &out, "last, longer than the memory cap\n"); // Spilled
+    finish_with(&order, child2, &out, "child2\n");
+    finish_with(&order, child1, &out, "child1\n");
+    order_finish(&order, dir, NULL);
+    finish_with(&order, first, &out, "first\n"); // Unblocks everything
+    output_buffer_destroy(&out);
+    order_destroy(&order);
+
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    char result[128] = {0};
+    rewind(capture);
+    size_t length = fread(result, 1, sizeof(result) - 1, capture);
+    fclose(capture);
+    result[length] = '\0';
+    TEST_ASSERT_EQUAL_STRING("first\nchild1\nchild2\nlast, longer than the memory cap\n", result);
+}
+
+void test_io_load_strategy(void) {
+    char path[] = "/tmp/cgrep_io_XXXXXX";
+    int fd = mkstemp(path);
+    TEST_ASSERT_TRUE(fd >= 0);
+    unlink(path);
+    const char text[] = "line one\nline two\n";
+    TEST_ASSERT_EQUAL_INT((int)sizeof(text) - 1, (int)write(fd, text, sizeof(text) - 1));
+
+    io_buffer_t buffer = { .data = NULL, .capacity = 0 };
+    io_view_t view;
+    size_t read_before = atomic_load(&io_stats.files_read);
+    size_t mapped_before = atomic_load(&io_stats.files_mapped);
+
+    io_config_t read_config = { .mmap_threshold = 1024, .populate_limit = 0 };
+    TEST_ASSERT_TRUE(io_load(fd, sizeof(text) - 1, &read_config, &buffer, &view));
+    TEST_ASSERT_TRUE(view.region.addr == MAP_FAILED);
+    TEST_ASSERT_TRUE(view.data == buffer.data);
+    TEST_ASSERT_EQUAL_INT(0, memcmp(view.data, text, sizeof(text) - 1));
+    io_view_release(&view);
+
+    io_config_t map_config = { .mmap_threshold = 1, .populate_limit = 1024 };
+    TEST_ASSERT_TRUE(io_load(fd, sizeof(text) - 1, &map_config, &buffer, &view));
+    TEST_ASSERT_TRUE(view.region.addr != MAP_FAILED);
+    TEST_ASSERT_EQUAL_INT(0, memcmp(view.data, text, sizeof(text) - 1));
+    io_view_release(&view);
+
+    TEST_ASSERT_EQUAL_INT(1, (int)(atomic_load(&io_stats.files_read) - read_before));
+    TEST_ASSERT_EQUAL_INT(1, (int)(atomic_load(&io_stats.files_mapped) - mapped_before));
+    io_buffer_destroy(&buffer);
+    close(fd);
+}
+
+void test_glob_set_match(void) {
+    auto_glob_set glob_set_t set = { .count = 0 };
+    const char *patterns[] = { "*.c", "Makefile", "*.tar.gz", "[!a-z]*.h", "src/*.py", "docs/**/*.md", "a\\*b" };
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+        TEST_ASSERT_TRUE(glob_set_add(&set, patterns[i]));
+    }
+    TEST_ASSERT_TRUE(glob_set_compile(&set));
+    TEST_ASSERT_TRUE(glob_set_has_paths(&set));
+
+    TEST_ASSERT_TRUE(glob_set_match(&set, "lib/x.c", "x.c")); // Extension set
+    TEST_ASSERT_TRUE(glob_set_match(&set, "Makefile", "Makefile")); // Name set
+    TEST_ASSERT_TRUE(glob_set_match(&set, "t.tar.gz", "t.tar.gz"));
+    TEST_ASSERT_TRUE(glob_set_match(&set, "X.h", "X.h"));
+    TEST_ASSERT_FALSE(glob_set_match(&set, "x.h", "x.h"));
+    TEST_ASSERT_TRUE(glob_set_match(&set, "src/a.py", "a.py"));
+    TEST_ASSERT_FALSE(glob_set_match(&set, "src/sub/a.py", "a.py")); // '*' stops at '/'
+    TEST_ASSERT_TRUE(glob_set_match(&set, "docs/a.md", "a.md")); // '**/' may match no directory
+    TEST_ASSERT_TRUE(glob_set_match(&set, "docs/x/y/a.md", "a.md"));
+    TEST_ASSERT_TRUE(glob_set_match(&set, "a*b", "a*b"));
+    TEST_ASSERT_FALSE(glob_set_match(&set, "axb", "axb"));
+    TEST_ASSERT_FALSE(glob_set_match(&set, "x.cc", "x.cc"));
+    TEST_ASSERT_FALSE(glob_set_match(&set, "makefile", "makefile"));
+}
+
+static size_t collect_line_numbers(const char *text, const grep_config_t *config, matcher_state_t *state,
+                                   unsigned int *numbers, size_t capacity) {
+    matcher_lines_t lines = { .items = NULL, .count = 0, .capacity = 0 };
+    matcher_collect_lines(text, strlen(text), config, state, &lines, SIZE_MAX);
+    size_t count = lines.count;
+    for (size_t i = 0; i < count && i < capacity; i++) numbers[i] = lines.items[i].line_number;
+    matcher_lines_destroy(&lines);
+    return count;
+}
+
+void test_matcher_interpreter_fallback(void) {
+    // The long line backtracks through one group per character: more than
+    // PCRE2's default 32K JIT stack holds, so the state's own stack is needed.
+    const size_t pairs = 5000;
+    auto_free char *text = malloc(2 * pairs + 64);
+    TEST_ASSERT_TRUE(text != NULL);
+    char *pos = stpcpy(text, "ababc\nxyz\n");
+    for (size_t i = 0; i < pairs; i++) pos = stpcpy(pos, "ab");
+    stpcpy(pos, "c\nc\nabca\n");
+
+    auto_grep_config grep_config_t config = { .line_numbering = true, .max_count = SIZE_MAX };
+    const char *pattern = "^(a|b)*c$";
+    TEST_ASSERT_TRUE(matcher_compile(&config, &pattern, 1));
+    TEST_ASSERT_EQUAL_INT(MATCHER_ENGINE_PCRE2, config.engine);
+
+    auto_matcher_state matcher_state_t state;
+    TEST_ASSERT_TRUE(matcher_state_init(&state, &config));
+    uint32_t jit_available = 0;
+    pcre2_config(PCRE2_CONFIG_JIT, &jit_available);
+    TEST_ASSERT_EQUAL_INT(jit_available != 0, state.use_jit);
+
+    unsigned int numbers[8];
+    const unsigned int expected[] = { 1, 3, 4 };
+    TEST_ASSERT_EQUAL_INT(3, (int)collect_line_numbers(text, &config, &state, numbers, 8));
+    TEST_ASSERT_EQUAL_INT(0, memcmp(expected, numbers, sizeof(expected)));
+
+    // As when JIT compiling failed: the interpreter must find the same lines.
+    state.use_jit = false;
+    memset(numbers, 0, sizeof(numbers));
+    TEST_ASSERT_EQUAL_INT(3, (int)collect_line_numbers(text, &config, &state, numbers, 8));
+    TEST_ASSERT_EQUAL_INT(0, memcmp(expected, numbers, sizeof(expected)));
+}
+
+void test_directory_walk_types(void) {
+    char root[] = "/tmp/cgrep_walk_XXXXXX";
+    TEST_ASSERT_TRUE(mkdtemp(root) != NULL);
+    char sub[PATH_MAX], file[PATH_MAX];
+    snprintf(sub, sizeof(sub), "%s/sub", root);
+    snprintf(file, sizeof(file), "%s/file.txt", root);
+    TEST_ASSERT_EQUAL_INT(0, mkdir(sub, 0700));
+    int fd = open(file, O_WRONLY | O_CREAT, 0600);
+    TEST_ASSERT_TRUE(fd >= 0);
+    close(fd);
+
+    work_queue_t queue;
+    work_queue_init(&queue, 1);
+    discovery_config_t config = {
+        .ignore_binary = true, .recursive = true, .order = NULL
+    };
+    work_queue_hold(&queue);
+    discover_files(root, NULL, &config, &queue);
+
+    // Children carry their d_type and resolve against the root's held descriptor.
+    for (int i = 0; i < 2; i++) {
+        path_node_t *node = work_queue_pop(&queue);
+        TEST_ASSERT_TRUE(node != NULL);
+        TEST_ASSERT_TRUE(node->parent != NULL && node->parent->dir_fd >= 0);
+        if (strcmp(node->name, "sub") == 0) {
+            TEST_ASSERT_EQUAL_INT(DT_DIR, node->type);
+        } else {
+            TEST_ASSERT_EQUAL_STRING("file.txt", node->name);
+            TEST_ASSERT_EQUAL_INT(DT_REG, node->type);
+            fd = path_node_open(node, "/nonexistent", O_RDONLY);
+            TEST_ASSERT_TRUE(fd >= 0);
+            close(fd);
+        }
+        path_node_release(node);
+        work_queue_item_done(&queue);
+    }
+    work_queue_item_done(&queue);
+    TEST_ASSERT_TRUE(work_queue_pop(&queue) == NULL);
+    work_queue_destroy(&queue);
+
+    unlink(file);
+    rmdir(sub);
+    rmdir(root);
+}
+
 int main(void) {
     UNITY_BEGIN();
     RUN_TEST(test_queue_basic_push_pop);
     RUN_TEST(test_queue_done);
     RUN_TEST(test_queue_concurrent);
     RUN_TEST(test_queue_auto_done);
+    RUN_TEST(test_path_node_format);
+    RUN_TEST(test_queue_scaling);
+    RUN_TEST(test_queue_active_workers);
+    RUN_TEST(test_queue_class_order);
+    RUN_TEST(test_cpu_count_available);
+    RUN_TEST(test_simd_kernels);
+    RUN_TEST(test_order_reorders_and_spills);
+    RUN_TEST(test_io_load_strategy);
+    RUN_TEST(test_glob_set_match);
+    RUN_TEST(test_matcher_interpreter_fallback);
+    RUN_TEST(test_directory_walk_types);
     return UNITY_END();
 }